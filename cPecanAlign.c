@@ -4,7 +4,7 @@
 #include "commonC.h"
 
 static void usage(char *argv[]) {
-    fprintf(stderr, "%s fasta_target fasta_query\n", argv[0]);
+    fprintf(stderr, "%s fasta_target fasta_query [anchor_cache_directory]\n", argv[0]);
 }
 
 // Returns a hash mapping from sequence header to sequence data.
@@ -90,7 +90,7 @@ struct PairwiseAlignment *convertAlignedPairsToPairwiseAlignment(char *seqName1,
 
 int main(int argc, char *argv[]) {
     // Parse arguments
-    if (argc != 3) {
+    if (argc != 3 && argc != 4) {
         usage(argv);
         return 1;
     }
@@ -101,9 +101,30 @@ int main(int argc, char *argv[]) {
 
     PairwiseAlignmentParameters *parameters = pairwiseAlignmentBandingParameters_construct();
 
+    // Keep the anchors found in the directory, if given, so aligning the
+    // same sequences again skips finding them.
+    AnchorCache *anchorCache = NULL;
+    if (argc == 4) {
+        anchorCache = anchorCache_construct(argv[3]);
+        parameters->anchorCache = anchorCache;
+    }
+
     stHash *targetSequences = readFastaFile(argv[1]);
     stHash *querySequences = readFastaFile(argv[2]);
 
+    // If anchoring in process, index each target sequence for anchoring
+    // once, rather than for every query it is aligned to.
+    stHash *targetIndexes = stHash_construct2(NULL, (void (*)(void *)) seedIndex_destruct);
+    if (parameters->anchorMethod == seedAnchors) {
+        stHashIterator *targetIndexIt = stHash_getIterator(targetSequences);
+        char *targetIndexHeader;
+        while ((targetIndexHeader = stHash_getNext(targetIndexIt)) != NULL) {
+            char *targetSeq = stHash_search(targetSequences, targetIndexHeader);
+            stHash_insert(targetIndexes, targetSeq, seedIndex_construct(targetSeq, strlen(targetSeq), 1));
+        }
+        stHash_destructIterator(targetIndexIt);
+    }
+
     // For each query sequence, align it against all target sequences.
     stHashIterator *queryIt = stHash_getIterator(querySequences);
     char *queryHeader;
@@ -117,12 +138,16 @@ int main(int argc, char *argv[]) {
             // reverse-complemented version
 
 
-            // Aligns the sequences.
-            // If you have alignment constraints (anchors) you should
-            // replace this with getAlignedPairsUsingAnchors.
-            stList *alignedPairs = getAlignedPairs(stateMachine, targetSeq,
-                                                   querySeq, parameters,
-                                                   true, true);
+            // Aligns the sequences, anchored using the target's index, if
+            // it has one.
+            // If you have your own alignment constraints (anchors) you
+            // should use them in place of these.
+            stList *anchorPairs = getBlastPairsForPairwiseAlignmentParametersUsingIndex(targetSeq, querySeq,
+                    strlen(targetSeq), strlen(querySeq), stHash_search(targetIndexes, targetSeq), parameters);
+            stList *alignedPairs = getAlignedPairsUsingAnchors(stateMachine, targetSeq,
+                                                               querySeq, anchorPairs, parameters,
+                                                               true, true);
+            stList_destruct(anchorPairs);
             // Takes into account the probability of aligning to a
             // gap, by transforming the posterior probability into the
             // AMAP objective function (see Schwartz & Pachter, 2007).
@@ -156,9 +181,13 @@ int main(int argc, char *argv[]) {
     stHash_destructIterator(queryIt);
 
     // Clean up
+    stHash_destruct(targetIndexes);
     stHash_destruct(targetSequences);
     stHash_destruct(querySequences);
 
     pairwiseAlignmentBandingParameters_destruct(parameters);
+    if (anchorCache != NULL) {
+        anchorCache_destruct(anchorCache);
+    }
     stateMachine_destruct(stateMachine);
 }
@@ -0,0 +1,103 @@
+/*
+ * Micro-benchmark for the logAdd implementations in logAdd.h. Reports throughput and the
+ * maximum absolute error against log(exp(x) + exp(y)) computed in long double precision.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "sonLib.h"
+#include "pairwiseAligner.h"
+
+static void usage(char *argv[]) {
+    fprintf(stderr, "%s [pairs (default 65536)] [repeats (default 1000)]\n", argv[0]);
+}
+
+static double exactLogAdd(double x, double y) {
+    if (x == LOG_ZERO && y == LOG_ZERO) {
+        return LOG_ZERO;
+    }
+    long double mx = x > y ? x : y, mn = x > y ? y : x;
+    return (double) (mx + log1pl(expl(mn - mx)));
+}
+
+static double maxError(double *z, double *exact, int64_t pairs) {
+    double maxError = 0.0;
+    for (int64_t i = 0; i < pairs; i++) {
+        double e = exact[i] == LOG_ZERO ? (z[i] == LOG_ZERO ? 0.0 : INFINITY) : fabs(z[i] - exact[i]);
+        maxError = e > maxError ? e : maxError;
+    }
+    return maxError;
+}
+
+static void report(const char *name, double seconds, int64_t operations, double *z, double *exact, int64_t pairs) {
+    fprintf(stdout, "%-24s %8.1f million logAdds/s  max abs error %.3g\n", name, operations / seconds / 1.0e6,
+            maxError(z, exact, pairs));
+}
+
+//Macros rather than functions taking a function pointer, so that the logAdd is inlined into the timed loop.
+#define BENCHMARK_SCALAR(name, fn, repeats) { \
+    clock_t start = clock(); \
+    for (int64_t r = 0; r < repeats; r++) { \
+        for (int64_t i = 0; i < pairs; i++) { \
+            z[i] = fn(x[i], y[i]); \
+        } \
+    } \
+    report(name, ((double) (clock() - start)) / CLOCKS_PER_SEC, pairs * repeats, z, exact, pairs); \
+}
+
+#define BENCHMARK_SIMD(name, fn, repeats) { \
+    clock_t start = clock(); \
+    for (int64_t r = 0; r < repeats; r++) { \
+        for (int64_t i = 0; i < pairs; i += SIMD_WIDTH) { \
+            simd_store(z + i, fn(simd_load(x + i), simd_load(y + i))); \
+        } \
+    } \
+    report(name, ((double) (clock() - start)) / CLOCKS_PER_SEC, pairs * repeats, z, exact, pairs); \
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 3) {
+        usage(argv);
+        return 1;
+    }
+    int64_t pairs = argc > 1 ? atol(argv[1]) : 65536;
+    int64_t repeats = argc > 2 ? atol(argv[2]) : 1000;
+    pairs -= pairs % SIMD_WIDTH;
+    if (pairs <= 0 || repeats <= 0) {
+        usage(argv);
+        return 1;
+    }
+
+    //Log probabilities as seen in the dp, with differences spread over [0, 40] and a few LOG_ZEROs.
+    double *x = st_malloc(sizeof(double) * pairs);
+    double *y = st_malloc(sizeof(double) * pairs);
+    double *z = st_malloc(sizeof(double) * pairs);
+    double *exact = st_malloc(sizeof(double) * pairs);
+    for (int64_t i = 0; i < pairs; i++) {
+        x[i] = -st_random() * 1000.0;
+        y[i] = x[i] + (st_random() - 0.5) * 80.0;
+        if (st_random() < 0.01) {
+            x[i] = LOG_ZERO;
+        }
+        if (st_random() < 0.01) {
+            y[i] = LOG_ZERO;
+        }
+        exact[i] = exactLogAdd(x[i], y[i]);
+    }
+
+    fprintf(stdout, "%" PRIi64 " pairs, %" PRIi64 " repeats, SIMD width %i, dp uses %s\n", pairs, repeats, SIMD_WIDTH,
+            LOG_ADD_PRECISION == LOG_ADD_PRECISE ? "LOG_ADD_PRECISE" : "LOG_ADD_INTERPOLATED");
+    BENCHMARK_SCALAR("exact (libm)", exactLogAdd, repeats / 10 + 1)
+    BENCHMARK_SCALAR("interpolated", logAdd_interpolated, repeats)
+    BENCHMARK_SIMD("interpolated SIMD", simd_logAddInterpolated, repeats)
+    BENCHMARK_SCALAR("precise", logAdd_precise, repeats)
+    BENCHMARK_SIMD("precise SIMD", simd_logAddPrecise, repeats)
+    BENCHMARK_SCALAR("logAdd (exported)", logAdd, repeats)
+
+    free(x);
+    free(y);
+    free(z);
+    free(exact);
+    return 0;
+}
@@ -27,6 +27,8 @@ void usage() {
     fprintf(stderr, "-t --constraintDiagonalTrim : (int >= 0) Amount to trim from ends of each anchor\n");
     fprintf(stderr,
             "-w --alignAmbiguityCharacters : Align ambiguity characters (anything not ACTGactg) as a wildcard\n");
+    fprintf(stderr,
+            "-S --scaledProbabilities : Do the dp with scaled probabilities rather than log probabilities, which is faster\n");
     fprintf(stderr,
             "-x --rescoreOriginalAlignment : Rescore the original alignment. The output cigar is the same alignment.\n");
     fprintf(stderr, "-i --rescoreByIdentity : Set score equal to alignment identity, treating indels as mismatches.\n");
@@ -442,11 +444,12 @@ int main(int argc, char *argv[]) {
                 { "outputAllPosteriorProbs", required_argument, 0, 'z' },
                 { "outputExpectations", required_argument, 0, 'v' },
                 { "loadHmm", required_argument, 0, 'y' },
+                { "scaledProbabilities", no_argument, 0, 'S' },
                 { 0, 0, 0, 0 } };
 
         int option_index = 0;
 
-        int key = getopt_long(argc, argv, "a:hl:o:r:t:s:wxijkmuv:y:z:L:", long_options, &option_index);
+        int key = getopt_long(argc, argv, "a:hl:o:r:t:s:wxijkmuv:y:z:L:S", long_options, &option_index);
 
         if (key == -1) {
             break;
@@ -490,6 +493,9 @@ int main(int argc, char *argv[]) {
         case 'w':
             pairwiseAlignmentBandingParameters->alignAmbiguityCharacters = 1;
             break;
+        case 'S':
+            pairwiseAlignmentBandingParameters->scaledProbabilities = 1;
+            break;
         case 'x':
             rescoreOriginalAlignment = 1;
             break;
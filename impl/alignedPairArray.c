@@ -0,0 +1,63 @@
+/*
+ * alignedPairArray.c
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "sonLib.h"
+#include "alignedPairArray.h"
+
+AlignedPairArray *alignedPairArray_construct() {
+    return st_calloc(1, sizeof(AlignedPairArray));
+}
+
+void alignedPairArray_destruct(AlignedPairArray *alignedPairs) {
+    free(alignedPairs->scores);
+    free(alignedPairs->x);
+    free(alignedPairs->y);
+    free(alignedPairs);
+}
+
+static int64_t *resizeArray(int64_t *array, int64_t length) {
+    array = realloc(array, length * sizeof(int64_t));
+    if (array == NULL) {
+        st_errAbort("Could not allocate room for %" PRIi64 " aligned pairs", length);
+    }
+    return array;
+}
+
+void alignedPairArray_reserve(AlignedPairArray *alignedPairs, int64_t length) {
+    if (length > alignedPairs->maxLength) {
+        alignedPairs->scores = resizeArray(alignedPairs->scores, length);
+        alignedPairs->x = resizeArray(alignedPairs->x, length);
+        alignedPairs->y = resizeArray(alignedPairs->y, length);
+        alignedPairs->maxLength = length;
+    }
+}
+
+void alignedPairArray_appendArray(AlignedPairArray *alignedPairs, AlignedPairArray *alignedPairs2, int64_t offsetX,
+        int64_t offsetY) {
+    int64_t length = alignedPairs->length, length2 = alignedPairs2->length;
+    if (length + length2 > alignedPairs->maxLength) {
+        int64_t maxLength = 2 * alignedPairs->maxLength;
+        alignedPairArray_reserve(alignedPairs, length + length2 > maxLength ? length + length2 : maxLength);
+    }
+    memcpy(alignedPairs->scores + length, alignedPairs2->scores, length2 * sizeof(int64_t));
+    for (int64_t i = 0; i < length2; i++) {
+        alignedPairs->x[length + i] = alignedPairs2->x[i] + offsetX;
+        alignedPairs->y[length + i] = alignedPairs2->y[i] + offsetY;
+    }
+    alignedPairs->length += length2;
+}
+
+void alignedPairArray_clear(AlignedPairArray *alignedPairs) {
+    alignedPairs->length = 0;
+}
+
+stList *alignedPairArray_getList(AlignedPairArray *alignedPairs) {
+    stList *list = stList_construct3(alignedPairs->length, (void (*)(void *)) stIntTuple_destruct);
+    for (int64_t i = 0; i < alignedPairs->length; i++) {
+        stList_set(list, i, stIntTuple_construct3(alignedPairs->scores[i], alignedPairs->x[i], alignedPairs->y[i]));
+    }
+    return list;
+}
@@ -0,0 +1,352 @@
+/*
+ * anchorCache.c
+ *
+ *  Each x and y coordinate is stored as its zigzag encoded difference from
+ *  the last, in 7 bit groups, so the increasing anchors of an alignment take
+ *  about two bytes a pair. Files are written under a temporary name and
+ *  renamed, so a process reading the directory never sees half a file. A
+ *  file that is truncated or corrupt anyway is treated as a miss. When the
+ *  entries in memory outgrow the cache's limit, entries are dropped from
+ *  memory, in no particular order, until they fill half of it.
+ */
+//For getpid
+#define _XOPEN_SOURCE 500
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "sonLib.h"
+#include "anchorCache.h"
+
+//The start of every cache file, with the version of the format
+static const char ANCHOR_CACHE_MAGIC[8] = { 'c', 'P', 'A', 'n', 'c', 'h', '0', '1' };
+
+typedef struct _anchorCacheKey {
+    uint64_t hashX, hashY;
+    int64_t lX, lY;
+    uint64_t parameterHash;
+} AnchorCacheKey;
+
+typedef struct _cachedAnchors {
+    int64_t pairNumber;
+    int64_t byteNumber;
+    uint8_t *bytes;
+} CachedAnchors;
+
+struct _anchorCache {
+    char *directory; //NULL if the cache is only in memory
+    stHash *anchors; //AnchorCacheKey to CachedAnchors
+    int64_t memory; //The bytes taken by the entries in anchors, see cachedAnchors_getMemory
+    int64_t maxMemory;
+    pthread_mutex_t mutex; //Guards anchors, memory and temporaryFiles
+    int64_t temporaryFiles; //Makes the temporary file names of a process unique
+};
+
+///////////////////////////////////
+///////////////////////////////////
+//Keys
+///////////////////////////////////
+///////////////////////////////////
+
+static uint64_t hashBytes(const void *bytes, int64_t length, uint64_t hash) {
+    /*
+     * 64 bit FNV-1a hash, continuing from hash.
+     */
+    const uint8_t *b = bytes;
+    for (int64_t i = 0; i < length; i++) {
+        hash = (hash ^ b[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+
+static AnchorCacheKey getKey(const char *sX, const char *sY, int64_t lX, int64_t lY, const int64_t *parameters,
+        int64_t parameterNumber) {
+    AnchorCacheKey key = { hashBytes(sX, lX, FNV_OFFSET_BASIS), hashBytes(sY, lY, FNV_OFFSET_BASIS), lX, lY,
+            hashBytes(parameters, parameterNumber * sizeof(int64_t), FNV_OFFSET_BASIS) };
+    return key;
+}
+
+static uint64_t anchorCacheKey_hash(const void *key) {
+    return hashBytes(key, sizeof(AnchorCacheKey), FNV_OFFSET_BASIS);
+}
+
+static int anchorCacheKey_equals(const void *key1, const void *key2) {
+    return memcmp(key1, key2, sizeof(AnchorCacheKey)) == 0;
+}
+
+///////////////////////////////////
+///////////////////////////////////
+//Encoding
+///////////////////////////////////
+///////////////////////////////////
+
+static void cachedAnchors_destruct(CachedAnchors *cachedAnchors) {
+    free(cachedAnchors->bytes);
+    free(cachedAnchors);
+}
+
+static int64_t writeVarint(uint8_t *bytes, int64_t i) {
+    /*
+     * Writes i, zigzag encoded so small negative numbers are short too, 7 bits a byte, returning the bytes written.
+     */
+    uint64_t j = ((uint64_t) i << 1) ^ (uint64_t) (i >> 63);
+    int64_t k = 0;
+    while (j >= 0x80) {
+        bytes[k++] = (uint8_t) (j | 0x80);
+        j >>= 7;
+    }
+    bytes[k++] = (uint8_t) j;
+    return k;
+}
+
+static int64_t cachedAnchors_getMemory(CachedAnchors *cachedAnchors) {
+    return cachedAnchors->byteNumber + sizeof(CachedAnchors) + sizeof(AnchorCacheKey);
+}
+
+static int64_t readVarint(const uint8_t *bytes, int64_t byteNumber, int64_t *i) {
+    /*
+     * Reads an integer written by writeVarint from the byteNumber bytes, returning the bytes read, or -1 if it runs
+     * past them or is longer than any writeVarint writes.
+     */
+    uint64_t j = 0;
+    int64_t k = 0;
+    for (int64_t shift = 0;; shift += 7) {
+        if (k == byteNumber || k == 10) {
+            return -1;
+        }
+        j |= (uint64_t) (bytes[k] & 0x7F) << shift;
+        if ((bytes[k++] & 0x80) == 0) {
+            break;
+        }
+    }
+    *i = (int64_t) (j >> 1) ^ -(int64_t) (j & 1);
+    return k;
+}
+
+static CachedAnchors *encodeAnchors(stList *anchorPairs) {
+    CachedAnchors *cachedAnchors = st_malloc(sizeof(CachedAnchors));
+    cachedAnchors->pairNumber = stList_length(anchorPairs);
+    uint8_t *bytes = st_malloc(cachedAnchors->pairNumber * 20 + 1); //At most 10 bytes a coordinate
+    int64_t byteNumber = 0, pX = 0, pY = 0;
+    for (int64_t i = 0; i < stList_length(anchorPairs); i++) {
+        stIntTuple *anchorPair = stList_get(anchorPairs, i);
+        byteNumber += writeVarint(bytes + byteNumber, stIntTuple_get(anchorPair, 0) - pX);
+        byteNumber += writeVarint(bytes + byteNumber, stIntTuple_get(anchorPair, 1) - pY);
+        pX = stIntTuple_get(anchorPair, 0);
+        pY = stIntTuple_get(anchorPair, 1);
+    }
+    cachedAnchors->byteNumber = byteNumber;
+    cachedAnchors->bytes = st_malloc(byteNumber + 1);
+    memcpy(cachedAnchors->bytes, bytes, byteNumber);
+    free(bytes);
+    return cachedAnchors;
+}
+
+static stList *decodeAnchors(CachedAnchors *cachedAnchors) {
+    /*
+     * Returns the anchor pairs, or NULL if the bytes do not hold exactly pairNumber pairs, as from a corrupt file.
+     */
+    stList *anchorPairs = stList_construct3(cachedAnchors->pairNumber, (void (*)(void *)) stIntTuple_destruct);
+    int64_t byteNumber = 0, x = 0, y = 0;
+    for (int64_t i = 0; i < cachedAnchors->pairNumber; i++) {
+        int64_t dX, dY, k, l;
+        if ((k = readVarint(cachedAnchors->bytes + byteNumber, cachedAnchors->byteNumber - byteNumber, &dX)) < 0
+                || (l = readVarint(cachedAnchors->bytes + byteNumber + k, cachedAnchors->byteNumber - byteNumber - k,
+                        &dY)) < 0) {
+            stList_destruct(anchorPairs);
+            return NULL;
+        }
+        byteNumber += k + l;
+        x += dX;
+        y += dY;
+        stList_set(anchorPairs, i, stIntTuple_construct2(x, y));
+    }
+    if (byteNumber != cachedAnchors->byteNumber) { //Bytes left over
+        stList_destruct(anchorPairs);
+        return NULL;
+    }
+    return anchorPairs;
+}
+
+///////////////////////////////////
+///////////////////////////////////
+//Files
+///////////////////////////////////
+///////////////////////////////////
+
+static char *getFileName(AnchorCache *cache, AnchorCacheKey *key) {
+    return stString_print("%s/%016" PRIx64 ".anchors", cache->directory, anchorCacheKey_hash(key));
+}
+
+static CachedAnchors *readCachedAnchors(AnchorCache *cache, AnchorCacheKey *key) {
+    /*
+     * Reads the anchors for the key from the directory, returning NULL if there is no file for the key, or its file is
+     * for another key with the same hash or is not a whole cache file. The anchors are not decoded, see decodeAnchors.
+     */
+    char *fileName = getFileName(cache, key);
+    FILE *fileHandle = fopen(fileName, "rb");
+    free(fileName);
+    if (fileHandle == NULL) {
+        return NULL;
+    }
+    char magic[sizeof(ANCHOR_CACHE_MAGIC)];
+    AnchorCacheKey fileKey;
+    CachedAnchors *cachedAnchors = st_calloc(1, sizeof(CachedAnchors));
+    long start, end;
+    //Each pair takes two to twenty bytes, and the bytes must be the rest of the file
+    if (fread(magic, sizeof(magic), 1, fileHandle) != 1 || memcmp(magic, ANCHOR_CACHE_MAGIC, sizeof(magic)) != 0
+            || fread(&fileKey, sizeof(AnchorCacheKey), 1, fileHandle) != 1 || !anchorCacheKey_equals(&fileKey, key)
+            || fread(&cachedAnchors->pairNumber, sizeof(int64_t), 1, fileHandle) != 1
+            || fread(&cachedAnchors->byteNumber, sizeof(int64_t), 1, fileHandle) != 1
+            || cachedAnchors->pairNumber < 0 || cachedAnchors->pairNumber > cachedAnchors->byteNumber / 2
+            || (cachedAnchors->byteNumber + 19) / 20 > cachedAnchors->pairNumber
+            || (start = ftell(fileHandle)) < 0 || fseek(fileHandle, 0, SEEK_END) != 0
+            || (end = ftell(fileHandle)) < 0 || end - start != cachedAnchors->byteNumber
+            || fseek(fileHandle, start, SEEK_SET) != 0
+            || (cachedAnchors->bytes = st_malloc(cachedAnchors->byteNumber + 1)) == NULL
+            || (int64_t) fread(cachedAnchors->bytes, 1, cachedAnchors->byteNumber, fileHandle)
+                    != cachedAnchors->byteNumber) {
+        fclose(fileHandle);
+        cachedAnchors_destruct(cachedAnchors);
+        return NULL;
+    }
+    fclose(fileHandle);
+    return cachedAnchors;
+}
+
+static void writeCachedAnchors(AnchorCache *cache, AnchorCacheKey *key, CachedAnchors *cachedAnchors) {
+    pthread_mutex_lock(&cache->mutex);
+    int64_t temporaryFile = cache->temporaryFiles++;
+    pthread_mutex_unlock(&cache->mutex);
+    char *fileName = getFileName(cache, key);
+    char *temporaryFileName = stString_print("%s.%" PRIi64 ".%" PRIi64 ".tmp", fileName, (int64_t) getpid(),
+            temporaryFile);
+    FILE *fileHandle = fopen(temporaryFileName, "wb");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open anchor cache file %s for writing", temporaryFileName);
+    }
+    if (fwrite(ANCHOR_CACHE_MAGIC, sizeof(ANCHOR_CACHE_MAGIC), 1, fileHandle) != 1
+            || fwrite(key, sizeof(AnchorCacheKey), 1, fileHandle) != 1
+            || fwrite(&cachedAnchors->pairNumber, sizeof(int64_t), 1, fileHandle) != 1
+            || fwrite(&cachedAnchors->byteNumber, sizeof(int64_t), 1, fileHandle) != 1
+            || (int64_t) fwrite(cachedAnchors->bytes, 1, cachedAnchors->byteNumber, fileHandle)
+                    != cachedAnchors->byteNumber || fclose(fileHandle) != 0) {
+        st_errAbort("Could not write anchor cache file %s", temporaryFileName);
+    }
+    if (rename(temporaryFileName, fileName) != 0) {
+        st_errAbort("Could not rename anchor cache file %s to %s", temporaryFileName, fileName);
+    }
+    free(fileName);
+    free(temporaryFileName);
+}
+
+///////////////////////////////////
+///////////////////////////////////
+//Cache
+///////////////////////////////////
+///////////////////////////////////
+
+AnchorCache *anchorCache_construct(const char *directory) {
+    return anchorCache_construct2(directory, ANCHOR_CACHE_MAX_MEMORY);
+}
+
+AnchorCache *anchorCache_construct2(const char *directory, int64_t maxMemory) {
+    AnchorCache *cache = st_malloc(sizeof(AnchorCache));
+    cache->directory = directory != NULL ? stString_copy(directory) : NULL;
+    cache->anchors = stHash_construct3(anchorCacheKey_hash, anchorCacheKey_equals, free,
+            (void (*)(void *)) cachedAnchors_destruct);
+    cache->memory = 0;
+    cache->maxMemory = maxMemory;
+    pthread_mutex_init(&cache->mutex, NULL);
+    cache->temporaryFiles = 0;
+    return cache;
+}
+
+void anchorCache_destruct(AnchorCache *cache) {
+    stHash_destruct(cache->anchors);
+    pthread_mutex_destroy(&cache->mutex);
+    free(cache->directory);
+    free(cache);
+}
+
+static void removeCachedAnchors(AnchorCache *cache, AnchorCacheKey *key) {
+    /*
+     * Removes the anchors of the key from memory, if there. Must hold the cache's mutex.
+     */
+    CachedAnchors *cachedAnchors = stHash_search(cache->anchors, key);
+    if (cachedAnchors != NULL) {
+        cache->memory -= cachedAnchors_getMemory(cachedAnchors);
+        stHash_removeAndFreeKey(cache->anchors, key);
+        cachedAnchors_destruct(cachedAnchors);
+    }
+}
+
+static void insertCachedAnchors(AnchorCache *cache, AnchorCacheKey *key, CachedAnchors *cachedAnchors) {
+    /*
+     * Inserts the anchors in memory, replacing any there, first dropping other entries if they would take the memory
+     * of the cache over its limit. Anchors taking more than the limit alone are not kept. Must hold the cache's mutex.
+     */
+    removeCachedAnchors(cache, key);
+    int64_t memory = cachedAnchors_getMemory(cachedAnchors);
+    if (memory > cache->maxMemory) {
+        cachedAnchors_destruct(cachedAnchors);
+        return;
+    }
+    if (cache->memory + memory > cache->maxMemory) {
+        stList *keys = stHash_getKeys(cache->anchors);
+        for (int64_t i = 0; i < stList_length(keys) && cache->memory + memory > cache->maxMemory / 2; i++) {
+            removeCachedAnchors(cache, stList_get(keys, i));
+        }
+        stList_destruct(keys);
+    }
+    AnchorCacheKey *key2 = st_malloc(sizeof(AnchorCacheKey));
+    *key2 = *key;
+    stHash_insert(cache->anchors, key2, cachedAnchors);
+    cache->memory += memory;
+}
+
+stList *anchorCache_get(AnchorCache *cache, const char *sX, const char *sY, int64_t lX, int64_t lY,
+        const int64_t *parameters, int64_t parameterNumber) {
+    AnchorCacheKey key = getKey(sX, sY, lX, lY, parameters, parameterNumber);
+    stList *anchorPairs = NULL;
+    pthread_mutex_lock(&cache->mutex);
+    CachedAnchors *cachedAnchors = stHash_search(cache->anchors, &key);
+    if (cachedAnchors != NULL) {
+        anchorPairs = decodeAnchors(cachedAnchors);
+    }
+    pthread_mutex_unlock(&cache->mutex);
+    if (anchorPairs == NULL && cache->directory != NULL
+            && (cachedAnchors = readCachedAnchors(cache, &key)) != NULL) {
+        if ((anchorPairs = decodeAnchors(cachedAnchors)) == NULL) { //A corrupt file
+            cachedAnchors_destruct(cachedAnchors);
+            return NULL;
+        }
+        pthread_mutex_lock(&cache->mutex);
+        insertCachedAnchors(cache, &key, cachedAnchors);
+        pthread_mutex_unlock(&cache->mutex);
+    }
+    return anchorPairs;
+}
+
+void anchorCache_add(AnchorCache *cache, const char *sX, const char *sY, int64_t lX, int64_t lY,
+        const int64_t *parameters, int64_t parameterNumber, stList *anchorPairs) {
+    AnchorCacheKey key = getKey(sX, sY, lX, lY, parameters, parameterNumber);
+    CachedAnchors *cachedAnchors = encodeAnchors(anchorPairs);
+    if (cache->directory != NULL) {
+        writeCachedAnchors(cache, &key, cachedAnchors);
+    }
+    pthread_mutex_lock(&cache->mutex);
+    insertCachedAnchors(cache, &key, cachedAnchors);
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+int64_t anchorCache_size(AnchorCache *cache) {
+    pthread_mutex_lock(&cache->mutex);
+    int64_t size = stHash_size(cache->anchors);
+    pthread_mutex_unlock(&cache->mutex);
+    return size;
+}
@@ -0,0 +1,17 @@
+/*
+ * anchorSegments.c
+ */
+
+#include "sonLib.h"
+#include "anchorSegments.h"
+
+void addAnchorSegmentPairs(stList *anchorPairs, int64_t x, int64_t y, int64_t length, int64_t trim, int64_t *pX,
+        int64_t *pY) {
+    for (int64_t i = trim; i < length - trim; i++) {
+        if (x + i > *pX && y + i > *pY) {
+            stList_append(anchorPairs, stIntTuple_construct2(x + i, y + i));
+            *pX = x + i;
+            *pY = y + i;
+        }
+    }
+}
@@ -0,0 +1,329 @@
+/*
+ * minimizerAnchors.c
+ *
+ *  The minimizers of x are sorted, and each minimizer of y is looked up by
+ *  binary search. The chain is a heaviest increasing subsequence of the
+ *  matches with bounded gaps, found with a segment tree of the best chain
+ *  ending at each match, the matches ordered by y.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "sonLib.h"
+#include "minimizerAnchors.h"
+#include "anchorSegments.h"
+
+//The k-mer length and the number of consecutive k-mers in each window, minimap's defaults for nanopore reads
+#define MINIMIZER_K 15
+#define MINIMIZER_W 10
+
+//Minimizers occurring more often than this in x are not used, bounding the matches in repeats
+#define MAX_MINIMIZER_OCCURRENCES 100
+
+//Chains of fewer matches than this are not used, as minimap's -n
+#define MIN_CHAIN_MATCHES 3
+
+//The pairs of the minimizers are packed with their positions, the hash in the high bits
+#define MINIMIZER_POSITION_BITS 34
+
+typedef struct _minimizerMatch {
+    int64_t x, y;
+} MinimizerMatch;
+
+///////////////////////////////////
+///////////////////////////////////
+//Minimizers
+///////////////////////////////////
+///////////////////////////////////
+
+static int64_t getBaseCode(char c) {
+    switch (toupper(c)) {
+        case 'A':
+            return 0;
+        case 'C':
+            return 1;
+        case 'G':
+            return 2;
+        case 'T':
+            return 3;
+        default:
+            return -1;
+    }
+}
+
+static uint64_t hashKmer(uint64_t kmer) {
+    /*
+     * Thomas Wang's invertible integer hash, as used by minimap, over the 2 * MINIMIZER_K bits of the k-mer, so that
+     * the minimizers are not biased to runs of A.
+     */
+    uint64_t mask = ((uint64_t) 1 << (2 * MINIMIZER_K)) - 1;
+    kmer = (~kmer + (kmer << 21)) & mask;
+    kmer = kmer ^ kmer >> 24;
+    kmer = ((kmer + (kmer << 3)) + (kmer << 8)) & mask;
+    kmer = kmer ^ kmer >> 14;
+    kmer = ((kmer + (kmer << 2)) + (kmer << 4)) & mask;
+    kmer = kmer ^ kmer >> 28;
+    kmer = (kmer + (kmer << 31)) & mask;
+    return kmer;
+}
+
+static uint64_t *getMinimizers(const char *s, int64_t l, bool repeatMask, int64_t *minimizerNumber) {
+    /*
+     * Returns the minimizers of the sequence in order, each the hash of the k-mer packed with its position. Windows
+     * holding a k-mer with a base other than A, C, G or T, or repeat masked, take their minimizer from the valid k-mers
+     * alone.
+     */
+    int64_t kmerNumber = l >= MINIMIZER_K ? l - MINIMIZER_K + 1 : 0;
+    uint64_t *hashes = st_malloc((kmerNumber > 0 ? kmerNumber : 1) * sizeof(uint64_t)); //UINT64_MAX if not valid
+    uint64_t kmer = 0, mask = ((uint64_t) 1 << (2 * MINIMIZER_K)) - 1;
+    int64_t validLength = 0; //The number of valid bases ending at i
+    for (int64_t i = 0; i < l; i++) {
+        int64_t code = getBaseCode(s[i]);
+        if (code < 0 || (repeatMask && islower(s[i]))) {
+            validLength = 0;
+            code = 0;
+        } else {
+            validLength++;
+        }
+        kmer = ((kmer << 2) | code) & mask;
+        if (i >= MINIMIZER_K - 1) {
+            hashes[i - MINIMIZER_K + 1] = validLength >= MINIMIZER_K ? hashKmer(kmer) : UINT64_MAX;
+        }
+    }
+    uint64_t *minimizers = st_malloc((kmerNumber > 0 ? kmerNumber : 1) * sizeof(uint64_t));
+    *minimizerNumber = 0;
+    int64_t last = -1; //The position of the last minimizer added
+    for (int64_t i = 0; i < kmerNumber; i++) {
+        //The minimizer of the window of k-mers ending at i
+        int64_t minimum = i;
+        for (int64_t j = i - 1; j >= 0 && j > i - MINIMIZER_W; j--) {
+            if (hashes[j] < hashes[minimum]) {
+                minimum = j;
+            }
+        }
+        if (hashes[minimum] != UINT64_MAX && minimum != last) {
+            minimizers[(*minimizerNumber)++] = (hashes[minimum] << MINIMIZER_POSITION_BITS) | (uint64_t) minimum;
+            last = minimum;
+        }
+    }
+    free(hashes);
+    return minimizers;
+}
+
+static int cmpUint64(const void *a, const void *b) {
+    uint64_t i = *(const uint64_t *) a, j = *(const uint64_t *) b;
+    return i > j ? 1 : (i < j ? -1 : 0);
+}
+
+static int64_t getFirstOccurrence(const uint64_t *minimizers, int64_t minimizerNumber, uint64_t hash) {
+    /*
+     * Returns the first of the sorted minimizers with the given hash, or minimizerNumber if there is none.
+     */
+    uint64_t key = hash << MINIMIZER_POSITION_BITS;
+    int64_t i = 0, j = minimizerNumber;
+    while (i < j) {
+        int64_t k = i + (j - i) / 2;
+        if (minimizers[k] < key) {
+            i = k + 1;
+        } else {
+            j = k;
+        }
+    }
+    return i < minimizerNumber && (minimizers[i] >> MINIMIZER_POSITION_BITS) == hash ? i : minimizerNumber;
+}
+
+static MinimizerMatch *getMatches(const char *sX, const char *sY, int64_t lX, int64_t lY, bool repeatMask,
+        int64_t *matchNumber) {
+    /*
+     * Gets the pairs of positions of x and y with the same minimizer, leaving out minimizers occurring more than
+     * MAX_MINIMIZER_OCCURRENCES times in x.
+     */
+    int64_t minimizerNumberX, minimizerNumberY;
+    uint64_t *minimizersX = getMinimizers(sX, lX, repeatMask, &minimizerNumberX);
+    uint64_t *minimizersY = getMinimizers(sY, lY, repeatMask, &minimizerNumberY);
+    qsort(minimizersX, minimizerNumberX, sizeof(uint64_t), cmpUint64);
+    uint64_t positionMask = ((uint64_t) 1 << MINIMIZER_POSITION_BITS) - 1;
+    int64_t maxMatchNumber = 16;
+    MinimizerMatch *matches = st_malloc(maxMatchNumber * sizeof(MinimizerMatch));
+    *matchNumber = 0;
+    for (int64_t i = 0; i < minimizerNumberY; i++) {
+        uint64_t hash = minimizersY[i] >> MINIMIZER_POSITION_BITS;
+        int64_t first = getFirstOccurrence(minimizersX, minimizerNumberX, hash), last = first;
+        while (last < minimizerNumberX && (minimizersX[last] >> MINIMIZER_POSITION_BITS) == hash) {
+            last++;
+        }
+        if (last - first > MAX_MINIMIZER_OCCURRENCES) {
+            continue;
+        }
+        for (int64_t j = first; j < last; j++) {
+            if (*matchNumber == maxMatchNumber) {
+                maxMatchNumber *= 2;
+                matches = realloc(matches, maxMatchNumber * sizeof(MinimizerMatch));
+                if (matches == NULL) {
+                    st_errAbort("Could not allocate room for %" PRIi64 " minimizer matches", maxMatchNumber);
+                }
+            }
+            matches[*matchNumber].x = minimizersX[j] & positionMask;
+            matches[(*matchNumber)++].y = minimizersY[i] & positionMask;
+        }
+    }
+    free(minimizersX);
+    free(minimizersY);
+    return matches;
+}
+
+///////////////////////////////////
+///////////////////////////////////
+//Chaining
+///////////////////////////////////
+///////////////////////////////////
+
+static int cmpMatches(const void *a, const void *b) {
+    /*
+     * Orders by x, and then by decreasing y, so matches with the same x are never chained to each other.
+     */
+    const MinimizerMatch *i = a, *j = b;
+    return i->x > j->x ? 1 : (i->x < j->x ? -1 : (i->y < j->y ? 1 : (i->y > j->y ? -1 : 0)));
+}
+
+typedef struct _matchRank {
+    int64_t y, match;
+} MatchRank;
+
+static int cmpMatchRanks(const void *a, const void *b) {
+    const MatchRank *i = a, *j = b;
+    return i->y > j->y ? 1 : (i->y < j->y ? -1 : (i->match > j->match ? 1 : (i->match < j->match ? -1 : 0)));
+}
+
+static int64_t getFirstRank(MatchRank *ranks, int64_t matchNumber, int64_t y) {
+    /*
+     * Returns the first of the ranks with at least the given y, or matchNumber if there is none.
+     */
+    int64_t i = 0, j = matchNumber;
+    while (i < j) {
+        int64_t k = i + (j - i) / 2;
+        if (ranks[k].y < y) {
+            i = k + 1;
+        } else {
+            j = k;
+        }
+    }
+    return i;
+}
+
+static void setTree(int64_t *treeScores, int64_t *treeMatches, int64_t leafNumber, int64_t rank, int64_t score,
+        int64_t match) {
+    /*
+     * Sets the leaf of the segment tree of maxima for the given rank, updating the nodes above it.
+     */
+    int64_t i = rank + leafNumber;
+    treeScores[i] = score;
+    treeMatches[i] = match;
+    for (i /= 2; i > 0; i /= 2) {
+        int64_t j = treeScores[2 * i] >= treeScores[2 * i + 1] ? 2 * i : 2 * i + 1;
+        treeScores[i] = treeScores[j];
+        treeMatches[i] = treeMatches[j];
+    }
+}
+
+static int64_t getTreeMaximum(int64_t *treeScores, int64_t *treeMatches, int64_t leafNumber, int64_t firstRank,
+        int64_t lastRank, int64_t *match) {
+    /*
+     * Returns the greatest score of the ranks in [firstRank, lastRank), and its match in *match, or 0 if they have none.
+     */
+    int64_t score = 0;
+    for (int64_t i = firstRank + leafNumber, j = lastRank + leafNumber; i < j; i /= 2, j /= 2) {
+        if (i & 1) {
+            if (treeScores[i] > score) {
+                score = treeScores[i];
+                *match = treeMatches[i];
+            }
+            i++;
+        }
+        if (j & 1) {
+            j--;
+            if (treeScores[j] > score) {
+                score = treeScores[j];
+                *match = treeMatches[j];
+            }
+        }
+    }
+    return score;
+}
+
+static stList *getChain(MinimizerMatch *matches, int64_t matchNumber) {
+    /*
+     * Returns the chain of matches increasing in both x and y with the most matches, in order, no two successive
+     * matches of the chain being more than MINIMIZER_ANCHORS_MAX_GAP apart in either sequence. Taking the matches by x,
+     * the best chain ending at each is one more than the best ending at a lower y within the gap. The best chain ending
+     * at each match is kept in a segment tree of maxima over the matches ordered by y, from which the matches more
+     * than the gap behind in x are removed as the x of the matches taken goes past them.
+     */
+    stList *chain = stList_construct();
+    qsort(matches, matchNumber, sizeof(MinimizerMatch), cmpMatches);
+    MatchRank *ranks = st_malloc((matchNumber > 0 ? matchNumber : 1) * sizeof(MatchRank));
+    for (int64_t i = 0; i < matchNumber; i++) {
+        ranks[i].y = matches[i].y;
+        ranks[i].match = i;
+    }
+    qsort(ranks, matchNumber, sizeof(MatchRank), cmpMatchRanks);
+    int64_t *rankOfMatch = st_malloc((matchNumber > 0 ? matchNumber : 1) * sizeof(int64_t));
+    for (int64_t i = 0; i < matchNumber; i++) {
+        rankOfMatch[ranks[i].match] = i;
+    }
+    int64_t leafNumber = matchNumber > 0 ? matchNumber : 1;
+    int64_t *treeScores = st_calloc(2 * leafNumber, sizeof(int64_t)); //The leaves are at leafNumber + rank
+    int64_t *treeMatches = st_malloc(2 * leafNumber * sizeof(int64_t));
+    int64_t *previous = st_malloc(leafNumber * sizeof(int64_t));
+    int64_t bestScore = 0, best = -1, behind = 0; //The first match not yet removed from the tree
+    for (int64_t i = 0; i < matchNumber; i++) {
+        while (matches[behind].x < matches[i].x - MINIMIZER_ANCHORS_MAX_GAP) {
+            setTree(treeScores, treeMatches, leafNumber, rankOfMatch[behind++], 0, -1);
+        }
+        //The best chain ending below y, within the gap
+        previous[i] = -1;
+        int64_t score = getTreeMaximum(treeScores, treeMatches, leafNumber,
+                getFirstRank(ranks, matchNumber, matches[i].y - MINIMIZER_ANCHORS_MAX_GAP),
+                getFirstRank(ranks, matchNumber, matches[i].y), &previous[i]) + 1;
+        setTree(treeScores, treeMatches, leafNumber, rankOfMatch[i], score, i);
+        if (score > bestScore) {
+            bestScore = score;
+            best = i;
+        }
+    }
+    if (bestScore >= MIN_CHAIN_MATCHES) {
+        for (int64_t i = best; i != -1; i = previous[i]) {
+            stList_append(chain, &matches[i]);
+        }
+        stList_reverse(chain);
+    }
+    free(ranks);
+    free(rankOfMatch);
+    free(treeScores);
+    free(treeMatches);
+    free(previous);
+    return chain;
+}
+
+stList *getMinimizerAnchorPairs(const char *sX, const char *sY, int64_t lX, int64_t lY, int64_t trim, bool repeatMask) {
+    int64_t matchNumber;
+    MinimizerMatch *matches = getMatches(sX, sY, lX, lY, repeatMask, &matchNumber);
+    stList *chain = getChain(matches, matchNumber);
+    //Merge the matches of the chain on the same diagonal with no more than a k-mer between them into segments
+    stList *anchorPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    int64_t pX = -1, pY = -1, segmentX = 0, segmentY = 0, segmentEnd = -1; //The segment's end in x
+    for (int64_t i = 0; i < stList_length(chain); i++) {
+        MinimizerMatch *match = stList_get(chain, i);
+        if (i == 0 || match->x - match->y != segmentX - segmentY || match->x > segmentEnd + MINIMIZER_K) {
+            addAnchorSegmentPairs(anchorPairs, segmentX, segmentY, segmentEnd - segmentX, trim, &pX, &pY);
+            segmentX = match->x;
+            segmentY = match->y;
+        }
+        segmentEnd = match->x + MINIMIZER_K;
+    }
+    addAnchorSegmentPairs(anchorPairs, segmentX, segmentY, segmentEnd - segmentX, trim, &pX, &pY);
+    stList_destruct(chain);
+    free(matches);
+    return anchorPairs;
+}
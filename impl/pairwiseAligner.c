@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <math.h>
 #include <ctype.h>
+#include <pthread.h>
 
 #include "bioioC.h"
 #include "sonLib.h"
@@ -178,6 +179,17 @@ Band *band_construct(stList *anchorPairs, int64_t lX, int64_t lY, int64_t expans
     return band;
 }
 
+void band_narrowDiagonal(Band *band, int64_t xay, int64_t xmyL, int64_t xmyR) {
+    assert(xay >= 0 && xay <= band->lXalY);
+    assert((xay + xmyL) % 2 == 0 && (xay + xmyR) % 2 == 0);
+    Diagonal diagonal = band->diagonals[xay];
+    xmyL = xmyL > diagonal_getMinXmy(diagonal) ? xmyL : diagonal_getMinXmy(diagonal);
+    xmyR = xmyR < diagonal_getMaxXmy(diagonal) ? xmyR : diagonal_getMaxXmy(diagonal);
+    if (xmyL <= xmyR) {
+        band->diagonals[xay] = diagonal_construct(xay, xmyL, xmyR);
+    }
+}
+
 void band_destruct(Band *band) {
     free(band->diagonals);
     free(band);
@@ -225,30 +237,14 @@ Diagonal bandIterator_getPrevious(BandIterator *bandIterator) {
 ///////////////////////////////////
 //Log Add functions
 //
-//Interpolation function for doing log add
+//Function for doing log add, see logAdd.h
 ///////////////////////////////////
 ///////////////////////////////////
 
-#define logUnderflowThreshold 7.5
 #define posteriorMatchThreshold 0.01
 
-static inline double lookup(double x) {
-    //return log (exp (x) + 1);
-    assert(x >= 0.00f);
-    assert(x <= logUnderflowThreshold);
-    if (x <= 1.00f)
-        return ((-0.009350833524763f * x + 0.130659527668286f) * x + 0.498799810682272f) * x + 0.693203116424741f;
-    if (x <= 2.50f)
-        return ((-0.014532321752540f * x + 0.139942324101744f) * x + 0.495635523139337f) * x + 0.692140569840976f;
-    if (x <= 4.50f)
-        return ((-0.004605031767994f * x + 0.063427417320019f) * x + 0.695956496475118f) * x + 0.514272634594009f;
-    return ((-0.000458661602210f * x + 0.009695946122598f) * x + 0.930734667215156f) * x + 0.168037164329057f;
-}
-
 double logAdd(double x, double y) {
-    if (x < y)
-        return (x == LOG_ZERO || y - x >= logUnderflowThreshold) ? y : lookup(y - x) + x;
-    return (y == LOG_ZERO || x - y >= logUnderflowThreshold) ? x : lookup(x - y) + y;
+    return logAdd_inline(x, y);
 }
 
 ///////////////////////////////////
@@ -289,12 +285,29 @@ Symbol *symbol_convertStringToSymbols(const char *s, int64_t sL) {
 }
 
 SymbolString symbolString_construct(const char *sequence, int64_t length) {
+    assert(length >= 0);
+    assert(strlen(sequence) == length);
     SymbolString symbolString;
-    symbolString.sequence = symbol_convertStringToSymbols(sequence, length);
+    //The sequence and its reverse share one allocation, freed with the sequence
+    symbolString.sequence = st_malloc((2 * length + 1) * sizeof(PackedSymbol));
+    symbolString.reversedSequence = symbolString.sequence + length;
+    for (int64_t i = 0; i < length; i++) {
+        symbolString.sequence[i] = symbol_convertCharToSymbol(sequence[i]);
+        symbolString.reversedSequence[length - 1 - i] = symbolString.sequence[i];
+    }
     symbolString.length = length;
     return symbolString;
 }
 
+SymbolString symbolString_getSubString(SymbolString s, int64_t start, int64_t length) {
+    assert(start >= 0 && length >= 0 && start + length <= s.length);
+    SymbolString subString;
+    subString.sequence = s.sequence + start;
+    subString.reversedSequence = s.reversedSequence + (s.length - start - length);
+    subString.length = length;
+    return subString;
+}
+
 void symbolString_destruct(SymbolString s) {
     free(s.sequence);
 }
@@ -309,35 +322,25 @@ void symbolString_destruct(SymbolString s) {
 ///////////////////////////////////
 ///////////////////////////////////
 
-static inline void doTransitionForward(double *fromCells, double *toCells, int64_t from, int64_t to, double eP,
-        double tP, void *extraArgs) {
-    toCells[to] = logAdd(toCells[to], fromCells[from] + (eP + tP));
-}
-
-void cell_calculateForward(StateMachine *sM, double *current, double *lower, double *middle, double *upper, Symbol cX, Symbol cY,
+void cell_calculateForward(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle, DpValue *upper, Symbol cX, Symbol cY,
         void *extraArgs) {
-    sM->cellCalculate(sM, current, lower, middle, upper, cX, cY, doTransitionForward, extraArgs);
+    sM->cellCalculateForward(sM, current, lower, middle, upper, cX, cY, extraArgs);
 }
 
-static inline void doTransitionBackward(double *fromCells, double *toCells, int64_t from, int64_t to, double eP,
-        double tP, void *extraArgs) {
-    fromCells[from] = logAdd(fromCells[from], toCells[to] + (eP + tP));
-}
-
-void cell_calculateBackward(StateMachine *sM, double *current, double *lower, double *middle, double *upper, Symbol cX, Symbol cY,
+void cell_calculateBackward(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle, DpValue *upper, Symbol cX, Symbol cY,
         void *extraArgs) {
-    sM->cellCalculate(sM, current, lower, middle, upper, cX, cY, doTransitionBackward, extraArgs);
+    sM->cellCalculateBackward(sM, current, lower, middle, upper, cX, cY, extraArgs);
 }
 
-double cell_dotProduct(double *cell1, double *cell2, int64_t stateNumber) {
-    double totalProb = cell1[0] + cell2[0];
+double cell_dotProduct(DpValue *cell1, DpValue *cell2, int64_t stateNumber) {
+    double totalProb = (double) cell1[0] + cell2[0];
     for (int64_t i = 1; i < stateNumber; i++) {
-        totalProb = logAdd(totalProb, cell1[i] + cell2[i]);
+        totalProb = logAdd(totalProb, (double) cell1[i] + cell2[i]);
     }
     return totalProb;
 }
 
-double cell_dotProduct2(double *cell, StateMachine *sM, double (*getStateValue)(StateMachine *, int64_t)) {
+double cell_dotProduct2(DpValue *cell, StateMachine *sM, double (*getStateValue)(StateMachine *, int64_t)) {
     double totalProb = cell[0] + getStateValue(sM, 0);
     for (int64_t i = 1; i < sM->stateNumber; i++) {
         totalProb = logAdd(totalProb, cell[i] + getStateValue(sM, i));
@@ -345,28 +348,6 @@ double cell_dotProduct2(double *cell, StateMachine *sM, double (*getStateValue)(
     return totalProb;
 }
 
-static inline void updateExpectations(double *fromCells, double *toCells, int64_t from, int64_t to, double eP,
-        double tP, void *extraArgs) {
-    //void *extraArgs2[2] = { &totalProbability, hmmExpectations };
-    double totalProbability = *((double *) ((void **) extraArgs)[0]);
-    Hmm *hmmExpectations = ((void **) extraArgs)[1];
-    Symbol x = *((Symbol *)((void **) extraArgs)[2]);
-    Symbol y = *((Symbol *)((void **) extraArgs)[3]);
-    //Calculate posterior probability of the transition/emission pair
-    double p = exp(fromCells[from] + toCells[to] + (eP + tP) - totalProbability);
-    //Add in the expectation of the transition
-    hmm_addToTransitionExpectation(hmmExpectations, from, to, p);
-    if(x < SYMBOL_NUMBER_NO_N && y < SYMBOL_NUMBER_NO_N) { //Ignore gaps involving Ns.
-        hmm_addToEmissionsExpectation(hmmExpectations, to, x, y, p);
-    }
-}
-
-static void cell_calculateExpectation(StateMachine *sM, double *current, double *lower, double *middle, double *upper, Symbol cX, Symbol cY,
-        void *extraArgs) {
-    void *extraArgs2[4] = { ((void **)extraArgs)[0], ((void **)extraArgs)[1], &cX, &cY };
-    sM->cellCalculate(sM, current, lower, middle, upper, cX, cY, updateExpectations, extraArgs2);
-}
-
 ///////////////////////////////////
 ///////////////////////////////////
 //DpDiagonal
@@ -378,21 +359,87 @@ static void cell_calculateExpectation(StateMachine *sM, double *current, double
 struct _dpDiagonal {
     Diagonal diagonal;
     int64_t stateNumber;
-    double *cells;
+    bool scaled; //If true the cells hold probabilities divided by 2^scale, rather than log probabilities
+    int64_t scale;
+    //The values of the cells, stored state by state: the values of state s are a plane starting at
+    //cells + s * stateStride, holding the cells in order of increasing xmy. Each plane is 64 byte aligned, so that
+    //the values of a state along the diagonal can be loaded a vector at a time.
+    DpValue *cells;
+    int64_t stateStride;
+    void *cellMemory; //The allocation cells is aligned within
+    int64_t cellCapacity; //The number of values cellMemory has room for
 };
 
-DpDiagonal *dpDiagonal_construct(Diagonal diagonal, int64_t stateNumber) {
+#define dpDiagonalAlignment 64
+
+static int64_t dpDiagonal_getStateStride(Diagonal diagonal) {
+    //The width of the diagonal, rounded up to keep the planes aligned
+    int64_t valuesPerAlignment = dpDiagonalAlignment / sizeof(DpValue);
+    return ((diagonal_getWidth(diagonal) + valuesPerAlignment - 1) / valuesPerAlignment) * valuesPerAlignment;
+}
+
+static void dpDiagonal_allocateCells(DpDiagonal *dpDiagonal, int64_t cellCapacity) {
+    dpDiagonal->cellCapacity = cellCapacity;
+    dpDiagonal->cellMemory = st_malloc(sizeof(DpValue) * cellCapacity + dpDiagonalAlignment);
+    dpDiagonal->cells = (DpValue *) (((uintptr_t) dpDiagonal->cellMemory + dpDiagonalAlignment - 1)
+            & ~((uintptr_t) dpDiagonalAlignment - 1));
+}
+
+static DpDiagonal *dpDiagonal_construct2(Diagonal diagonal, int64_t stateNumber, bool scaled) {
     DpDiagonal *dpDiagonal = st_malloc(sizeof(DpDiagonal));
     dpDiagonal->diagonal = diagonal;
     dpDiagonal->stateNumber = stateNumber;
+    dpDiagonal->scaled = scaled;
+    dpDiagonal->scale = 0;
     assert(diagonal_getWidth(diagonal) >= 0);
-    dpDiagonal->cells = st_malloc(sizeof(double) * stateNumber * (int64_t) diagonal_getWidth(diagonal));
+    dpDiagonal->stateStride = dpDiagonal_getStateStride(diagonal);
+    dpDiagonal_allocateCells(dpDiagonal, stateNumber * dpDiagonal->stateStride);
     return dpDiagonal;
 }
 
+static void dpDiagonal_reuse(DpDiagonal *dpDiagonal, Diagonal diagonal) {
+    /*
+     * Makes an unused diagonal into a diagonal with the given coordinates, so that its memory can be reused. The cells
+     * are only reallocated if there is not room for them, and their values are left undefined.
+     */
+    assert(diagonal_getWidth(diagonal) >= 0);
+    dpDiagonal->stateStride = dpDiagonal_getStateStride(diagonal);
+    int64_t cellNumber = dpDiagonal->stateNumber * dpDiagonal->stateStride;
+    if (cellNumber > dpDiagonal->cellCapacity) {
+        free(dpDiagonal->cellMemory);
+        dpDiagonal_allocateCells(dpDiagonal, cellNumber);
+    }
+    dpDiagonal->diagonal = diagonal;
+    dpDiagonal->scale = 0;
+}
+
+DpDiagonal *dpDiagonal_construct(Diagonal diagonal, int64_t stateNumber) {
+    return dpDiagonal_construct2(diagonal, stateNumber, 0);
+}
+
+static inline DpValue *dpDiagonal_getState(DpDiagonal *dpDiagonal, int64_t state) {
+    return dpDiagonal->cells + state * dpDiagonal->stateStride;
+}
+
 DpDiagonal *dpDiagonal_clone(DpDiagonal *diagonal) {
+    DpDiagonal *diagonal2 = dpDiagonal_construct2(diagonal->diagonal, diagonal->stateNumber, diagonal->scaled);
+    diagonal2->scale = diagonal->scale;
+    memcpy(diagonal2->cells, diagonal->cells, sizeof(DpValue) * diagonal->stateStride * diagonal->stateNumber);
+    return diagonal2;
+}
+
+static DpDiagonal *dpDiagonal_cloneAsLogProbabilities(DpDiagonal *diagonal) {
+    /*
+     * Returns a log probability copy of a scaled diagonal.
+     */
+    assert(diagonal->scaled);
     DpDiagonal *diagonal2 = dpDiagonal_construct(diagonal->diagonal, diagonal->stateNumber);
-    memcpy(diagonal2->cells, diagonal->cells, sizeof(double) * diagonal_getWidth(diagonal->diagonal) * diagonal->stateNumber);
+    for (int64_t s = 0; s < diagonal->stateNumber; s++) {
+        DpValue *values = dpDiagonal_getState(diagonal, s), *values2 = dpDiagonal_getState(diagonal2, s);
+        for (int64_t i = 0; i < diagonal_getWidth(diagonal->diagonal); i++) {
+            values2[i] = log(values[i]) + diagonal->scale * M_LN2;
+        }
+    }
     return diagonal2;
 }
 
@@ -403,55 +450,176 @@ bool dpDiagonal_equals(DpDiagonal *diagonal1, DpDiagonal *diagonal2) {
     if(diagonal1->stateNumber != diagonal2->stateNumber) {
         return 0;
     }
-    for (int64_t i = 0; i < diagonal_getWidth(diagonal1->diagonal) * diagonal1->stateNumber; i++) {
-        if (diagonal1->cells[i] != diagonal2->cells[i]) {
-            return 0;
+    if (diagonal1->scaled != diagonal2->scaled || diagonal1->scale != diagonal2->scale) {
+        return 0;
+    }
+    for (int64_t s = 0; s < diagonal1->stateNumber; s++) {
+        DpValue *values1 = dpDiagonal_getState(diagonal1, s), *values2 = dpDiagonal_getState(diagonal2, s);
+        for (int64_t i = 0; i < diagonal_getWidth(diagonal1->diagonal); i++) {
+            if (values1[i] != values2[i]) {
+                return 0;
+            }
         }
     }
     return 1;
 }
 
 void dpDiagonal_destruct(DpDiagonal *dpDiagonal) {
-    free(dpDiagonal->cells);
+    free(dpDiagonal->cellMemory);
     free(dpDiagonal);
 }
 
-double *dpDiagonal_getCell(DpDiagonal *dpDiagonal, int64_t xmy) {
+DpCells dpDiagonal_getCell(DpDiagonal *dpDiagonal, int64_t xmy) {
+    DpCells cell = { NULL, dpDiagonal->stateStride };
     if (xmy < dpDiagonal->diagonal.xmyL || xmy > dpDiagonal->diagonal.xmyR) {
-        return NULL;
+        return cell;
     }
     assert((diagonal_getXay(dpDiagonal->diagonal) + xmy) % 2 == 0);
-    return &dpDiagonal->cells[((xmy - dpDiagonal->diagonal.xmyL) / 2) * dpDiagonal->stateNumber];
+    cell.values = dpDiagonal->cells + (xmy - dpDiagonal->diagonal.xmyL) / 2;
+    return cell;
 }
 
 void dpDiagonal_zeroValues(DpDiagonal *diagonal) {
-    for (int64_t i = 0; i < diagonal_getWidth(diagonal->diagonal) * diagonal->stateNumber; i++) {
-        diagonal->cells[i] = LOG_ZERO;
+    double zero = diagonal->scaled ? 0.0 : LOG_ZERO;
+    for (int64_t i = 0; i < diagonal->stateStride * diagonal->stateNumber; i++) {
+        diagonal->cells[i] = zero;
     }
 }
 
 void dpDiagonal_initialiseValues(DpDiagonal *diagonal, StateMachine *sM, double (*getStateValue)(StateMachine *, int64_t)) {
-    for (int64_t i = diagonal_getMinXmy(diagonal->diagonal); i <= diagonal_getMaxXmy(diagonal->diagonal); i += 2) {
-        double *cell = dpDiagonal_getCell(diagonal, i);
-        assert(cell != NULL);
-        for (int64_t j = 0; j < diagonal->stateNumber; j++) {
-            cell[j] = getStateValue(sM, j);
+    diagonal->scale = 0;
+    for (int64_t s = 0; s < diagonal->stateNumber; s++) {
+        double value = diagonal->scaled ? exp(getStateValue(sM, s)) : getStateValue(sM, s);
+        DpValue *values = dpDiagonal_getState(diagonal, s);
+        for (int64_t i = 0; i < diagonal_getWidth(diagonal->diagonal); i++) {
+            values[i] = value;
+        }
+    }
+}
+
+#ifdef DP_FLOAT
+#define dpDiagonalMaxScaleExponent 32 //Leaves room below the largest value before floats become denormal
+#else
+#define dpDiagonalMaxScaleExponent 64
+#endif
+
+static void dpDiagonal_rescale(DpDiagonal *diagonal) {
+    /*
+     * Keeps the values of a scaled diagonal well away from under and overflow. If the largest of them is outside
+     * [2^-64, 2^64] they are divided by the power of two that puts it in [0.5, 1), which is added to the diagonal's
+     * scale. Being a power of two the division is exact. Rescaling only when needed saves a pass over most diagonals.
+     */
+    assert(diagonal->scaled);
+    int64_t width = diagonal_getWidth(diagonal->diagonal);
+    SimdDouble maxValues = simd_set1(0.0);
+    double maxValue = 0.0;
+    for (int64_t s = 0; s < diagonal->stateNumber; s++) {
+        DpValue *values = dpDiagonal_getState(diagonal, s);
+        int64_t i = 0;
+        for (; i + SIMD_WIDTH <= width; i += SIMD_WIDTH) {
+            maxValues = simd_max(maxValues, simd_loadValues(values + i));
+        }
+        for (; i < width; i++) {
+            maxValue = values[i] > maxValue ? values[i] : maxValue;
+        }
+    }
+    double m[SIMD_WIDTH];
+    simd_store(m, maxValues);
+    for (int64_t j = 0; j < SIMD_WIDTH; j++) {
+        maxValue = m[j] > maxValue ? m[j] : maxValue;
+    }
+    if (maxValue == 0.0) { //Nothing to rescale
+        return;
+    }
+    int exponent;
+    frexp(maxValue, &exponent);
+    if (exponent < -dpDiagonalMaxScaleExponent || exponent > dpDiagonalMaxScaleExponent) {
+        double factor = ldexp(1.0, -exponent);
+        for (int64_t s = 0; s < diagonal->stateNumber; s++) {
+            DpValue *values = dpDiagonal_getState(diagonal, s);
+            for (int64_t i = 0; i < width; i++) {
+                values[i] *= factor;
+            }
         }
+        diagonal->scale += exponent;
     }
 }
 
 double dpDiagonal_dotProduct(DpDiagonal *diagonal1, DpDiagonal *diagonal2) {
+    assert(diagonal1->scaled == diagonal2->scaled);
+    assert(diagonal1->stateNumber == diagonal2->stateNumber);
+    assert(diagonal_getXay(diagonal1->diagonal) == diagonal_getXay(diagonal2->diagonal));
+    //Only the cells the diagonals share contribute, as their other cells are multiplied by zero. Summed cell by cell,
+    //and within a cell state by state, so the total does not depend on the layout of the cells
+    int64_t xmyL = diagonal_getMinXmy(diagonal1->diagonal) > diagonal_getMinXmy(diagonal2->diagonal) ?
+            diagonal_getMinXmy(diagonal1->diagonal) : diagonal_getMinXmy(diagonal2->diagonal);
+    int64_t xmyR = diagonal_getMaxXmy(diagonal1->diagonal) < diagonal_getMaxXmy(diagonal2->diagonal) ?
+            diagonal_getMaxXmy(diagonal1->diagonal) : diagonal_getMaxXmy(diagonal2->diagonal);
+    int64_t width = xmyL <= xmyR ? (xmyR - xmyL) / 2 + 1 : 0;
+    const DpValue *cells1 = dpDiagonal_getCell(diagonal1, xmyL).values, *cells2 = dpDiagonal_getCell(diagonal2, xmyL).values;
+    int64_t stride1 = diagonal1->stateStride, stride2 = diagonal2->stateStride;
+    if (diagonal1->scaled) {
+        double totalProbability = 0.0;
+        for (int64_t i = 0; i < width; i++) {
+            for (int64_t s = 0; s < diagonal1->stateNumber; s++) {
+                totalProbability += (double) cells1[s * stride1 + i] * cells2[s * stride2 + i];
+            }
+        }
+        return log(totalProbability) + (diagonal1->scale + diagonal2->scale) * M_LN2;
+    }
     double totalProbability = LOG_ZERO;
-    Diagonal diagonal = diagonal1->diagonal;
-    int64_t xmy = diagonal_getMinXmy(diagonal);
-    while (xmy <= diagonal_getMaxXmy(diagonal)) {
-        totalProbability = logAdd(totalProbability,
-                cell_dotProduct(dpDiagonal_getCell(diagonal1, xmy), dpDiagonal_getCell(diagonal2, xmy), diagonal1->stateNumber));
-        xmy += 2;
+    for (int64_t i = 0; i < width; i++) {
+        double cellProbability = (double) cells1[i] + cells2[i];
+        for (int64_t s = 1; s < diagonal1->stateNumber; s++) {
+            cellProbability = logAdd(cellProbability, (double) cells1[s * stride1 + i] + cells2[s * stride2 + i]);
+        }
+        totalProbability = logAdd(totalProbability, cellProbability);
     }
     return totalProbability;
 }
 
+static void dpDiagonal_getCellsWithinDrop(DpDiagonal *diagonal, double drop, int64_t *xmyL, int64_t *xmyR) {
+    /*
+     * Gets the first and last cells of the diagonal with a state whose value is within drop (a log probability) of the
+     * maximum value of the diagonal. If every cell has probability zero it gets the whole diagonal.
+     */
+    int64_t width = diagonal_getWidth(diagonal->diagonal);
+    double zero = diagonal->scaled ? 0.0 : LOG_ZERO;
+    double maxValue = zero;
+    for (int64_t s = 0; s < diagonal->stateNumber; s++) {
+        DpValue *values = dpDiagonal_getState(diagonal, s);
+        for (int64_t i = 0; i < width; i++) {
+            maxValue = values[i] > maxValue ? values[i] : maxValue;
+        }
+    }
+    *xmyL = diagonal_getMinXmy(diagonal->diagonal);
+    *xmyR = diagonal_getMaxXmy(diagonal->diagonal);
+    if (maxValue <= zero) {
+        return;
+    }
+    //The scale of a scaled diagonal is shared by all its cells, so does not change which are within the drop
+    double threshold = diagonal->scaled ? maxValue * exp(-drop) : maxValue - drop;
+    int64_t first = width, last = -1;
+    for (int64_t s = 0; s < diagonal->stateNumber; s++) {
+        DpValue *values = dpDiagonal_getState(diagonal, s);
+        for (int64_t i = 0; i < first; i++) {
+            if (values[i] >= threshold) {
+                first = i;
+                break;
+            }
+        }
+        for (int64_t i = width - 1; i > last; i--) {
+            if (values[i] >= threshold) {
+                last = i;
+                break;
+            }
+        }
+    }
+    assert(first <= last);
+    *xmyR = *xmyL + 2 * last;
+    *xmyL += 2 * first;
+}
+
 ///////////////////////////////////
 ///////////////////////////////////
 //DpMatrix
@@ -465,20 +633,35 @@ struct _dpMatrix {
     int64_t diagonalNumber;
     int64_t activeDiagonals;
     int64_t stateNumber;
+    bool scaled;
+    //Deleted diagonals, which are reused by later diagonals rather than being freed. As only a window of diagonals
+    //is live at a time during the dp, this removes almost all allocation of diagonals.
+    stList *unusedDiagonals;
+    ThreadPool *threadPool; //If not NULL, long diagonals are split between its threads, see dpMatrix_setThreadPool
+    int64_t minCellsPerThread;
 };
 
-DpMatrix *dpMatrix_construct(int64_t diagonalNumber, int64_t stateNumber) {
+DpMatrix *dpMatrix_construct2(int64_t diagonalNumber, int64_t stateNumber, bool scaled) {
     assert(diagonalNumber >= 0);
     DpMatrix *dpMatrix = st_malloc(sizeof(DpMatrix));
     dpMatrix->diagonalNumber = diagonalNumber;
     dpMatrix->diagonals = st_calloc(dpMatrix->diagonalNumber + 1, sizeof(DpDiagonal *));
     dpMatrix->activeDiagonals = 0;
     dpMatrix->stateNumber = stateNumber;
+    dpMatrix->scaled = scaled;
+    dpMatrix->unusedDiagonals = stList_construct3(0, (void (*)(void *)) dpDiagonal_destruct);
+    dpMatrix->threadPool = NULL;
+    dpMatrix->minCellsPerThread = 1;
     return dpMatrix;
 }
 
+DpMatrix *dpMatrix_construct(int64_t diagonalNumber, int64_t stateNumber) {
+    return dpMatrix_construct2(diagonalNumber, stateNumber, 0);
+}
+
 void dpMatrix_destruct(DpMatrix *dpMatrix) {
     assert(dpMatrix->activeDiagonals == 0);
+    stList_destruct(dpMatrix->unusedDiagonals);
     free(dpMatrix->diagonals);
     free(dpMatrix);
 }
@@ -494,11 +677,30 @@ int64_t dpMatrix_getActiveDiagonalNumber(DpMatrix *dpMatrix) {
     return dpMatrix->activeDiagonals;
 }
 
+static DpDiagonal *dpMatrix_getUnusedDiagonal(DpMatrix *dpMatrix, Diagonal diagonal) {
+    /*
+     * Gets a diagonal with the matrix's number of states and type, reusing a deleted diagonal if there is one.
+     * It is not part of the matrix, and should be given back with dpMatrix_addUnusedDiagonal.
+     */
+    if (stList_length(dpMatrix->unusedDiagonals) == 0) {
+        return dpDiagonal_construct2(diagonal, dpMatrix->stateNumber, dpMatrix->scaled);
+    }
+    DpDiagonal *dpDiagonal = stList_pop(dpMatrix->unusedDiagonals);
+    dpDiagonal_reuse(dpDiagonal, diagonal);
+    return dpDiagonal;
+}
+
+static void dpMatrix_addUnusedDiagonal(DpMatrix *dpMatrix, DpDiagonal *dpDiagonal) {
+    assert(dpDiagonal->stateNumber == dpMatrix->stateNumber);
+    assert(dpDiagonal->scaled == dpMatrix->scaled);
+    stList_append(dpMatrix->unusedDiagonals, dpDiagonal);
+}
+
 DpDiagonal *dpMatrix_createDiagonal(DpMatrix *dpMatrix, Diagonal diagonal) {
     assert(diagonal.xay >= 0);
     assert(diagonal.xay <= dpMatrix->diagonalNumber);
     assert(dpMatrix_getDiagonal(dpMatrix, diagonal.xay) == NULL);
-    DpDiagonal *dpDiagonal = dpDiagonal_construct(diagonal, dpMatrix->stateNumber);
+    DpDiagonal *dpDiagonal = dpMatrix_getUnusedDiagonal(dpMatrix, diagonal);
     dpMatrix->diagonals[diagonal_getXay(diagonal)] = dpDiagonal;
     dpMatrix->activeDiagonals++;
     return dpDiagonal;
@@ -510,7 +712,7 @@ void dpMatrix_deleteDiagonal(DpMatrix *dpMatrix, int64_t xay) {
     if (dpMatrix->diagonals[xay] != NULL) {
         dpMatrix->activeDiagonals--;
         assert(dpMatrix->activeDiagonals >= 0);
-        dpDiagonal_destruct(dpMatrix->diagonals[xay]);
+        dpMatrix_addUnusedDiagonal(dpMatrix, dpMatrix->diagonals[xay]);
         dpMatrix->diagonals[xay] = NULL;
     }
 }
@@ -536,31 +738,289 @@ static Symbol getYCharacter(const SymbolString sY, int64_t xay, int64_t xmy) {
     return y > 0 ? sY.sequence[y - 1] : n;
 }
 
+static DpValue *dpCells_loadCell(DpCells cells, DpValue *cell, int64_t stateNumber) {
+    //Copies the first cell of the run into an array of its states' values, returning NULL for cells outside of the diagonal
+    if (cells.values == NULL) {
+        return NULL;
+    }
+    for (int64_t s = 0; s < stateNumber; s++) {
+        cell[s] = *dpCells_getValue(cells, 0, s);
+    }
+    return cell;
+}
+
+static void dpCells_storeCell(DpCells cells, DpValue *cell, int64_t stateNumber) {
+    //Only the values the calculation changed are written back, so a cell it only reads, such as the lower cell of a
+    //forward calculation, may be read by other threads at the same time (see diagonalCalculationWithThreads).
+    if (cells.values != NULL) {
+        for (int64_t s = 0; s < stateNumber; s++) {
+            DpValue *value = dpCells_getValue(cells, 0, s);
+            if (*value != cell[s]) {
+                *value = cell[s];
+            }
+        }
+    }
+}
+
+static void calculateCell(StateMachine *sM, DpCells current, DpCells lower, DpCells middle, DpCells upper, Symbol x,
+        Symbol y, void (*cellCalculation)(StateMachine *, DpValue *, DpValue *, DpValue *, DpValue *, Symbol, Symbol, void *),
+        void *extraArgs) {
+    /*
+     * The cell calculations take each cell as an array of its states' values, but diagonals store their cells state by
+     * state, so the cells are copied into arrays for the calculation and back afterwards.
+     */
+    DpValue cells[4][sM->stateNumber];
+    DpValue *currentCell = dpCells_loadCell(current, cells[0], sM->stateNumber);
+    DpValue *lowerCell = dpCells_loadCell(lower, cells[1], sM->stateNumber);
+    DpValue *middleCell = dpCells_loadCell(middle, cells[2], sM->stateNumber);
+    DpValue *upperCell = dpCells_loadCell(upper, cells[3], sM->stateNumber);
+    cellCalculation(sM, currentCell, lowerCell, middleCell, upperCell, x, y, extraArgs);
+    dpCells_storeCell(current, currentCell, sM->stateNumber);
+    dpCells_storeCell(lower, lowerCell, sM->stateNumber);
+    dpCells_storeCell(middle, middleCell, sM->stateNumber);
+    dpCells_storeCell(upper, upperCell, sM->stateNumber);
+}
+
 static void diagonalCalculation(StateMachine *sM, DpDiagonal *dpDiagonal, DpDiagonal *dpDiagonalM1, DpDiagonal *dpDiagonalM2,
         const SymbolString sX, const SymbolString sY,
-        void (*cellCalculation)(StateMachine *, double *, double *, double *, double *, Symbol, Symbol, void *), void *extraArgs) {
+        void (*cellCalculation)(StateMachine *, DpValue *, DpValue *, DpValue *, DpValue *, Symbol, Symbol, void *), void *extraArgs) {
     Diagonal diagonal = dpDiagonal->diagonal;
+    DpCells noCells = { NULL, 0 };
     int64_t xmy = diagonal_getMinXmy(diagonal);
     while (xmy <= diagonal_getMaxXmy(diagonal)) {
         Symbol x = getXCharacter(sX, diagonal_getXay(diagonal), xmy);
         Symbol y = getYCharacter(sY, diagonal_getXay(diagonal), xmy);
-        double *current = dpDiagonal_getCell(dpDiagonal, xmy);
-        double *lower = dpDiagonalM1 == NULL ? NULL : dpDiagonal_getCell(dpDiagonalM1, xmy - 1);
-        double *middle = dpDiagonalM2 == NULL ? NULL : dpDiagonal_getCell(dpDiagonalM2, xmy);
-        double *upper = dpDiagonalM1 == NULL ? NULL : dpDiagonal_getCell(dpDiagonalM1, xmy + 1);
-        cellCalculation(sM, current, lower, middle, upper, x, y, extraArgs);
+        DpCells current = dpDiagonal_getCell(dpDiagonal, xmy);
+        DpCells lower = dpDiagonalM1 == NULL ? noCells : dpDiagonal_getCell(dpDiagonalM1, xmy - 1);
+        DpCells middle = dpDiagonalM2 == NULL ? noCells : dpDiagonal_getCell(dpDiagonalM2, xmy);
+        DpCells upper = dpDiagonalM1 == NULL ? noCells : dpDiagonal_getCell(dpDiagonalM1, xmy + 1);
+        calculateCell(sM, current, lower, middle, upper, x, y, cellCalculation, extraArgs);
         xmy += 2;
     }
 }
 
+static void diagonalCalculationWithKernel(StateMachine *sM, DpDiagonal *dpDiagonal, DpDiagonal *dpDiagonalM1,
+        DpDiagonal *dpDiagonalM2, const SymbolString sX, const SymbolString sY, int64_t xmyL, int64_t xmyR,
+        void (*cellCalculation)(StateMachine *, DpValue *, DpValue *, DpValue *, DpValue *, Symbol, Symbol, void *),
+        void (*diagonalKernel)(StateMachine *, DpCells, DpCells, DpCells, DpCells, const PackedSymbol *, const PackedSymbol *, int64_t,
+                void *), void *extraArgs) {
+    /*
+     * As diagonalCalculation, but only for the cells of the diagonal in [xmyL, xmyR], and the interior cells, which have
+     * lower, middle and upper cells, are computed in blocks by the state machine's diagonal kernel. The remaining cells
+     * at either end are done cell by cell. Cells are visited in the same order as diagonalCalculation, so the results
+     * are identical.
+     */
+    Diagonal diagonal = dpDiagonal->diagonal;
+    int64_t xay = diagonal_getXay(diagonal);
+    assert(xmyL >= diagonal_getMinXmy(diagonal) && xmyR <= diagonal_getMaxXmy(diagonal));
+    if (dpDiagonalM1 == NULL || dpDiagonalM2 == NULL) {
+        assert(xmyL == diagonal_getMinXmy(diagonal) && xmyR == diagonal_getMaxXmy(diagonal));
+        diagonalCalculation(sM, dpDiagonal, dpDiagonalM1, dpDiagonalM2, sX, sY, cellCalculation, extraArgs);
+        return;
+    }
+    //Get the run of interior cells, [interiorL, interiorR]
+    Diagonal diagonalM1 = dpDiagonalM1->diagonal, diagonalM2 = dpDiagonalM2->diagonal;
+    int64_t interiorL = xmyL;
+    interiorL = interiorL > diagonal_getMinXmy(diagonalM1) + 1 ? interiorL : diagonal_getMinXmy(diagonalM1) + 1;
+    interiorL = interiorL > diagonal_getMinXmy(diagonalM2) ? interiorL : diagonal_getMinXmy(diagonalM2);
+    int64_t interiorR = xmyR;
+    interiorR = interiorR < diagonal_getMaxXmy(diagonalM1) - 1 ? interiorR : diagonal_getMaxXmy(diagonalM1) - 1;
+    interiorR = interiorR < diagonal_getMaxXmy(diagonalM2) ? interiorR : diagonal_getMaxXmy(diagonalM2);
+    int64_t interiorCellNumber = 0;
+    if (interiorL <= interiorR) {
+        interiorCellNumber = (interiorR - interiorL) / 2 + 1;
+        interiorCellNumber -= interiorCellNumber % SIMD_WIDTH;
+    }
+    if (interiorCellNumber == 0) {
+        interiorL = xmyR + 2; //Do every cell one by one
+    }
+    interiorR = interiorL + 2 * (interiorCellNumber - 1);
+    int64_t xmy = xmyL;
+    while (xmy <= xmyR) {
+        if (xmy == interiorL) {
+            int64_t x = diagonal_getXCoordinate(xay, xmy);
+            int64_t y = diagonal_getYCoordinate(xay, xmy);
+            assert(x > 0 && y > 0);
+            diagonalKernel(sM, dpDiagonal_getCell(dpDiagonal, xmy), dpDiagonal_getCell(dpDiagonalM1, xmy - 1),
+                    dpDiagonal_getCell(dpDiagonalM2, xmy), dpDiagonal_getCell(dpDiagonalM1, xmy + 1), &sX.sequence[x - 1],
+                    &sY.reversedSequence[sY.length - y], interiorCellNumber, extraArgs);
+            xmy = interiorR + 2;
+            continue;
+        }
+        DpCells lower = dpDiagonal_getCell(dpDiagonalM1, xmy - 1);
+        DpCells middle = dpDiagonal_getCell(dpDiagonalM2, xmy);
+        DpCells upper = dpDiagonal_getCell(dpDiagonalM1, xmy + 1);
+        calculateCell(sM, dpDiagonal_getCell(dpDiagonal, xmy), lower, middle, upper, getXCharacter(sX, xay, xmy),
+                getYCharacter(sY, xay, xmy), cellCalculation, extraArgs);
+        xmy += 2;
+    }
+}
+
+///////////////////////////////////
+///////////////////////////////////
+//Diagonals split between threads
+//
+//A diagonal's cells only depend on the previous two diagonals, so a long
+//diagonal is split into runs of cells computed by the threads of the
+//matrix's thread pool, the pool's run returning once the whole diagonal
+//is done.
+///////////////////////////////////
+///////////////////////////////////
+
+void dpMatrix_setThreadPool(DpMatrix *dpMatrix, ThreadPool *threadPool, int64_t minCellsPerThread) {
+    assert(minCellsPerThread > 0);
+    dpMatrix->threadPool = threadPool;
+    dpMatrix->minCellsPerThread = minCellsPerThread;
+}
+
+typedef struct _diagonalCalculationRun {
+    StateMachine *sM;
+    DpDiagonal *dpDiagonal, *dpDiagonalM1, *dpDiagonalM2;
+    SymbolString sX, sY;
+    void (*cellCalculation)(StateMachine *, DpValue *, DpValue *, DpValue *, DpValue *, Symbol, Symbol, void *);
+    void (*diagonalKernel)(StateMachine *, DpCells, DpCells, DpCells, DpCells, const PackedSymbol *, const PackedSymbol *,
+            int64_t, void *);
+    void *extraArgs;
+    int64_t cellsPerThread; //A multiple of SIMD_WIDTH, so each thread's cells are done by whole blocks of the kernel
+    bool backward;
+} DiagonalCalculationRun;
+
+static DpCells noCells = { NULL, 0 };
+
+static void diagonalCalculationRun_getCells(DiagonalCalculationRun *run, int64_t thread, int64_t *xmyL, int64_t *xmyR) {
+    Diagonal diagonal = run->dpDiagonal->diagonal;
+    *xmyL = diagonal_getMinXmy(diagonal) + 2 * thread * run->cellsPerThread;
+    *xmyR = *xmyL + 2 * (run->cellsPerThread - 1);
+    *xmyR = *xmyR < diagonal_getMaxXmy(diagonal) ? *xmyR : diagonal_getMaxXmy(diagonal);
+}
+
+static void diagonalCalculationRun_calculateCell(DiagonalCalculationRun *run, int64_t xmy, DpCells lower, DpCells middle,
+        DpCells upper) {
+    int64_t xay = diagonal_getXay(run->dpDiagonal->diagonal);
+    calculateCell(run->sM, dpDiagonal_getCell(run->dpDiagonal, xmy), lower, middle, upper, getXCharacter(run->sX, xay, xmy),
+            getYCharacter(run->sY, xay, xmy), run->cellCalculation, run->extraArgs);
+}
+
+static void diagonalCalculationRun_thread(void *args, int64_t thread, int64_t threadNumber) {
+    DiagonalCalculationRun *run = args;
+    int64_t xmyL, xmyR;
+    diagonalCalculationRun_getCells(run, thread, &xmyL, &xmyR);
+    if (xmyL > xmyR) {
+        return; //The diagonal is done by fewer threads than the pool has
+    }
+    if (run->backward && thread > 0) {
+        /*
+         * The backward calculation sums each cell into its lower and upper cells on the previous diagonal, and the lower
+         * cell of the thread's first cell is the upper cell of the last cell of the previous thread. So the first cell
+         * is done here without its lower cell, which is summed into after the run, in the order the whole diagonal
+         * would sum into it.
+         */
+        diagonalCalculationRun_calculateCell(run, xmyL, noCells, dpDiagonal_getCell(run->dpDiagonalM2, xmyL),
+                dpDiagonal_getCell(run->dpDiagonalM1, xmyL + 1));
+        xmyL += 2;
+        if (xmyL > xmyR) {
+            return;
+        }
+    }
+    diagonalCalculationWithKernel(run->sM, run->dpDiagonal, run->dpDiagonalM1, run->dpDiagonalM2, run->sX, run->sY, xmyL,
+            xmyR, run->cellCalculation, run->diagonalKernel, run->extraArgs);
+}
+
+static void diagonalCalculationWithThreads(DpMatrix *dpMatrix, StateMachine *sM, DpDiagonal *dpDiagonal,
+        DpDiagonal *dpDiagonalM1, DpDiagonal *dpDiagonalM2, const SymbolString sX, const SymbolString sY,
+        void (*cellCalculation)(StateMachine *, DpValue *, DpValue *, DpValue *, DpValue *, Symbol, Symbol, void *),
+        void (*diagonalKernel)(StateMachine *, DpCells, DpCells, DpCells, DpCells, const PackedSymbol *, const PackedSymbol *, int64_t,
+                void *), void *extraArgs, bool backward) {
+    /*
+     * Does diagonalCalculationWithKernel on the whole diagonal, splitting it between the threads of the matrix's thread
+     * pool if it is long enough to give each at least the matrix's minimum number of cells. Each cell's values are
+     * summed in the same order either way, so the results are identical.
+     */
+    Diagonal diagonal = dpDiagonal->diagonal;
+    int64_t cellNumber = diagonal_getWidth(diagonal);
+    int64_t threadNumber = 1;
+    if (dpMatrix->threadPool != NULL && dpDiagonalM1 != NULL && dpDiagonalM2 != NULL) {
+        threadNumber = cellNumber / dpMatrix->minCellsPerThread;
+        threadNumber = threadNumber < threadPool_getThreadNumber(dpMatrix->threadPool) ? threadNumber :
+                threadPool_getThreadNumber(dpMatrix->threadPool);
+    }
+    if (threadNumber <= 1) {
+        diagonalCalculationWithKernel(sM, dpDiagonal, dpDiagonalM1, dpDiagonalM2, sX, sY, diagonal_getMinXmy(diagonal),
+                diagonal_getMaxXmy(diagonal), cellCalculation, diagonalKernel, extraArgs);
+        return;
+    }
+    int64_t cellsPerThread = (cellNumber + threadNumber - 1) / threadNumber;
+    cellsPerThread += (SIMD_WIDTH - cellsPerThread % SIMD_WIDTH) % SIMD_WIDTH;
+    DiagonalCalculationRun run = { sM, dpDiagonal, dpDiagonalM1, dpDiagonalM2, sX, sY, cellCalculation, diagonalKernel,
+            extraArgs, cellsPerThread, backward };
+    threadPool_run(dpMatrix->threadPool, diagonalCalculationRun_thread, &run);
+    if (backward) {
+        //Sum the first cells of the threads after the first into their lower cells
+        for (int64_t thread = 1; thread < threadNumber; thread++) {
+            int64_t xmyL, xmyR;
+            diagonalCalculationRun_getCells(&run, thread, &xmyL, &xmyR);
+            if (xmyL <= xmyR) {
+                diagonalCalculationRun_calculateCell(&run, xmyL, dpDiagonal_getCell(dpDiagonalM1, xmyL - 1), noCells,
+                        noCells);
+            }
+        }
+    }
+}
+
 void diagonalCalculationForward(StateMachine *sM, int64_t xay, DpMatrix *dpMatrix, const SymbolString sX, const SymbolString sY) {
-    diagonalCalculation(sM, dpMatrix_getDiagonal(dpMatrix, xay), dpMatrix_getDiagonal(dpMatrix, xay - 1),
-            dpMatrix_getDiagonal(dpMatrix, xay - 2), sX, sY, cell_calculateForward, NULL);
+    DpDiagonal *dpDiagonal = dpMatrix_getDiagonal(dpMatrix, xay);
+    DpDiagonal *dpDiagonalM1 = dpMatrix_getDiagonal(dpMatrix, xay - 1);
+    DpDiagonal *dpDiagonalM2 = dpMatrix_getDiagonal(dpMatrix, xay - 2);
+    if (!dpMatrix->scaled) {
+        diagonalCalculationWithThreads(dpMatrix, sM, dpDiagonal, dpDiagonalM1, dpDiagonalM2, sX, sY,
+                sM->cellCalculateForward, sM->diagonalCalculateForward, NULL, 0);
+        return;
+    }
+    //The diagonal starts with the scale of the previous diagonal. Scaling the match emissions brings
+    //the cells of the diagonal before that to the same scale.
+    double emissionScales[2] = { 1.0, 1.0 };
+    if (dpDiagonalM1 != NULL) {
+        dpDiagonal->scale = dpDiagonalM1->scale;
+        if (dpDiagonalM2 != NULL) {
+            emissionScales[1] = ldexp(1.0, dpDiagonalM2->scale - dpDiagonalM1->scale);
+        }
+    }
+    diagonalCalculationWithThreads(dpMatrix, sM, dpDiagonal, dpDiagonalM1, dpDiagonalM2, sX, sY,
+            sM->cellCalculateForwardScaled, sM->diagonalCalculateForwardScaled, emissionScales, 0);
+    dpDiagonal_rescale(dpDiagonal);
 }
 
 void diagonalCalculationBackward(StateMachine *sM, int64_t xay, DpMatrix *dpMatrix, const SymbolString sX, const SymbolString sY) {
-    diagonalCalculation(sM, dpMatrix_getDiagonal(dpMatrix, xay), dpMatrix_getDiagonal(dpMatrix, xay - 1),
-            dpMatrix_getDiagonal(dpMatrix, xay - 2), sX, sY, cell_calculateBackward, NULL);
+    DpDiagonal *dpDiagonal = dpMatrix_getDiagonal(dpMatrix, xay);
+    DpDiagonal *dpDiagonalM1 = dpMatrix_getDiagonal(dpMatrix, xay - 1);
+    DpDiagonal *dpDiagonalM2 = dpMatrix_getDiagonal(dpMatrix, xay - 2);
+    if (!dpMatrix->scaled) {
+        diagonalCalculationWithThreads(dpMatrix, sM, dpDiagonal, dpDiagonalM1, dpDiagonalM2, sX, sY,
+                sM->cellCalculateBackward, sM->diagonalCalculateBackward, NULL, 1);
+        return;
+    }
+    /*
+     * The diagonal's values are summed into the previous two diagonals. Nothing has yet been summed into the diagonal
+     * two back, so it takes this diagonal's scale. The previous diagonal was given the scale of the next diagonal when
+     * that was calculated, or, if there is no next diagonal, is also empty and takes this diagonal's scale. Scaling the
+     * gap emissions brings this diagonal's cells to the previous diagonal's scale. Afterwards the previous diagonal is
+     * complete, so it is rescaled.
+     */
+    double emissionScales[2] = { 1.0, 1.0 };
+    if (dpDiagonalM2 != NULL) {
+        dpDiagonalM2->scale = dpDiagonal->scale;
+    }
+    if (dpDiagonalM1 != NULL) {
+        if (dpMatrix_getDiagonal(dpMatrix, xay + 1) == NULL) {
+            dpDiagonalM1->scale = dpDiagonal->scale;
+        }
+        emissionScales[0] = ldexp(1.0, dpDiagonal->scale - dpDiagonalM1->scale);
+    }
+    diagonalCalculationWithThreads(dpMatrix, sM, dpDiagonal, dpDiagonalM1, dpDiagonalM2, sX, sY,
+            sM->cellCalculateBackwardScaled, sM->diagonalCalculateBackwardScaled, emissionScales, 1);
+    if (dpDiagonalM1 != NULL) {
+        dpDiagonal_rescale(dpDiagonalM1);
+    }
 }
 
 double diagonalCalculationTotalProbability(StateMachine *sM, int64_t xay, DpMatrix *forwardDpMatrix, DpMatrix *backwardDpMatrix,
@@ -573,45 +1033,113 @@ double diagonalCalculationTotalProbability(StateMachine *sM, int64_t xay, DpMatr
     forwardDiagonal = dpMatrix_getDiagonal(forwardDpMatrix, xay - 1);
     backDiagonal = dpMatrix_getDiagonal(backwardDpMatrix, xay + 1);
     if (backDiagonal != NULL && forwardDiagonal != NULL) {
-        DpDiagonal *matchDiagonal = dpDiagonal_clone(backDiagonal);
+        DpDiagonal *matchDiagonal = dpMatrix_getUnusedDiagonal(backwardDpMatrix, backDiagonal->diagonal);
         dpDiagonal_zeroValues(matchDiagonal);
-        diagonalCalculation(sM, matchDiagonal, NULL, forwardDiagonal, sX, sY, cell_calculateForward, NULL);
-        totalProbability = logAdd(totalProbability, dpDiagonal_dotProduct(matchDiagonal, backDiagonal));
-        dpDiagonal_destruct(matchDiagonal);
+        if (matchDiagonal->scaled) {
+            double emissionScales[2] = { 1.0, 1.0 };
+            matchDiagonal->scale = forwardDiagonal->scale;
+            diagonalCalculation(sM, matchDiagonal, NULL, forwardDiagonal, sX, sY, sM->cellCalculateForwardScaled,
+                    emissionScales);
+        } else {
+            diagonalCalculation(sM, matchDiagonal, NULL, forwardDiagonal, sX, sY, sM->cellCalculateForward, NULL);
+        }
+        //The scaled dp is accurate enough for the error of the interpolated logAdd to matter, so it uses the precise one.
+        totalProbability = matchDiagonal->scaled ?
+                logAdd_precise(totalProbability, dpDiagonal_dotProduct(matchDiagonal, backDiagonal)) :
+                logAdd(totalProbability, dpDiagonal_dotProduct(matchDiagonal, backDiagonal));
+        dpMatrix_addUnusedDiagonal(backwardDpMatrix, matchDiagonal);
     }
     return totalProbability;
 }
 
-void diagonalCalculationPosteriorMatchProbs(StateMachine *sM, int64_t xay, DpMatrix *forwardDpMatrix, DpMatrix *backwardDpMatrix,
-        const SymbolString sX, const SymbolString sY, double totalProbability, PairwiseAlignmentParameters *p,
-        void *extraArgs) {
+static inline void addPosteriorMatchProb(StateMachine *sM, int64_t xay, int64_t xmy, DpValue forward, DpValue backward,
+        bool scaled, double scaleFactor, double totalProbability, PairwiseAlignmentParameters *p,
+        void *alignedPairs, bool toArray) {
+    /*
+     * Appends the pair of a cell if its posterior match probability is at least the threshold, to an AlignedPairArray
+     * if toArray is true, else as an stIntTuple to an stList.
+     */
+    int64_t x = diagonal_getXCoordinate(xay, xmy);
+    int64_t y = diagonal_getYCoordinate(xay, xmy);
+    if (x > 0 && y > 0) {
+        double posteriorProbability = scaled ? (double) forward * backward * scaleFactor :
+                exp(((double) forward + backward) - totalProbability);
+        if (posteriorProbability >= p->threshold) {
+            if (posteriorProbability > 1.0) {
+                posteriorProbability = 1.0;
+            }
+            posteriorProbability = floor(posteriorProbability * PAIR_ALIGNMENT_PROB_1);
+
+            if (toArray) {
+                alignedPairArray_append(alignedPairs, (int64_t) posteriorProbability, x - 1, y - 1);
+            } else {
+                stList_append(alignedPairs, stIntTuple_construct3((int64_t) posteriorProbability, x - 1, y - 1));
+            }
+        }
+    }
+}
+
+static inline void diagonalCalculationPosteriorMatchProbs2(StateMachine *sM, int64_t xay, DpMatrix *forwardDpMatrix,
+        DpMatrix *backwardDpMatrix, double totalProbability, PairwiseAlignmentParameters *p, void *alignedPairs,
+        bool toArray) {
+    /*
+     * Most cells are far below the threshold, so rather than take the posterior of every cell, a block of SIMD_WIDTH
+     * cells is first screened with a vector comparison, and only the cells passing it have their posteriors calculated.
+     * For scaled diagonals the screen is the threshold comparison itself. For log diagonals it compares the log of
+     * the product of the forward and backward values with the log of the threshold, loosened slightly so no cell that
+     * would pass the exact comparison after the exp is screened out, so exp is only taken for the cells passing it.
+     */
     assert(p->threshold >= 0.0);
     assert(p->threshold <= 1.0);
-    stList *alignedPairs = ((void **) extraArgs)[0];
     DpDiagonal *forwardDiagonal = dpMatrix_getDiagonal(forwardDpMatrix, xay);
     DpDiagonal *backDiagonal = dpMatrix_getDiagonal(backwardDpMatrix, xay);
-    Diagonal diagonal = forwardDiagonal->diagonal;
-    int64_t xmy = diagonal_getMinXmy(diagonal);
-    //Walk over the cells computing the posteriors
-    while (xmy <= diagonal_getMaxXmy(diagonal)) {
-        int64_t x = diagonal_getXCoordinate(diagonal_getXay(diagonal), xmy);
-        int64_t y = diagonal_getYCoordinate(diagonal_getXay(diagonal), xmy);
-        if (x > 0 && y > 0) {
-            double *cellForward = dpDiagonal_getCell(forwardDiagonal, xmy);
-            double *cellBackward = dpDiagonal_getCell(backDiagonal, xmy);
-            double posteriorProbability = exp(
-                    (cellForward[sM->matchState] + cellBackward[sM->matchState]) - totalProbability);
-            if (posteriorProbability >= p->threshold) {
-                if (posteriorProbability > 1.0) {
-                    posteriorProbability = 1.0;
+    //The backward diagonal may only have some of the forward diagonal's cells, see backwardBandDrop
+    Diagonal diagonal = backDiagonal->diagonal;
+    assert(diagonal_getMinXmy(diagonal) >= diagonal_getMinXmy(forwardDiagonal->diagonal));
+    assert(diagonal_getMaxXmy(diagonal) <= diagonal_getMaxXmy(forwardDiagonal->diagonal));
+    bool scaled = forwardDiagonal->scaled;
+    //For scaled diagonals, the factor converting a product of forward and backward values to a posterior probability
+    double scaleFactor = scaled ? exp((forwardDiagonal->scale + backDiagonal->scale) * M_LN2 - totalProbability) : 0.0;
+    //For log diagonals, the sum of forward and backward values below which a cell's posterior is below the threshold
+    double minLogProduct = totalProbability + log(p->threshold) - 1.0e-6;
+    const DpValue *forward = dpDiagonal_getCell(forwardDiagonal, diagonal_getMinXmy(diagonal)).values
+            + sM->matchState * forwardDiagonal->stateStride;
+    const DpValue *backward = dpDiagonal_getState(backDiagonal, sM->matchState);
+    SimdDouble cutoff = simd_set1(scaled ? p->threshold : minLogProduct);
+    SimdDouble scaleFactors = simd_set1(scaleFactor);
+    int64_t width = diagonal_getWidth(diagonal);
+    int64_t i = 0;
+    for (; i + SIMD_WIDTH <= width; i += SIMD_WIDTH) {
+        SimdDouble f = simd_loadValues(forward + i), b = simd_loadValues(backward + i);
+        SimdDouble screened = scaled ? simd_mul(simd_mul(f, b), scaleFactors) : simd_add(f, b);
+        int passed = simd_maskBits(simd_lessThanOrEqual(cutoff, screened));
+        if (passed != 0) {
+            for (int64_t j = i; j < i + SIMD_WIDTH; j++) {
+                if (passed & (1 << (j - i))) {
+                    addPosteriorMatchProb(sM, xay, diagonal.xmyL + 2 * j, forward[j], backward[j], scaled, scaleFactor,
+                            totalProbability, p, alignedPairs, toArray);
                 }
-                posteriorProbability = floor(posteriorProbability * PAIR_ALIGNMENT_PROB_1);
-
-                stList_append(alignedPairs, stIntTuple_construct3((int64_t) posteriorProbability, x - 1, y - 1));
             }
         }
-        xmy += 2;
     }
+    for (; i < width; i++) { //The cells left over
+        addPosteriorMatchProb(sM, xay, diagonal.xmyL + 2 * i, forward[i], backward[i], scaled, scaleFactor,
+                totalProbability, p, alignedPairs, toArray);
+    }
+}
+
+void diagonalCalculationPosteriorMatchProbs(StateMachine *sM, int64_t xay, DpMatrix *forwardDpMatrix, DpMatrix *backwardDpMatrix,
+        const SymbolString sX, const SymbolString sY, double totalProbability, PairwiseAlignmentParameters *p,
+        void *extraArgs) {
+    diagonalCalculationPosteriorMatchProbs2(sM, xay, forwardDpMatrix, backwardDpMatrix, totalProbability, p,
+            ((void **) extraArgs)[0], 0);
+}
+
+void diagonalCalculationPosteriorMatchProbsToArray(StateMachine *sM, int64_t xay, DpMatrix *forwardDpMatrix,
+        DpMatrix *backwardDpMatrix, const SymbolString sX, const SymbolString sY, double totalProbability,
+        PairwiseAlignmentParameters *p, void *extraArgs) {
+    diagonalCalculationPosteriorMatchProbs2(sM, xay, forwardDpMatrix, backwardDpMatrix, totalProbability, p,
+            ((void **) extraArgs)[0], 1);
 }
 
 static void diagonalCalculationExpectations(StateMachine *sM, int64_t xay, DpMatrix *forwardDpMatrix, DpMatrix *backwardDpMatrix,
@@ -623,8 +1151,27 @@ static void diagonalCalculationExpectations(StateMachine *sM, int64_t xay, DpMat
     Hmm *hmmExpectations = extraArgs;
     void *extraArgs2[2] = { &totalProbability, hmmExpectations };
     hmmExpectations->likelihood += totalProbability; //We do this once per diagonal, which is a hack, rather than for the whole matrix. The correction factor is approximately 1/number of diagonals.
-    diagonalCalculation(sM, dpMatrix_getDiagonal(backwardDpMatrix, xay), dpMatrix_getDiagonal(forwardDpMatrix, xay - 1),
-            dpMatrix_getDiagonal(forwardDpMatrix, xay - 2), sX, sY, cell_calculateExpectation, extraArgs2);
+    DpDiagonal *backDiagonal = dpMatrix_getDiagonal(backwardDpMatrix, xay);
+    DpDiagonal *forwardDiagonalM1 = dpMatrix_getDiagonal(forwardDpMatrix, xay - 1);
+    DpDiagonal *forwardDiagonalM2 = dpMatrix_getDiagonal(forwardDpMatrix, xay - 2);
+    if (!backwardDpMatrix->scaled) {
+        diagonalCalculation(sM, backDiagonal, forwardDiagonalM1, forwardDiagonalM2, sX, sY,
+                sM->cellCalculateUpdateExpectations, extraArgs2);
+        return;
+    }
+    //The expectations are accumulated in log space, so work from log probability copies of the diagonals.
+    backDiagonal = dpDiagonal_cloneAsLogProbabilities(backDiagonal);
+    forwardDiagonalM1 = forwardDiagonalM1 == NULL ? NULL : dpDiagonal_cloneAsLogProbabilities(forwardDiagonalM1);
+    forwardDiagonalM2 = forwardDiagonalM2 == NULL ? NULL : dpDiagonal_cloneAsLogProbabilities(forwardDiagonalM2);
+    diagonalCalculation(sM, backDiagonal, forwardDiagonalM1, forwardDiagonalM2, sX, sY, sM->cellCalculateUpdateExpectations,
+            extraArgs2);
+    dpDiagonal_destruct(backDiagonal);
+    if (forwardDiagonalM1 != NULL) {
+        dpDiagonal_destruct(forwardDiagonalM1);
+    }
+    if (forwardDiagonalM2 != NULL) {
+        dpDiagonal_destruct(forwardDiagonalM2);
+    }
 }
 
 ///////////////////////////////////
@@ -635,6 +1182,134 @@ static void diagonalCalculationExpectations(StateMachine *sM, int64_t xay, DpMat
 ///////////////////////////////////
 ///////////////////////////////////
 
+typedef struct _traceBack {
+    StateMachine *sM;
+    SymbolString sX, sY;
+    PairwiseAlignmentParameters *p;
+    DpMatrix *forwardDpMatrix, *backwardDpMatrix;
+    Band *band;
+    Band *backwardBand; //If not NULL, the cells of each diagonal the backward calculation is restricted to, see backwardBandDrop
+    bool checkpointed; //If true, forward diagonals missing from the forward matrix are recomputed as needed
+    BandIterator *backwardBandIterator; //Positioned after the diagonal traced back from
+    int64_t diagonalNumber;
+    bool atEnd;
+    int64_t tracedBackTo, tracedBackFrom;
+    bool deleteForwardDiagonals; //If false the forward diagonals done with are left for the caller to delete
+    void (*diagonalPosteriorProbFn)(StateMachine *, int64_t, DpMatrix *, DpMatrix *, const SymbolString, const SymbolString, double,
+            PairwiseAlignmentParameters *, void *);
+    void *extraArgs;
+    int64_t totalPosteriorCalculations;
+} TraceBack;
+
+static void traceBack_recomputeForwardDiagonals(TraceBack *t, int64_t xay) {
+    /*
+     * If the forward diagonal xay was deleted as the forward calculation went, recomputes it and those between it and
+     * the closest pair of consecutive forward diagonals before it which were kept, the checkpoint.
+     */
+    DpMatrix *forwardDpMatrix = t->forwardDpMatrix;
+    if (dpMatrix_getDiagonal(forwardDpMatrix, xay) != NULL) {
+        return;
+    }
+    int64_t checkpoint = xay - 1;
+    while (dpMatrix_getDiagonal(forwardDpMatrix, checkpoint) == NULL
+            || dpMatrix_getDiagonal(forwardDpMatrix, checkpoint - 1) == NULL) {
+        checkpoint--;
+        assert(checkpoint > t->tracedBackTo);
+    }
+    for (int64_t xay2 = checkpoint + 1; xay2 <= xay; xay2++) {
+        dpDiagonal_zeroValues(dpMatrix_createDiagonal(forwardDpMatrix, t->band->diagonals[xay2]));
+        diagonalCalculationForward(t->sM, xay2, forwardDpMatrix, t->sX, t->sY);
+    }
+}
+
+static void traceBack(TraceBack *t) {
+    /*
+     * Does the backward calculation from the diagonal traced back from, whose backward diagonal (and that of the
+     * diagonal before it) has been initialised, to tracedBackTo, and the posterior calculations of the diagonals up to
+     * tracedBackFrom. It only reads the forward diagonals up to the diagonal traced back from.
+     */
+    StateMachine *sM = t->sM;
+    SymbolString sX = t->sX, sY = t->sY;
+    DpMatrix *forwardDpMatrix = t->forwardDpMatrix, *backwardDpMatrix = t->backwardDpMatrix;
+    int64_t diagonalNumber = t->diagonalNumber, tracedBackTo = t->tracedBackTo, tracedBackFrom = t->tracedBackFrom;
+    Diagonal diagonal2 = bandIterator_getPrevious(t->backwardBandIterator);
+    assert(diagonal_getXay(diagonal2) == tracedBackFrom + (t->atEnd ? 0 : t->p->traceBackDiagonals + 1));
+    /*
+     * The total probability of the alignment is the same across any diagonal, so is taken once, across the diagonal
+     * traced back from, where the backward diagonal holds the end state probabilities and it is the dot product of the
+     * forward and backward diagonals.
+     */
+    double totalProbability = dpDiagonal_dotProduct(dpMatrix_getDiagonal(forwardDpMatrix, diagonal_getXay(diagonal2)),
+            dpMatrix_getDiagonal(backwardDpMatrix, diagonal_getXay(diagonal2)));
+    int64_t totalPosteriorCalculationsThisTraceback = 0;
+    while (diagonal_getXay(diagonal2) > tracedBackTo) {
+        //Create the earlier diagonal
+        if (diagonal_getXay(diagonal2) > tracedBackTo + 2) {
+            if (t->checkpointed) {
+                traceBack_recomputeForwardDiagonals(t, diagonal_getXay(diagonal2) - 2);
+            }
+            DpDiagonal *j = dpMatrix_getDiagonal(forwardDpMatrix, diagonal_getXay(diagonal2) - 2);
+            assert(j != NULL);
+            dpDiagonal_zeroValues(dpMatrix_createDiagonal(backwardDpMatrix,
+                    t->backwardBand != NULL ? t->backwardBand->diagonals[diagonal_getXay(j->diagonal)] : j->diagonal));
+        }
+        if (diagonal_getXay(diagonal2) > tracedBackTo + 1) {
+            diagonalCalculationBackward(sM, diagonal_getXay(diagonal2), backwardDpMatrix, sX, sY);
+        }
+        if (diagonal_getXay(diagonal2) <= tracedBackFrom) {
+            assert(dpMatrix_getDiagonal(forwardDpMatrix, diagonal_getXay(diagonal2)) != NULL);
+            assert(dpMatrix_getDiagonal(forwardDpMatrix, diagonal_getXay(diagonal2)-1) != NULL);
+            assert(dpMatrix_getDiagonal(backwardDpMatrix, diagonal_getXay(diagonal2)) != NULL);
+            if (diagonal_getXay(diagonal2) != diagonalNumber) {
+                assert(dpMatrix_getDiagonal(backwardDpMatrix, diagonal_getXay(diagonal2)+1) != NULL);
+            }
+#ifndef NDEBUG
+            //Check the forward and backward calculations agree on the total probability. If the backward calculation is
+            //restricted they only roughly agree, so it is not checked.
+            if (totalPosteriorCalculationsThisTraceback % 10 == 0 && t->backwardBand == NULL) {
+                double newTotalProbability = diagonalCalculationTotalProbability(sM, diagonal_getXay(diagonal2),
+                        forwardDpMatrix, backwardDpMatrix, sX, sY);
+                assert(totalProbability + 1.0 > newTotalProbability);
+                assert(newTotalProbability + 1.0 > totalProbability);
+            }
+#endif
+            totalPosteriorCalculationsThisTraceback++;
+
+            t->diagonalPosteriorProbFn(sM, diagonal_getXay(diagonal2), forwardDpMatrix, backwardDpMatrix, sX, sY,
+                    totalProbability, t->p, t->extraArgs);
+
+            if ((diagonal_getXay(diagonal2) < tracedBackFrom || t->atEnd) && t->deleteForwardDiagonals) {
+                dpMatrix_deleteDiagonal(forwardDpMatrix, diagonal_getXay(diagonal2)); //Delete forward diagonal after last access in posterior calculation
+            }
+        }
+        if (diagonal_getXay(diagonal2) + 1 <= diagonalNumber) {
+            dpMatrix_deleteDiagonal(backwardDpMatrix, diagonal_getXay(diagonal2) + 1); //Delete backward diagonal after last access in backward calculation
+        }
+        diagonal2 = bandIterator_getPrevious(t->backwardBandIterator);
+    }
+    bandIterator_destruct(t->backwardBandIterator);
+    dpMatrix_deleteDiagonal(backwardDpMatrix, diagonal_getXay(diagonal2) + 1);
+    if (t->deleteForwardDiagonals) {
+        dpMatrix_deleteDiagonal(forwardDpMatrix, diagonal_getXay(diagonal2));
+    }
+    //Check memory state.
+    assert(dpMatrix_getActiveDiagonalNumber(backwardDpMatrix) == 0);
+    t->totalPosteriorCalculations += totalPosteriorCalculationsThisTraceback;
+}
+
+static void traceBackInBackground(void *args, int64_t thread, int64_t threadNumber) {
+    traceBack(args);
+}
+
+static void finishBackgroundTraceBack(TraceBack *t, ThreadPool *traceBackThread) {
+    //Waits for the traceback running in the background, then deletes the forward diagonals it was done with
+    threadPool_wait(traceBackThread);
+    assert(!t->atEnd);
+    for (int64_t xay = t->tracedBackTo; xay < t->tracedBackFrom; xay++) {
+        dpMatrix_deleteDiagonal(t->forwardDpMatrix, xay);
+    }
+}
+
 void getPosteriorProbsWithBanding(StateMachine *sM, stList *anchorPairs, const SymbolString sX, const SymbolString sY,
         PairwiseAlignmentParameters *p, bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd,
         void (*diagonalPosteriorProbFn)(StateMachine *, int64_t, DpMatrix *, DpMatrix *, const SymbolString, const SymbolString, double,
@@ -654,15 +1329,62 @@ void getPosteriorProbsWithBanding(StateMachine *sM, stList *anchorPairs, const S
     //Primitives for the forward matrix recursion
     Band *band = band_construct(anchorPairs, sX.length, sY.length, p->diagonalExpansion);
     BandIterator *forwardBandIterator = bandIterator_construct(band);
-    DpMatrix *forwardDpMatrix = dpMatrix_construct(diagonalNumber, sM->stateNumber);
+    DpMatrix *forwardDpMatrix = dpMatrix_construct2(diagonalNumber, sM->stateNumber, p->scaledProbabilities);
     dpDiagonal_initialiseValues(dpMatrix_createDiagonal(forwardDpMatrix, bandIterator_getNext(forwardBandIterator)), sM,
             alignmentHasRaggedLeftEnd ? sM->raggedStartStateProb : sM->startStateProb); //Initialise forward matrix.
 
     //Backward matrix.
-    DpMatrix *backwardDpMatrix = dpMatrix_construct(diagonalNumber, sM->stateNumber);
+    DpMatrix *backwardDpMatrix = dpMatrix_construct2(diagonalNumber, sM->stateNumber, p->scaledProbabilities);
+
+    //No diagonal is wider than the shorter sequence, so only start threads if that is long enough to split
+    ThreadPool *threadPool = NULL;
+    int64_t maxDiagonalWidth = (sX.length < sY.length ? sX.length : sY.length) + 1;
+    if (p->threadNumber > 1 && maxDiagonalWidth >= 2 * p->minDiagonalCellsPerThread) {
+        threadPool = threadPool_construct(p->threadNumber);
+        dpMatrix_setThreadPool(forwardDpMatrix, threadPool, p->minDiagonalCellsPerThread);
+        if (!p->pipelineTraceBacks) { //Else the backward calculation may run at the same time as the forward calculation
+            dpMatrix_setThreadPool(backwardDpMatrix, threadPool, p->minDiagonalCellsPerThread);
+        }
+    }
+
+    /*
+     * If the tracebacks are pipelined, intermediate tracebacks run on a second thread while the forward calculation
+     * carries on past them, each waiting for the last to finish. A traceback only reads the forward diagonals it
+     * traces back from, which the forward calculation has finished with, and the forward diagonals it is done with are
+     * deleted once it has finished, so the forward matrix is only changed by this thread.
+     */
+    //The cells of the last diagonal within the adaptive band drop, initially the first diagonal
+    int64_t withinDropL = 0, withinDropR = 0;
+
+    ThreadPool *traceBackThread = NULL; //Started at the first intermediate traceback
+    /*
+     * If checkpointing, the forward calculation only keeps the pairs of consecutive diagonals every checkpointDiagonals
+     * diagonals after the last traceback, and the last two diagonals. The traceback recomputes the others from the
+     * pairs as it needs them, a stretch of checkpointDiagonals at a time, so at most about
+     * diagonalNumber / checkpointDiagonals + checkpointDiagonals forward diagonals are held.
+     */
+    int64_t checkpointDiagonals = p->checkpointDiagonals;
+    if (checkpointDiagonals < 0) {
+        checkpointDiagonals = (int64_t) sqrt((double) diagonalNumber);
+    }
+    checkpointDiagonals = checkpointDiagonals > 0 && checkpointDiagonals < 2 ? 2 : checkpointDiagonals;
+
+    /*
+     * If restricting the backward calculation, the backward band's diagonals are narrowed to the cells of the forward
+     * diagonals within the drop, and the cells after those of the diagonal before within the drop, so the cells kept
+     * on consecutive diagonals are connected.
+     */
+    Band *backwardBand = NULL;
+    int64_t backwardWithinDropL = 0, backwardWithinDropR = 0;
+    if (p->backwardBandDrop > 0.0) {
+        backwardBand = band_construct(anchorPairs, sX.length, sY.length, p->diagonalExpansion);
+    }
+
+    TraceBack t = { sM, sX, sY, p, forwardDpMatrix, backwardDpMatrix, band, backwardBand, checkpointDiagonals > 0, NULL,
+            diagonalNumber, 0, 0, 0, 1, diagonalPosteriorProbFn, extraArgs, 0 };
+    bool traceBackRunning = 0;
 
     int64_t tracedBackTo = 0;
-    int64_t totalPosteriorCalculations = 0;
     while (1) { //Loop that moves through the matrix forward
         Diagonal diagonal = bandIterator_getNext(forwardBandIterator);
 
@@ -671,11 +1393,49 @@ void getPosteriorProbsWithBanding(StateMachine *sM, stList *anchorPairs, const S
         diagonalCalculationForward(sM, diagonal_getXay(diagonal), forwardDpMatrix, sX, sY);
 
         bool atEnd = diagonal_getXay(diagonal) == diagonalNumber; //Condition true at the end of the matrix
+
+        //Prune the next diagonal to the cells reached from the cells of this diagonal or the last within the drop
+        if (p->adaptiveBandDrop > 0.0 && !atEnd) {
+            int64_t xmyL, xmyR;
+            dpDiagonal_getCellsWithinDrop(dpMatrix_getDiagonal(forwardDpMatrix, diagonal_getXay(diagonal)),
+                    p->adaptiveBandDrop, &xmyL, &xmyR);
+            band_narrowDiagonal(band, diagonal_getXay(diagonal) + 1, xmyL - 1 < withinDropL ? xmyL - 1 : withinDropL,
+                    xmyR + 1 > withinDropR ? xmyR + 1 : withinDropR);
+            withinDropL = xmyL;
+            withinDropR = xmyR;
+        }
+
+        //Restrict the backward calculation on this diagonal
+        if (backwardBand != NULL) {
+            int64_t xmyL, xmyR;
+            dpDiagonal_getCellsWithinDrop(dpMatrix_getDiagonal(forwardDpMatrix, diagonal_getXay(diagonal)),
+                    p->backwardBandDrop, &xmyL, &xmyR);
+            int64_t backwardXmyL = xmyL < backwardWithinDropL - 1 ? xmyL : backwardWithinDropL - 1;
+            int64_t backwardXmyR = xmyR > backwardWithinDropR + 1 ? xmyR : backwardWithinDropR + 1;
+            //The backward diagonal must be within the forward diagonal, which may have been pruned
+            backwardXmyL = backwardXmyL > diagonal_getMinXmy(diagonal) ? backwardXmyL : diagonal_getMinXmy(diagonal);
+            backwardXmyR = backwardXmyR < diagonal_getMaxXmy(diagonal) ? backwardXmyR : diagonal_getMaxXmy(diagonal);
+            backwardBand->diagonals[diagonal_getXay(diagonal)] = diagonal;
+            band_narrowDiagonal(backwardBand, diagonal_getXay(diagonal), backwardXmyL, backwardXmyR);
+            backwardWithinDropL = xmyL;
+            backwardWithinDropR = xmyR;
+        }
+
+        //Delete the diagonal before last, unless it is part of a checkpoint
+        int64_t checkpointXay = diagonal_getXay(diagonal) - 2;
+        if (checkpointDiagonals > 0 && checkpointXay > tracedBackTo + 1
+                && (checkpointXay - tracedBackTo) % checkpointDiagonals >= 2) {
+            dpMatrix_deleteDiagonal(forwardDpMatrix, checkpointXay);
+        }
         bool tracebackPoint = diagonal_getXay(diagonal) >= tracedBackTo + p->minDiagsBetweenTraceBack
                 && diagonal_getWidth(diagonal) <= p->diagonalExpansion * 2 + 1; //Condition true when we want to do an intermediate traceback.
 
                 //Traceback
         if (atEnd || tracebackPoint) {
+            if (traceBackRunning) {
+                finishBackgroundTraceBack(&t, traceBackThread);
+                traceBackRunning = 0;
+            }
             //Initialise the last row (until now) of the backward matrix to represent an end point
             dpDiagonal_initialiseValues(dpMatrix_createDiagonal(backwardDpMatrix, diagonal), sM,
                     (atEnd && alignmentHasRaggedRightEnd) ? sM->raggedEndStateProb : sM->endStateProb);
@@ -686,60 +1446,24 @@ void getPosteriorProbsWithBanding(StateMachine *sM, stList *anchorPairs, const S
             }
 
             //Do walk back
-            BandIterator *backwardBandIterator = bandIterator_clone(forwardBandIterator);
-            Diagonal diagonal2 = bandIterator_getPrevious(backwardBandIterator);
-            assert(diagonal_getXay(diagonal2) == diagonal_getXay(diagonal));
-            int64_t tracedBackFrom = diagonal_getXay(diagonal) - (atEnd ? 0 : p->traceBackDiagonals + 1);
-            double totalProbability = LOG_ZERO;
-            int64_t totalPosteriorCalculationsThisTraceback = 0;
-            while (diagonal_getXay(diagonal2) > tracedBackTo) {
-                //Create the earlier diagonal
-                if (diagonal_getXay(diagonal2) > tracedBackTo + 2) {
-                    DpDiagonal *j = dpMatrix_getDiagonal(forwardDpMatrix, diagonal_getXay(diagonal2) - 2);
-                    assert(j != NULL);
-                    dpDiagonal_zeroValues(dpMatrix_createDiagonal(backwardDpMatrix, j->diagonal));
-                }
-                if (diagonal_getXay(diagonal2) > tracedBackTo + 1) {
-                    diagonalCalculationBackward(sM, diagonal_getXay(diagonal2), backwardDpMatrix, sX, sY);
+            t.backwardBandIterator = bandIterator_clone(forwardBandIterator);
+            t.atEnd = atEnd;
+            t.tracedBackTo = tracedBackTo;
+            t.tracedBackFrom = diagonal_getXay(diagonal) - (atEnd ? 0 : p->traceBackDiagonals + 1);
+            tracedBackTo = t.tracedBackFrom;
+            if (p->pipelineTraceBacks && !atEnd && !t.checkpointed) { //Recomputing forward diagonals would race the forward calculation
+                if (traceBackThread == NULL) {
+                    traceBackThread = threadPool_construct(2);
                 }
-                if (diagonal_getXay(diagonal2) <= tracedBackFrom) {
-                    assert(dpMatrix_getDiagonal(forwardDpMatrix, diagonal_getXay(diagonal2)) != NULL);
-                    assert(dpMatrix_getDiagonal(forwardDpMatrix, diagonal_getXay(diagonal2)-1) != NULL);
-                    assert(dpMatrix_getDiagonal(backwardDpMatrix, diagonal_getXay(diagonal2)) != NULL);
-                    if (diagonal_getXay(diagonal2) != diagonalNumber) {
-                        assert(dpMatrix_getDiagonal(backwardDpMatrix, diagonal_getXay(diagonal2)+1) != NULL);
-                    }
-                    if (totalPosteriorCalculationsThisTraceback++ % 10 == 0) {
-                        double newTotalProbability = diagonalCalculationTotalProbability(sM, diagonal_getXay(diagonal2),
-                                forwardDpMatrix, backwardDpMatrix, sX, sY);
-                        if (totalPosteriorCalculationsThisTraceback != 1) {
-                            assert(totalProbability + 1.0 > newTotalProbability);
-                            assert(newTotalProbability + 1.0 > newTotalProbability);
-                        }
-                        totalProbability = newTotalProbability;
-                    }
-
-                    diagonalPosteriorProbFn(sM, diagonal_getXay(diagonal2), forwardDpMatrix, backwardDpMatrix, sX, sY,
-                            totalProbability, p, extraArgs);
-
-                    if (diagonal_getXay(diagonal2) < tracedBackFrom || atEnd) {
-                        dpMatrix_deleteDiagonal(forwardDpMatrix, diagonal_getXay(diagonal2)); //Delete forward diagonal after last access in posterior calculation
-                    }
+                t.deleteForwardDiagonals = 0;
+                threadPool_start(traceBackThread, traceBackInBackground, &t);
+                traceBackRunning = 1;
+            } else {
+                t.deleteForwardDiagonals = 1;
+                traceBack(&t);
+                if (!atEnd) {
+                    assert(dpMatrix_getActiveDiagonalNumber(forwardDpMatrix) == p->traceBackDiagonals + 2);
                 }
-                if (diagonal_getXay(diagonal2) + 1 <= diagonalNumber) {
-                    dpMatrix_deleteDiagonal(backwardDpMatrix, diagonal_getXay(diagonal2) + 1); //Delete backward diagonal after last access in backward calculation
-                }
-                diagonal2 = bandIterator_getPrevious(backwardBandIterator);
-            }
-            tracedBackTo = tracedBackFrom;
-            bandIterator_destruct(backwardBandIterator);
-            dpMatrix_deleteDiagonal(backwardDpMatrix, diagonal_getXay(diagonal2) + 1);
-            dpMatrix_deleteDiagonal(forwardDpMatrix, diagonal_getXay(diagonal2));
-            //Check memory state.
-            assert(dpMatrix_getActiveDiagonalNumber(backwardDpMatrix) == 0);
-            totalPosteriorCalculations += totalPosteriorCalculationsThisTraceback;
-            if (!atEnd) {
-                assert(dpMatrix_getActiveDiagonalNumber(forwardDpMatrix) == p->traceBackDiagonals + 2);
             }
         }
 
@@ -747,22 +1471,165 @@ void getPosteriorProbsWithBanding(StateMachine *sM, stList *anchorPairs, const S
             break;
         }
     }
-    assert(totalPosteriorCalculations == diagonalNumber);
+    assert(t.totalPosteriorCalculations == diagonalNumber);
     assert(tracedBackTo == diagonalNumber);
     assert(dpMatrix_getActiveDiagonalNumber(backwardDpMatrix) == 0);
     assert(dpMatrix_getActiveDiagonalNumber(forwardDpMatrix) == 0);
     //Cleanup
     dpMatrix_destruct(forwardDpMatrix);
     dpMatrix_destruct(backwardDpMatrix);
+    if (threadPool != NULL) {
+        threadPool_destruct(threadPool);
+    }
+    if (traceBackThread != NULL) {
+        threadPool_destruct(traceBackThread);
+    }
     bandIterator_destruct(forwardBandIterator);
     band_destruct(band);
+    if (backwardBand != NULL) {
+        band_destruct(backwardBand);
+    }
+}
+
+///////////////////////////////////
+///////////////////////////////////
+//Viterbi alignment
+//
+//The most probable alignment, found by the max-product version
+//of the forward calculation over the same band, with no backward
+//calculation. For each cell the state each of its states came
+//from is kept, in 3 bits a state, to trace the alignment back.
+///////////////////////////////////
+///////////////////////////////////
+
+static void diagonalCalculationViterbi(StateMachine *sM, int64_t xay, DpMatrix *dpMatrix, const SymbolString sX,
+        const SymbolString sY, uint16_t *traceBack) {
+    DpDiagonal *dpDiagonal = dpMatrix_getDiagonal(dpMatrix, xay);
+    DpDiagonal *dpDiagonalM1 = dpMatrix_getDiagonal(dpMatrix, xay - 1);
+    DpDiagonal *dpDiagonalM2 = dpMatrix_getDiagonal(dpMatrix, xay - 2);
+    Diagonal diagonal = dpDiagonal->diagonal;
+    for (int64_t xmy = diagonal_getMinXmy(diagonal), i = 0; xmy <= diagonal_getMaxXmy(diagonal); xmy += 2, i++) {
+        DpCells lower = dpDiagonalM1 == NULL ? noCells : dpDiagonal_getCell(dpDiagonalM1, xmy - 1);
+        DpCells middle = dpDiagonalM2 == NULL ? noCells : dpDiagonal_getCell(dpDiagonalM2, xmy);
+        DpCells upper = dpDiagonalM1 == NULL ? noCells : dpDiagonal_getCell(dpDiagonalM1, xmy + 1);
+        traceBack[i] = 0;
+        calculateCell(sM, dpDiagonal_getCell(dpDiagonal, xmy), lower, middle, upper, getXCharacter(sX, xay, xmy),
+                getYCharacter(sY, xay, xmy), sM->cellCalculateViterbi, &traceBack[i]);
+    }
+}
+
+static void appendAlignmentOperation(stList *operations, int64_t type) {
+    //Adds one to the length of the last operation if it is of the type, else appends an operation of length one
+    struct AlignmentOperation *operation = stList_length(operations) > 0 ? stList_peek(operations) : NULL;
+    if (operation != NULL && operation->opType == type) {
+        operation->length++;
+    } else {
+        stList_append(operations, constructAlignmentOperation(type, 1, 0.0));
+    }
+}
+
+struct List *getViterbiAlignmentWithBanding(StateMachine *sM, stList *anchorPairs, const SymbolString sX,
+        const SymbolString sY, PairwiseAlignmentParameters *p, bool alignmentHasRaggedLeftEnd,
+        bool alignmentHasRaggedRightEnd, double *score) {
+    assert(sM->stateNumber <= 5); //The traceback of each state takes 3 of the 16 bits of a cell's traceback
+    int64_t diagonalNumber = sX.length + sY.length;
+
+    //The forward, max-product, calculation. Only the last two diagonals are kept, but every diagonal's traceback.
+    Band *band = band_construct(anchorPairs, sX.length, sY.length, p->diagonalExpansion);
+    BandIterator *bandIterator = bandIterator_construct(band);
+    DpMatrix *dpMatrix = dpMatrix_construct(diagonalNumber, sM->stateNumber);
+    uint16_t **traceBacks = st_calloc(diagonalNumber + 1, sizeof(uint16_t *));
+    Diagonal diagonal = bandIterator_getNext(bandIterator);
+    dpDiagonal_initialiseValues(dpMatrix_createDiagonal(dpMatrix, diagonal), sM,
+            alignmentHasRaggedLeftEnd ? sM->raggedStartStateProb : sM->startStateProb);
+    int64_t withinDropL = 0, withinDropR = 0; //As in getPosteriorProbsWithBanding
+    for (int64_t xay = 1; xay <= diagonalNumber; xay++) {
+        diagonal = bandIterator_getNext(bandIterator);
+        assert(diagonal_getXay(diagonal) == xay);
+        dpDiagonal_zeroValues(dpMatrix_createDiagonal(dpMatrix, diagonal));
+        traceBacks[xay] = st_malloc(diagonal_getWidth(diagonal) * sizeof(uint16_t));
+        diagonalCalculationViterbi(sM, xay, dpMatrix, sX, sY, traceBacks[xay]);
+        if (p->adaptiveBandDrop > 0.0 && xay < diagonalNumber) {
+            int64_t xmyL, xmyR;
+            dpDiagonal_getCellsWithinDrop(dpMatrix_getDiagonal(dpMatrix, xay), p->adaptiveBandDrop, &xmyL, &xmyR);
+            band_narrowDiagonal(band, xay + 1, xmyL - 1 < withinDropL ? xmyL - 1 : withinDropL,
+                    xmyR + 1 > withinDropR ? xmyR + 1 : withinDropR);
+            withinDropL = xmyL;
+            withinDropR = xmyR;
+        }
+        if (xay >= 2) {
+            dpMatrix_deleteDiagonal(dpMatrix, xay - 2);
+        }
+    }
+
+    //Choose the best state to end in, at the single cell of the last diagonal
+    DpDiagonal *lastDiagonal = dpMatrix_getDiagonal(dpMatrix, diagonalNumber);
+    int64_t xmy = sX.length - sY.length;
+    DpCells cell = dpDiagonal_getCell(lastDiagonal, xmy);
+    assert(cell.values != NULL);
+    int64_t state = 0;
+    *score = LOG_ZERO;
+    for (int64_t s = 0; s < sM->stateNumber; s++) {
+        double value = *dpCells_getValue(cell, 0, s) + (alignmentHasRaggedRightEnd ? sM->raggedEndStateProb(sM, s) :
+                sM->endStateProb(sM, s));
+        if (value > *score) {
+            *score = value;
+            state = s;
+        }
+    }
+
+    //Trace back the alignment from the end, getting its operations in reverse
+    stList *operations = stList_construct();
+    int64_t xay = diagonalNumber;
+    while (xay > 0) {
+        Diagonal diagonal = band->diagonals[xay];
+        assert(xmy >= diagonal_getMinXmy(diagonal) && xmy <= diagonal_getMaxXmy(diagonal));
+        int64_t fromState = (traceBacks[xay][(xmy - diagonal_getMinXmy(diagonal)) / 2] >> (3 * state)) & 7;
+        switch (stateMachine_getStateEmission(sM, state)) {
+        case matchEmission:
+            appendAlignmentOperation(operations, PAIRWISE_MATCH);
+            xay -= 2;
+            break;
+        case gapXEmission:
+            appendAlignmentOperation(operations, PAIRWISE_INDEL_X);
+            xay--;
+            xmy--;
+            break;
+        case gapYEmission:
+            appendAlignmentOperation(operations, PAIRWISE_INDEL_Y);
+            xay--;
+            xmy++;
+            break;
+        }
+        state = fromState;
+    }
+    assert(xay == 0 && xmy == 0);
+    struct List *alignmentOperations = constructEmptyList(0, (void (*)(void *)) destructAlignmentOperation);
+    while (stList_length(operations) > 0) {
+        listAppend(alignmentOperations, stList_pop(operations));
+    }
+
+    //Cleanup
+    stList_destruct(operations);
+    for (int64_t i = 0; i <= diagonalNumber; i++) {
+        free(traceBacks[i]);
+    }
+    free(traceBacks);
+    dpMatrix_deleteDiagonal(dpMatrix, diagonalNumber);
+    if (diagonalNumber > 0) {
+        dpMatrix_deleteDiagonal(dpMatrix, diagonalNumber - 1);
+    }
+    dpMatrix_destruct(dpMatrix);
+    bandIterator_destruct(bandIterator);
+    band_destruct(band);
+    return alignmentOperations;
 }
 
 ///////////////////////////////////
 ///////////////////////////////////
 //Blast anchoring functions
 //
-//Use lastz to get sets of anchors
+//Use lastz, or the in process equivalents in seedAnchors.c and minimizerAnchors.c, to get sets of anchors
 ///////////////////////////////////
 ///////////////////////////////////
 
@@ -812,6 +1679,10 @@ stList *convertPairwiseForwardStrandAlignmentToAnchorPairs(struct PairwiseAlignm
     return alignedPairs;
 }
 
+//Guards the sonLib functions getBlastPairs uses that are not safe to run at once on different threads, as cigarRead,
+//which reads into static buffers, so the gaps of the anchors may be filled by threads, see getCombinedAnchorPairs.
+static pthread_mutex_t blastPairsMutex = PTHREAD_MUTEX_INITIALIZER;
+
 stList *getBlastPairs(const char *sX, const char *sY, int64_t lX, int64_t lY, int64_t trim, bool repeatMask) {
     /*
      * Uses lastz to compute a bunch of monotonically increasing pairs such that for any pair of consecutive pairs in the list
@@ -829,7 +1700,9 @@ stList *getBlastPairs(const char *sX, const char *sY, int64_t lX, int64_t lY, in
     }
 
     //Write one sequence to file..
+    pthread_mutex_lock(&blastPairsMutex);
     char *tempFile1 = getTempFile();
+    pthread_mutex_unlock(&blastPairsMutex);
     char *tempFile2 = NULL;
 
     writeSequenceToFile(tempFile1, "a", sX);
@@ -837,7 +1710,9 @@ stList *getBlastPairs(const char *sX, const char *sY, int64_t lX, int64_t lY, in
     char *command;
 
     if (lY > 1000) {
+        pthread_mutex_lock(&blastPairsMutex);
         tempFile2 = getTempFile();
+        pthread_mutex_unlock(&blastPairsMutex);
         writeSequenceToFile(tempFile2, "b", sY);
         command =
                 stString_print(
@@ -853,9 +1728,15 @@ stList *getBlastPairs(const char *sX, const char *sY, int64_t lX, int64_t lY, in
     if (fileHandle == NULL) {
         st_errAbort("Problems with lastz pipe");
     }
-    //Read from stream
+    //Read from stream. The lock is taken for each cigar, so the other threads' lastz runs carry on meanwhile.
     struct PairwiseAlignment *pA;
-    while ((pA = cigarRead(fileHandle)) != NULL) {
+    while (1) {
+        pthread_mutex_lock(&blastPairsMutex);
+        pA = cigarRead(fileHandle);
+        pthread_mutex_unlock(&blastPairsMutex);
+        if (pA == NULL) {
+            break;
+        }
         assert(strcmp(pA->contig1, "a") == 0);
         assert(strcmp(pA->contig2, "b") == 0);
         stList *alignedPairsForCigar = convertPairwiseForwardStrandAlignmentToAnchorPairs(pA, trim);
@@ -889,6 +1770,18 @@ stList *getBlastPairs(const char *sX, const char *sY, int64_t lX, int64_t lY, in
     return alignedPairs;
 }
 
+static stList *getAnchorPairs(const char *sX, const char *sY, int64_t lX, int64_t lY, bool repeatMask,
+        PairwiseAlignmentParameters *p) {
+    switch (p->anchorMethod) {
+        case lastzAnchors:
+            return getBlastPairs(sX, sY, lX, lY, p->constraintDiagonalTrim, repeatMask);
+        case minimizerAnchors:
+            return getMinimizerAnchorPairs(sX, sY, lX, lY, p->constraintDiagonalTrim, repeatMask);
+        default:
+            return getSeedAnchorPairs(sX, sY, lX, lY, p->constraintDiagonalTrim, repeatMask);
+    }
+}
+
 static void convertBlastPairs(stList *alignedPairs2, int64_t offsetX, int64_t offsetY) {
     /*
      * Convert the coordinates of the computed pairs.
@@ -954,7 +1847,7 @@ static void getBlastPairsForPairwiseAlignmentParametersP(const char *sX, const c
     if (matrixSize > p->repeatMaskMatrixBiggerThanThis) {
         char *sX2 = stString_getSubString(sX, pX, lX2);
         char *sY2 = stString_getSubString(sY, pY, lY2);
-        stList *unfilteredBottomLevelAnchorPairs = getBlastPairs(sX2, sY2, lX2, lY2, p->constraintDiagonalTrim, 0);
+        stList *unfilteredBottomLevelAnchorPairs = getAnchorPairs(sX2, sY2, lX2, lY2, 0, p);
         stList_sort(unfilteredBottomLevelAnchorPairs, (int (*)(const void *, const void *)) stIntTuple_cmpFn);
         stList *bottomLevelAnchorPairs = filterToRemoveOverlap(unfilteredBottomLevelAnchorPairs);
         st_logDebug("Got %" PRIi64 " bottom level anchor pairs, which reduced to %" PRIi64 " after filtering \n",
@@ -969,42 +1862,102 @@ static void getBlastPairsForPairwiseAlignmentParametersP(const char *sX, const c
     }
 }
 
-stList *getBlastPairsForPairwiseAlignmentParameters(const char *sX, const char *sY, const int64_t lX, const int64_t lY,
-        PairwiseAlignmentParameters *p) {
-    if ((int64_t) lX * lY <= p->anchorMatrixBiggerThanThis) {
-        return stList_construct();
+typedef struct _anchorGaps {
+    const char *sX, *sY;
+    int64_t lX, lY;
+    stList *topLevelAnchorPairs;
+    PairwiseAlignmentParameters *p;
+    stList **bottomLevelAnchorPairs; //The anchor pairs found in each gap, gap i being the gap before top level pair i
+} AnchorGaps;
+
+static void anchorGaps_fill(void *args, int64_t gap, int64_t thread) {
+    /*
+     * Finds the bottom level anchor pairs of the gap, between the top level pairs either side of it or the ends of the
+     * sequences. The gaps are independent, so may be filled by different threads.
+     */
+    AnchorGaps *a = args;
+    stIntTuple *previousAnchorPair = gap > 0 ? stList_get(a->topLevelAnchorPairs, gap - 1) : NULL;
+    stIntTuple *anchorPair = gap < stList_length(a->topLevelAnchorPairs) ? stList_get(a->topLevelAnchorPairs, gap) : NULL;
+    int64_t pX = previousAnchorPair != NULL ? stIntTuple_get(previousAnchorPair, 0) + 1 : 0;
+    int64_t pY = previousAnchorPair != NULL ? stIntTuple_get(previousAnchorPair, 1) + 1 : 0;
+    int64_t x = anchorPair != NULL ? stIntTuple_get(anchorPair, 0) : a->lX;
+    int64_t y = anchorPair != NULL ? stIntTuple_get(anchorPair, 1) : a->lY;
+    assert(x >= pX && x <= a->lX);
+    assert(y >= pY && y <= a->lY);
+    a->bottomLevelAnchorPairs[gap] = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    getBlastPairsForPairwiseAlignmentParametersP(a->sX, a->sY, pX, pY, x, y, a->p, a->bottomLevelAnchorPairs[gap]);
+}
+
+static void anchorGaps_merge(AnchorGaps *a, int64_t gap, stList *combinedAnchorPairs) {
+    //Appends the pairs of the gap and then the top level pair after it to the combined pairs
+    stList_appendAll(combinedAnchorPairs, a->bottomLevelAnchorPairs[gap]);
+    stList_setDestructor(a->bottomLevelAnchorPairs[gap], NULL);
+    stList_destruct(a->bottomLevelAnchorPairs[gap]);
+    if (gap < stList_length(a->topLevelAnchorPairs)) {
+        stList_append(combinedAnchorPairs, stList_get(a->topLevelAnchorPairs, gap));
     }
+}
+
+static stList *getCombinedAnchorPairs(const char *sX, const char *sY, const int64_t lX, const int64_t lY,
+        SeedIndex *indexX, PairwiseAlignmentParameters *p) {
     //Anchor pairs
-    stList *unfilteredTopLevelAnchorPairs = getBlastPairs(sX, sY, lX, lY, p->constraintDiagonalTrim, 1);
+    stList *unfilteredTopLevelAnchorPairs = indexX != NULL && p->anchorMethod == seedAnchors ?
+            seedIndex_getAnchorPairs(indexX, sY, lY, p->constraintDiagonalTrim) : getAnchorPairs(sX, sY, lX, lY, 1, p);
     stList_sort(unfilteredTopLevelAnchorPairs, (int (*)(const void *, const void *)) stIntTuple_cmpFn);
     stList *topLevelAnchorPairs = filterToRemoveOverlap(unfilteredTopLevelAnchorPairs);
     st_logDebug("Got %" PRIi64 " top level anchor pairs, which reduced to %" PRIi64 " after filtering \n",
             stList_length(unfilteredTopLevelAnchorPairs), stList_length(topLevelAnchorPairs));
     stList_destruct(unfilteredTopLevelAnchorPairs);
 
-    int64_t pX = 0;
-    int64_t pY = 0;
+    //Fill the gaps before each top level anchor pair and after the last, merging them in order
+    int64_t gapNumber = stList_length(topLevelAnchorPairs) + 1;
+    AnchorGaps a = { sX, sY, lX, lY, topLevelAnchorPairs, p, st_malloc(gapNumber * sizeof(stList *)) };
     stList *combinedAnchorPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
-    for (int64_t i = 0; i < stList_length(topLevelAnchorPairs); i++) {
-        stIntTuple *anchorPair = stList_get(topLevelAnchorPairs, i);
-        int64_t x = stIntTuple_get(anchorPair, 0);
-        int64_t y = stIntTuple_get(anchorPair, 1);
-        assert(x >= 0 && x < lX);
-        assert(y >= 0 && y < lY);
-        assert(x >= pX);
-        assert(y >= pY);
-        getBlastPairsForPairwiseAlignmentParametersP(sX, sY, pX, pY, x, y, p, combinedAnchorPairs);
-        stList_append(combinedAnchorPairs, anchorPair);
-        pX = x + 1;
-        pY = y + 1;
+    if (p->threadNumber > 1 && gapNumber > 1) {
+        ThreadPool *threadPool = threadPool_construct(p->threadNumber < gapNumber ? p->threadNumber : gapNumber);
+        threadPool_runTasks(threadPool, gapNumber, anchorGaps_fill, &a);
+        threadPool_destruct(threadPool);
+        for (int64_t i = 0; i < gapNumber; i++) {
+            anchorGaps_merge(&a, i, combinedAnchorPairs);
+        }
+    } else {
+        for (int64_t i = 0; i < gapNumber; i++) {
+            anchorGaps_fill(&a, i, 0);
+            anchorGaps_merge(&a, i, combinedAnchorPairs);
+        }
     }
-    getBlastPairsForPairwiseAlignmentParametersP(sX, sY, pX, pY, lX, lY, p, combinedAnchorPairs);
+    free(a.bottomLevelAnchorPairs);
     stList_setDestructor(topLevelAnchorPairs, NULL);
     stList_destruct(topLevelAnchorPairs);
     st_logDebug("Got %" PRIi64 " combined anchor pairs\n", stList_length(combinedAnchorPairs));
     return combinedAnchorPairs;
 }
 
+stList *getBlastPairsForPairwiseAlignmentParametersUsingIndex(const char *sX, const char *sY, const int64_t lX,
+        const int64_t lY, SeedIndex *indexX, PairwiseAlignmentParameters *p) {
+    if ((int64_t) lX * lY <= p->anchorMatrixBiggerThanThis) {
+        return stList_construct();
+    }
+    if (p->anchorCache == NULL) {
+        return getCombinedAnchorPairs(sX, sY, lX, lY, indexX, p);
+    }
+    //The parameters the anchors depend on
+    int64_t parameters[] = { p->anchorMethod, p->constraintDiagonalTrim, p->repeatMaskMatrixBiggerThanThis };
+    stList *combinedAnchorPairs = anchorCache_get(p->anchorCache, sX, sY, lX, lY, parameters, 3);
+    if (combinedAnchorPairs != NULL) {
+        st_logDebug("Got %" PRIi64 " combined anchor pairs from the cache\n", stList_length(combinedAnchorPairs));
+        return combinedAnchorPairs;
+    }
+    combinedAnchorPairs = getCombinedAnchorPairs(sX, sY, lX, lY, indexX, p);
+    anchorCache_add(p->anchorCache, sX, sY, lX, lY, parameters, 3, combinedAnchorPairs);
+    return combinedAnchorPairs;
+}
+
+stList *getBlastPairsForPairwiseAlignmentParameters(const char *sX, const char *sY, const int64_t lX, const int64_t lY,
+        PairwiseAlignmentParameters *p) {
+    return getBlastPairsForPairwiseAlignmentParametersUsingIndex(sX, sY, lX, lY, NULL, p);
+}
+
 ///////////////////////////////////
 ///////////////////////////////////
 //Split large gap functions
@@ -1066,18 +2019,26 @@ stList *getSplitPoints(stList *anchorPairs, int64_t lX, int64_t lY, int64_t spli
     return splitPoints;
 }
 
-static void convertAlignedPairs(stList *alignedPairs2, int64_t offsetX, int64_t offsetY) {
+static stList *getSubRegionAnchorPairs(stList *anchorPairs, int64_t *j, int64_t x1, int64_t y1, int64_t x2, int64_t y2) {
     /*
-     * Convert the coordinates of the computed pairs.
+     * Gets the anchor pairs within the sub region, starting from the jth, relative to the sub region's start, and moves j
+     * past them.
      */
-    for (int64_t k = 0; k < stList_length(alignedPairs2); k++) {
-        stIntTuple *i = stList_get(alignedPairs2, k);
-        assert(stIntTuple_length(i) == 3);
-        stList_set(alignedPairs2, k,
-                stIntTuple_construct3(stIntTuple_get(i, 0), stIntTuple_get(i, 1) + offsetX,
-                        stIntTuple_get(i, 2) + offsetY));
-        stIntTuple_destruct(i);
+    stList *subListOfAnchorPoints = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    while (*j < stList_length(anchorPairs)) {
+        stIntTuple *anchorPair = stList_get(anchorPairs, *j);
+        int64_t x = stIntTuple_get(anchorPair, 0);
+        int64_t y = stIntTuple_get(anchorPair, 1);
+        assert(x + y >= x1 + y1);
+        if (x + y >= x2 + y2) {
+            break;
+        }
+        assert(x >= x1 && x < x2);
+        assert(y >= y1 && y < y2);
+        stList_append(subListOfAnchorPoints, stIntTuple_construct2(x - x1, y - y1));
+        (*j)++;
     }
+    return subListOfAnchorPoints;
 }
 
 void getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps(StateMachine *sM, stList *anchorPairs, const char *sX, const char *sY,
@@ -1086,6 +2047,9 @@ void getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps(StateMachine *sM
         void (*diagonalPosteriorProbFn)(StateMachine *, int64_t, DpMatrix *, DpMatrix *, const SymbolString, const SymbolString, double,
                 PairwiseAlignmentParameters *, void *), void (*coordinateCorrectionFn)(), void *extraArgs) {
     stList *splitPoints = getSplitPoints(anchorPairs, lX, lY, p->splitMatrixBiggerThanThis, alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd);
+    //The sequences are converted once, the sub regions being views of them
+    SymbolString sX2 = symbolString_construct(sX, lX);
+    SymbolString sY2 = symbolString_construct(sY, lY);
     int64_t j = 0;
     //Now to the actual alignments
     for (int64_t i = 0; i < stList_length(splitPoints); i++) {
@@ -1096,26 +2060,11 @@ void getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps(StateMachine *sM
         int64_t y2 = stIntTuple_get(subRegion, 3);
 
         //Sub sequences
-        char *sX2 = stString_getSubString(sX, x1, x2 - x1);
-        char *sY2 = stString_getSubString(sY, y1, y2 - y1);
-        SymbolString sX3 = symbolString_construct(sX2, x2 - x1);
-        SymbolString sY3 = symbolString_construct(sY2, y2 - y1);
+        SymbolString sX3 = symbolString_getSubString(sX2, x1, x2 - x1);
+        SymbolString sY3 = symbolString_getSubString(sY2, y1, y2 - y1);
 
         //List of anchor pairs
-        stList *subListOfAnchorPoints = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
-        while (j < stList_length(anchorPairs)) {
-            stIntTuple *anchorPair = stList_get(anchorPairs, j);
-            int64_t x = stIntTuple_get(anchorPair, 0);
-            int64_t y = stIntTuple_get(anchorPair, 1);
-            assert(x + y >= x1 + y1);
-            if (x + y >= x2 + y2) {
-                break;
-            }
-            assert(x >= x1 && x < x2);
-            assert(y >= y1 && y < y2);
-            stList_append(subListOfAnchorPoints, stIntTuple_construct2(x - x1, y - y1));
-            j++;
-        }
+        stList *subListOfAnchorPoints = getSubRegionAnchorPairs(anchorPairs, &j, x1, y1, x2, y2);
 
         //Make the alignments
         getPosteriorProbsWithBanding(sM, subListOfAnchorPoints, sX3, sY3, p, (alignmentHasRaggedLeftEnd || i > 0),
@@ -1126,13 +2075,156 @@ void getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps(StateMachine *sM
 
         //Clean up
         stList_destruct(subListOfAnchorPoints);
-        free(sX2);
-        free(sY2);
-        symbolString_destruct(sX3);
-        symbolString_destruct(sY3);
     }
     assert(j == stList_length(anchorPairs));
     stList_destruct(splitPoints);
+    symbolString_destruct(sX2);
+    symbolString_destruct(sY2);
+}
+
+typedef struct _subRegionAlignments {
+    StateMachine *sM;
+    SymbolString sX, sY;
+    stList *splitPoints;
+    stList **subListsOfAnchorPoints;
+    void **regionArgs;
+    PairwiseAlignmentParameters *p;
+    bool alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd;
+    void (*diagonalPosteriorProbFn)(StateMachine *, int64_t, DpMatrix *, DpMatrix *, const SymbolString, const SymbolString, double,
+            PairwiseAlignmentParameters *, void *);
+} SubRegionAlignments;
+
+static void subRegionAlignments_align(void *args, int64_t i, int64_t thread) {
+    SubRegionAlignments *a = args;
+    stIntTuple *subRegion = stList_get(a->splitPoints, i);
+    int64_t x1 = stIntTuple_get(subRegion, 0);
+    int64_t y1 = stIntTuple_get(subRegion, 1);
+    SymbolString sX3 = symbolString_getSubString(a->sX, x1, stIntTuple_get(subRegion, 2) - x1);
+    SymbolString sY3 = symbolString_getSubString(a->sY, y1, stIntTuple_get(subRegion, 3) - y1);
+    getPosteriorProbsWithBanding(a->sM, a->subListsOfAnchorPoints[i], sX3, sY3, a->p, (a->alignmentHasRaggedLeftEnd || i > 0),
+            (a->alignmentHasRaggedRightEnd || i < stList_length(a->splitPoints) - 1), a->diagonalPosteriorProbFn,
+            a->regionArgs[i]);
+}
+
+void getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps2(StateMachine *sM, stList *anchorPairs, const char *sX,
+        const char *sY, int64_t lX, int64_t lY, PairwiseAlignmentParameters *p, bool alignmentHasRaggedLeftEnd,
+        bool alignmentHasRaggedRightEnd,
+        void (*diagonalPosteriorProbFn)(StateMachine *, int64_t, DpMatrix *, DpMatrix *, const SymbolString, const SymbolString, double,
+                PairwiseAlignmentParameters *, void *), void *(*constructRegionArgsFn)(void *),
+        void (*mergeRegionArgsFn)(void *, int64_t, int64_t, void *), void *extraArgs) {
+    stList *splitPoints = getSplitPoints(anchorPairs, lX, lY, p->splitMatrixBiggerThanThis, alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd);
+    int64_t regionNumber = stList_length(splitPoints);
+    SubRegionAlignments a = { sM, symbolString_construct(sX, lX), symbolString_construct(sY, lY), splitPoints,
+            st_malloc(regionNumber * sizeof(stList *)), st_malloc(regionNumber * sizeof(void *)), p,
+            alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd, diagonalPosteriorProbFn };
+    int64_t j = 0;
+    for (int64_t i = 0; i < regionNumber; i++) {
+        stIntTuple *subRegion = stList_get(splitPoints, i);
+        a.subListsOfAnchorPoints[i] = getSubRegionAnchorPairs(anchorPairs, &j, stIntTuple_get(subRegion, 0),
+                stIntTuple_get(subRegion, 1), stIntTuple_get(subRegion, 2), stIntTuple_get(subRegion, 3));
+    }
+    assert(j == stList_length(anchorPairs));
+    if (p->threadNumber > 1 && regionNumber > 1) {
+        /*
+         * The regions are aligned by the threads, each region's diagonals being calculated by the one thread aligning
+         * it, and then merged in order.
+         */
+        PairwiseAlignmentParameters p2 = *p;
+        p2.threadNumber = 1;
+        p2.pipelineTraceBacks = 0;
+        a.p = &p2;
+        for (int64_t i = 0; i < regionNumber; i++) {
+            a.regionArgs[i] = constructRegionArgsFn(extraArgs);
+        }
+        ThreadPool *threadPool = threadPool_construct(p->threadNumber < regionNumber ? p->threadNumber : regionNumber);
+        threadPool_runTasks(threadPool, regionNumber, subRegionAlignments_align, &a);
+        threadPool_destruct(threadPool);
+        for (int64_t i = 0; i < regionNumber; i++) {
+            stIntTuple *subRegion = stList_get(splitPoints, i);
+            mergeRegionArgsFn(a.regionArgs[i], stIntTuple_get(subRegion, 0), stIntTuple_get(subRegion, 1), extraArgs);
+        }
+    } else {
+        //Each region is merged as soon as it is aligned, so only one region's results are held at a time
+        for (int64_t i = 0; i < regionNumber; i++) {
+            stIntTuple *subRegion = stList_get(splitPoints, i);
+            a.regionArgs[i] = constructRegionArgsFn(extraArgs);
+            subRegionAlignments_align(&a, i, 0);
+            mergeRegionArgsFn(a.regionArgs[i], stIntTuple_get(subRegion, 0), stIntTuple_get(subRegion, 1), extraArgs);
+        }
+    }
+    //Clean up
+    for (int64_t i = 0; i < regionNumber; i++) {
+        stList_destruct(a.subListsOfAnchorPoints[i]);
+    }
+    free(a.subListsOfAnchorPoints);
+    free(a.regionArgs);
+    stList_destruct(splitPoints);
+    symbolString_destruct(a.sX);
+    symbolString_destruct(a.sY);
+}
+
+static void appendAlignmentOperations(struct List *operations, int64_t type, int64_t length) {
+    //Adds length to the last operation if it is of the type, else appends an operation of the type and length
+    if (length == 0) {
+        return;
+    }
+    struct AlignmentOperation *operation = operations->length > 0 ? operations->list[operations->length - 1] : NULL;
+    if (operation != NULL && operation->opType == type) {
+        operation->length += length;
+    } else {
+        listAppend(operations, constructAlignmentOperation(type, length, 0.0));
+    }
+}
+
+struct List *getViterbiAlignmentWithBandingSplittingAlignmentsByLargeGaps(StateMachine *sM, stList *anchorPairs,
+        const char *sX, const char *sY, int64_t lX, int64_t lY, PairwiseAlignmentParameters *p,
+        bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd, double *score) {
+    /*
+     * Aligns each region in turn, so only one region's tracebacks are held at a time. The part of each large gap
+     * between two regions, and any ragged end left out, is aligned as gaps, so the operations cover both sequences.
+     */
+    stList *splitPoints = getSplitPoints(anchorPairs, lX, lY, p->splitMatrixBiggerThanThis, alignmentHasRaggedLeftEnd,
+            alignmentHasRaggedRightEnd);
+    SymbolString sX2 = symbolString_construct(sX, lX);
+    SymbolString sY2 = symbolString_construct(sY, lY);
+    struct List *alignmentOperations = constructEmptyList(0, (void (*)(void *)) destructAlignmentOperation);
+    *score = 0.0;
+    int64_t x = 0, y = 0, j = 0; //x and y are the end of the last region
+    for (int64_t i = 0; i < stList_length(splitPoints); i++) {
+        stIntTuple *subRegion = stList_get(splitPoints, i);
+        int64_t x1 = stIntTuple_get(subRegion, 0);
+        int64_t y1 = stIntTuple_get(subRegion, 1);
+        int64_t x2 = stIntTuple_get(subRegion, 2);
+        int64_t y2 = stIntTuple_get(subRegion, 3);
+        appendAlignmentOperations(alignmentOperations, PAIRWISE_INDEL_X, x1 - x);
+        appendAlignmentOperations(alignmentOperations, PAIRWISE_INDEL_Y, y1 - y);
+
+        SymbolString sX3 = symbolString_getSubString(sX2, x1, x2 - x1);
+        SymbolString sY3 = symbolString_getSubString(sY2, y1, y2 - y1);
+        stList *subListOfAnchorPoints = getSubRegionAnchorPairs(anchorPairs, &j, x1, y1, x2, y2);
+        double regionScore;
+        struct List *regionOperations = getViterbiAlignmentWithBanding(sM, subListOfAnchorPoints, sX3, sY3, p,
+                (alignmentHasRaggedLeftEnd || i > 0), (alignmentHasRaggedRightEnd || i < stList_length(splitPoints) - 1),
+                &regionScore);
+        *score += regionScore;
+        for (int64_t k = 0; k < regionOperations->length; k++) {
+            struct AlignmentOperation *operation = regionOperations->list[k];
+            appendAlignmentOperations(alignmentOperations, operation->opType, operation->length);
+        }
+        destructList(regionOperations);
+        stList_destruct(subListOfAnchorPoints);
+        x = x2;
+        y = y2;
+    }
+    appendAlignmentOperations(alignmentOperations, PAIRWISE_INDEL_X, lX - x);
+    appendAlignmentOperations(alignmentOperations, PAIRWISE_INDEL_Y, lY - y);
+    assert(j == stList_length(anchorPairs));
+
+    //Clean up
+    stList_destruct(splitPoints);
+    symbolString_destruct(sX2);
+    symbolString_destruct(sY2);
+    return alignmentOperations;
 }
 
 ///////////////////////////////////
@@ -1151,8 +2243,17 @@ PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters_construct() {
     p->anchorMatrixBiggerThanThis = 500 * 500;
     p->repeatMaskMatrixBiggerThanThis = 500 * 500;
     p->splitMatrixBiggerThanThis = (int64_t) 3000 * 3000;
+    p->anchorMethod = seedAnchors;
+    p->anchorCache = NULL;
     p->alignAmbiguityCharacters = 0;
     p->gapGamma = 0.5;
+    p->scaledProbabilities = 0;
+    p->threadNumber = 1;
+    p->minDiagonalCellsPerThread = 1000;
+    p->adaptiveBandDrop = 0.0;
+    p->backwardBandDrop = 0.0;
+    p->checkpointDiagonals = 0;
+    p->pipelineTraceBacks = 0;
     return p;
 }
 
@@ -1160,35 +2261,53 @@ void pairwiseAlignmentBandingParameters_destruct(PairwiseAlignmentParameters *p)
     free(p);
 }
 
-static void alignedPairCoordinateCorrectionFn(int64_t offsetX, int64_t offsetY, void *extraArgs) {
-    stList *subListOfAlignedPairs = ((void **) extraArgs)[0];
-    stList *alignedPairs = ((void **) extraArgs)[1];
-    convertAlignedPairs(subListOfAlignedPairs, offsetX, offsetY); //Shift back the aligned pairs to the appropriate coordinates
-    while (stList_length(subListOfAlignedPairs) > 0) {
-        stList_append(alignedPairs, stList_pop(subListOfAlignedPairs));
-    }
+static void *alignedPairConstructRegionArgsFn(void *extraArgs) {
+    void **regionArgs = st_malloc(sizeof(void *));
+    regionArgs[0] = alignedPairArray_construct(); //The region's aligned pairs, see diagonalCalculationPosteriorMatchProbsToArray
+    return regionArgs;
 }
 
-stList *getAlignedPairsUsingAnchors(StateMachine *sM, const char *sX, const char *sY, stList *anchorPairs, PairwiseAlignmentParameters *p,
-        bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd) {
+static void alignedPairMergeRegionArgsFn(void *regionArgs, int64_t offsetX, int64_t offsetY, void *extraArgs) {
+    AlignedPairArray *subAlignedPairs = ((void **) regionArgs)[0];
+    //Shift back the aligned pairs to the appropriate coordinates as they are copied
+    alignedPairArray_appendArray(extraArgs, subAlignedPairs, offsetX, offsetY);
+    alignedPairArray_destruct(subAlignedPairs);
+    free(regionArgs);
+}
+
+AlignedPairArray *getAlignedPairArrayUsingAnchors(StateMachine *sM, const char *sX, const char *sY, stList *anchorPairs,
+        PairwiseAlignmentParameters *p, bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd) {
     const int64_t lX = strlen(sX);
     const int64_t lY = strlen(sY);
 
-    //This list of pairs to be returned. Not in any order, but points must be unique
-    stList *subListOfAlignedPairs = stList_construct();
-    stList *alignedPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
-    void *extraArgs[2] = { subListOfAlignedPairs, alignedPairs };
+    //The pairs to be returned. Not in any order, but points must be unique
+    AlignedPairArray *alignedPairs = alignedPairArray_construct();
 
-    getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps(sM, anchorPairs, sX, sY, lX, lY, p,
-            alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd, diagonalCalculationPosteriorMatchProbs,
-            alignedPairCoordinateCorrectionFn, extraArgs);
+    getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps2(sM, anchorPairs, sX, sY, lX, lY, p,
+            alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd, diagonalCalculationPosteriorMatchProbsToArray,
+            alignedPairConstructRegionArgsFn, alignedPairMergeRegionArgsFn, alignedPairs);
 
-    assert(stList_length(subListOfAlignedPairs) == 0);
-    stList_destruct(subListOfAlignedPairs);
+    return alignedPairs;
+}
 
+AlignedPairArray *getAlignedPairArray(StateMachine *sM, const char *sX, const char *sY, PairwiseAlignmentParameters *p,
+        bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd) {
+    stList *anchorPairs = getBlastPairsForPairwiseAlignmentParameters(sX, sY, strlen(sX), strlen(sY), p);
+    AlignedPairArray *alignedPairs = getAlignedPairArrayUsingAnchors(sM, sX, sY, anchorPairs, p,
+            alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd);
+    stList_destruct(anchorPairs);
     return alignedPairs;
 }
 
+stList *getAlignedPairsUsingAnchors(StateMachine *sM, const char *sX, const char *sY, stList *anchorPairs, PairwiseAlignmentParameters *p,
+        bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd) {
+    AlignedPairArray *alignedPairs = getAlignedPairArrayUsingAnchors(sM, sX, sY, anchorPairs, p,
+            alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd);
+    stList *alignedPairList = alignedPairArray_getList(alignedPairs);
+    alignedPairArray_destruct(alignedPairs);
+    return alignedPairList;
+}
+
 stList *getAlignedPairs(StateMachine *sM, const char *sX, const char *sY, PairwiseAlignmentParameters *p, bool alignmentHasRaggedLeftEnd,
         bool alignmentHasRaggedRightEnd) {
     stList *anchorPairs = getBlastPairsForPairwiseAlignmentParameters(sX, sY, strlen(sX), strlen(sY), p);
@@ -1198,8 +2317,40 @@ stList *getAlignedPairs(StateMachine *sM, const char *sX, const char *sY, Pairwi
     return alignedPairs;
 }
 
+struct List *getViterbiAlignmentUsingAnchors(StateMachine *sM, const char *sX, const char *sY, stList *anchorPairs,
+        PairwiseAlignmentParameters *p, bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd, double *score) {
+    return getViterbiAlignmentWithBandingSplittingAlignmentsByLargeGaps(sM, anchorPairs, sX, sY, strlen(sX), strlen(sY), p,
+            alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd, score);
+}
+
+struct List *getViterbiAlignment(StateMachine *sM, const char *sX, const char *sY, PairwiseAlignmentParameters *p,
+        bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd, double *score) {
+    stList *anchorPairs = getBlastPairsForPairwiseAlignmentParameters(sX, sY, strlen(sX), strlen(sY), p);
+    struct List *alignmentOperations = getViterbiAlignmentUsingAnchors(sM, sX, sY, anchorPairs, p,
+            alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd, score);
+    stList_destruct(anchorPairs);
+    return alignmentOperations;
+}
+
+static void *expectationsConstructRegionArgsFn(void *extraArgs) {
+    return hmm_constructEmpty(0.0, ((Hmm *) extraArgs)->type);
+}
+
+static void expectationsMergeRegionArgsFn(void *regionArgs, int64_t offsetX, int64_t offsetY, void *extraArgs) {
+    hmm_addExpectations(extraArgs, regionArgs);
+    hmm_destruct(regionArgs);
+}
+
 void getExpectationsUsingAnchors(StateMachine *sM, Hmm *hmmExpectations, const char *sX, const char *sY, stList *anchorPairs,
         PairwiseAlignmentParameters *p, bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd) {
+    if (p->threadNumber > 1) {
+        //The regions' expectations are summed separately and then added, so may differ in the last bits from
+        //summing them all in turn
+        getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps2(sM, anchorPairs, sX, sY, strlen(sX), strlen(sY), p,
+                alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd, diagonalCalculationExpectations,
+                expectationsConstructRegionArgsFn, expectationsMergeRegionArgsFn, hmmExpectations);
+        return;
+    }
     getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps(sM, anchorPairs, sX, sY, strlen(sX), strlen(sY), p,
             alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd, diagonalCalculationExpectations, NULL,
             hmmExpectations);
@@ -1213,6 +2364,144 @@ void getExpectations(StateMachine *sM, Hmm *hmmExpectations, const char *sX, con
     stList_destruct(anchorPairs);
 }
 
+///////////////////////////////////
+///////////////////////////////////
+//Batches of alignments
+//
+//Many small pairs of sequences are aligned in one call, the pairs
+//being split between threads, each pair aligned by one thread. With one
+//thread the pairs are just aligned in turn.
+///////////////////////////////////
+///////////////////////////////////
+
+typedef struct _batchAlignments {
+    StateMachine *sM;
+    stList *sXs, *sYs, *anchorPairs;
+    stList *emptyAnchorPairs; //Used for the pairs without anchor pairs
+    PairwiseAlignmentParameters *p;
+    bool alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd;
+    int64_t *order; //The pairs in the order they are aligned
+    void **results; //The aligned pairs or expectations of each pair
+    Hmm *hmmExpectations; //If not NULL, the pairs are aligned in turn and their expectations added straight to it
+} BatchAlignments;
+
+static int64_t *batchAlignments_getOrder(stList *sXs, stList *sYs) {
+    /*
+     * Orders the pairs from the largest (by the size of their dp matrix) to the smallest, so the pairs the threads are
+     * aligning when the others run out are small ones.
+     */
+    int64_t pairNumber = stList_length(sXs);
+    stList *sizes = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    for (int64_t i = 0; i < pairNumber; i++) {
+        int64_t size = (int64_t) strlen(stList_get(sXs, i)) * (int64_t) strlen(stList_get(sYs, i));
+        stList_append(sizes, stIntTuple_construct2(-size, i));
+    }
+    stList_sort(sizes, (int (*)(const void *, const void *)) stIntTuple_cmpFn);
+    int64_t *order = st_malloc(pairNumber * sizeof(int64_t));
+    for (int64_t i = 0; i < pairNumber; i++) {
+        order[i] = stIntTuple_get(stList_get(sizes, i), 1);
+    }
+    stList_destruct(sizes);
+    return order;
+}
+
+static int64_t batchAlignments_getThreadNumber(stList *sXs, stList *sYs, stList *anchorPairs,
+        PairwiseAlignmentParameters *p) {
+    /*
+     * Checks the batch is well formed, returning the number of threads to align it with.
+     */
+    int64_t pairNumber = stList_length(sXs);
+    if (stList_length(sYs) != pairNumber || (anchorPairs != NULL && stList_length(anchorPairs) != pairNumber)) {
+        st_errAbort("Got a batch of %" PRIi64 " x sequences but %" PRIi64 " y sequences and %" PRIi64 " anchor pair lists",
+                pairNumber, stList_length(sYs), anchorPairs != NULL ? stList_length(anchorPairs) : pairNumber);
+    }
+    return p->threadNumber < pairNumber ? p->threadNumber : pairNumber;
+}
+
+static void batchAlignments_run(BatchAlignments *a, void (*alignFn)(void *, int64_t, int64_t), int64_t threadNumber) {
+    /*
+     * Runs alignFn for each pair. With more than one thread the pairs are split between the threads, largest first, each
+     * pair being aligned by a single thread, so the results are those of aligning the pairs one by one. With one thread
+     * the pairs are aligned in turn, in their order, with the parameters as given.
+     */
+    int64_t pairNumber = stList_length(a->sXs);
+    a->emptyAnchorPairs = stList_construct();
+    if (threadNumber > 1) {
+        PairwiseAlignmentParameters p2 = *a->p;
+        p2.threadNumber = 1;
+        p2.pipelineTraceBacks = 0;
+        a->p = &p2;
+        a->order = batchAlignments_getOrder(a->sXs, a->sYs);
+        ThreadPool *threadPool = threadPool_construct(threadNumber);
+        threadPool_runTasks(threadPool, pairNumber, alignFn, a);
+        threadPool_destruct(threadPool);
+        free(a->order);
+    } else {
+        for (int64_t pair = 0; pair < pairNumber; pair++) {
+            alignFn(a, pair, 0);
+        }
+    }
+    stList_destruct(a->emptyAnchorPairs);
+}
+
+static stList *batchAlignments_getAnchorPairs(BatchAlignments *a, int64_t pair) {
+    return a->anchorPairs != NULL ? stList_get(a->anchorPairs, pair) : a->emptyAnchorPairs;
+}
+
+static void batchAlignments_getAlignedPairs(void *args, int64_t task, int64_t thread) {
+    BatchAlignments *a = args;
+    int64_t pair = a->order != NULL ? a->order[task] : task;
+    a->results[pair] = getAlignedPairArrayUsingAnchors(a->sM, stList_get(a->sXs, pair), stList_get(a->sYs, pair),
+            batchAlignments_getAnchorPairs(a, pair), a->p, a->alignmentHasRaggedLeftEnd, a->alignmentHasRaggedRightEnd);
+}
+
+static void batchAlignments_getExpectations(void *args, int64_t task, int64_t thread) {
+    BatchAlignments *a = args;
+    int64_t pair = a->order != NULL ? a->order[task] : task;
+    Hmm *hmmExpectations = a->hmmExpectations;
+    if (hmmExpectations == NULL) {
+        hmmExpectations = a->results[pair] = hmm_constructEmpty(0.0, a->sM->type);
+    }
+    getExpectationsUsingAnchors(a->sM, hmmExpectations, stList_get(a->sXs, pair), stList_get(a->sYs, pair),
+            batchAlignments_getAnchorPairs(a, pair), a->p, a->alignmentHasRaggedLeftEnd, a->alignmentHasRaggedRightEnd);
+}
+
+stList *getAlignedPairArraysForBatch(StateMachine *sM, stList *sXs, stList *sYs, stList *anchorPairs,
+        PairwiseAlignmentParameters *p, bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd) {
+    int64_t pairNumber = stList_length(sXs);
+    int64_t threadNumber = batchAlignments_getThreadNumber(sXs, sYs, anchorPairs, p);
+    BatchAlignments a = { sM, sXs, sYs, anchorPairs, NULL, p, alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd,
+            NULL, st_malloc(pairNumber * sizeof(void *)), NULL };
+    batchAlignments_run(&a, batchAlignments_getAlignedPairs, threadNumber);
+    stList *alignedPairs = stList_construct3(pairNumber, (void (*)(void *)) alignedPairArray_destruct);
+    for (int64_t i = 0; i < pairNumber; i++) {
+        stList_set(alignedPairs, i, a.results[i]);
+    }
+    free(a.results);
+    return alignedPairs;
+}
+
+void getExpectationsForBatch(StateMachine *sM, Hmm *hmmExpectations, stList *sXs, stList *sYs, stList *anchorPairs,
+        PairwiseAlignmentParameters *p, bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd) {
+    int64_t pairNumber = stList_length(sXs);
+    int64_t threadNumber = batchAlignments_getThreadNumber(sXs, sYs, anchorPairs, p);
+    if (threadNumber <= 1) {
+        BatchAlignments a = { sM, sXs, sYs, anchorPairs, NULL, p, alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd,
+                NULL, NULL, hmmExpectations };
+        batchAlignments_run(&a, batchAlignments_getExpectations, threadNumber);
+        return;
+    }
+    BatchAlignments a = { sM, sXs, sYs, anchorPairs, NULL, p, alignmentHasRaggedLeftEnd, alignmentHasRaggedRightEnd,
+            NULL, st_malloc(pairNumber * sizeof(void *)), NULL };
+    batchAlignments_run(&a, batchAlignments_getExpectations, threadNumber);
+    //The pairs' expectations are added in the order of the pairs, so the sum does not depend on the number of threads
+    for (int64_t i = 0; i < pairNumber; i++) {
+        hmm_addExpectations(hmmExpectations, a.results[i]);
+        hmm_destruct(a.results[i]);
+    }
+    free(a.results);
+}
+
 /*
  * Functions for adjusting weights to account for probability of alignment to a gap.
  */
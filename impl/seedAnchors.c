@@ -0,0 +1,394 @@
+/*
+ * seedAnchors.c
+ *
+ *  The seeds of x are indexed by sorting them, and each seed of y is looked
+ *  up by binary search. The hits are then sorted by diagonal, so the HSPs of
+ *  a diagonal are found in turn without any state the size of x. Only the
+ *  ungapped stage of lastz is done; the gaps between the chained HSPs are left
+ *  to the banded dp.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "sonLib.h"
+#include "seedAnchors.h"
+#include "anchorSegments.h"
+
+//The 12of19 spaced seed lastz uses by default, the 1s being the positions that must match
+static const char *SEED = "1110100110010101111";
+#define SEED_LENGTH 19
+
+//Seeds occurring more often than this in x are not used, bounding the hits in repeats
+#define MAX_SEED_OCCURRENCES 100
+
+//lastz's default (HOXD70) substitution scores, indexed by A, C, G and T. Pairs with any other base score AMBIGUITY_SCORE.
+static const int64_t SUBSTITUTION_SCORES[4][4] = { { 91, -114, -31, -123 }, { -114, 100, -125, -31 }, { -31, -125,
+        100, -114 }, { -123, -31, -114, 91 } };
+#define AMBIGUITY_SCORE -100
+
+//An extension stops once its score drops this far below the best so far, lastz's default of ten times the A/A score
+#define X_DROP 910
+
+//HSPs are split into pieces where their score drops this far below the best before, see addHspPairs
+#define SPLIT_DROP 300
+
+struct _seedIndex {
+    int64_t lX;
+    bool repeatMask;
+    int8_t *cX; //The codes of the bases of x, see getBaseCodes
+    uint64_t *seeds; //The seeds of x with their positions, sorted, see getSeeds
+    int64_t seedNumber;
+};
+
+typedef struct _seedHit {
+    int64_t diagonal; //x - y
+    int64_t x;
+} SeedHit;
+
+typedef struct _hsp {
+    int64_t x, y; //Start coordinates
+    int64_t length;
+    int64_t score;
+} Hsp;
+
+///////////////////////////////////
+///////////////////////////////////
+//Seeds
+///////////////////////////////////
+///////////////////////////////////
+
+static int8_t *getBaseCodes(const char *s, int64_t l) {
+    /*
+     * Codes A, C, G and T (in either case) as 0 to 3, and anything else as -1.
+     */
+    int8_t *codes = st_malloc(l * sizeof(int8_t));
+    for (int64_t i = 0; i < l; i++) {
+        switch (toupper(s[i])) {
+            case 'A':
+                codes[i] = 0;
+                break;
+            case 'C':
+                codes[i] = 1;
+                break;
+            case 'G':
+                codes[i] = 2;
+                break;
+            case 'T':
+                codes[i] = 3;
+                break;
+            default:
+                codes[i] = -1;
+        }
+    }
+    return codes;
+}
+
+static int64_t getSeed(const char *s, const int8_t *codes, int64_t i, bool repeatMask) {
+    /*
+     * Gets the seed starting at i, the 2 bit codes of the bases at the 1s of SEED, or -1 if any of those is not A, C, G
+     * or T, or is repeat masked.
+     */
+    int64_t seed = 0;
+    for (int64_t j = 0; j < SEED_LENGTH; j++) {
+        if (SEED[j] == '1') {
+            if (codes[i + j] < 0 || (repeatMask && islower(s[i + j]))) {
+                return -1;
+            }
+            seed = (seed << 2) | codes[i + j];
+        }
+    }
+    return seed;
+}
+
+static int cmpUint64(const void *a, const void *b) {
+    uint64_t i = *(const uint64_t *) a, j = *(const uint64_t *) b;
+    return i > j ? 1 : (i < j ? -1 : 0);
+}
+
+//The seeds of a sequence are packed with their positions, the seed in the high bits, and sorted
+#define SEED_POSITION_BITS 40
+
+static uint64_t *getSeeds(const char *s, const int8_t *codes, int64_t l, bool repeatMask, int64_t *seedNumber) {
+    uint64_t *seeds = st_malloc((l >= SEED_LENGTH ? l - SEED_LENGTH + 1 : 1) * sizeof(uint64_t));
+    *seedNumber = 0;
+    for (int64_t i = 0; i + SEED_LENGTH <= l; i++) {
+        int64_t seed = getSeed(s, codes, i, repeatMask);
+        if (seed >= 0) {
+            seeds[(*seedNumber)++] = ((uint64_t) seed << SEED_POSITION_BITS) | (uint64_t) i;
+        }
+    }
+    qsort(seeds, *seedNumber, sizeof(uint64_t), cmpUint64);
+    return seeds;
+}
+
+static int64_t getFirstOccurrence(SeedIndex *index, int64_t seed) {
+    /*
+     * Returns the first of the index's seeds equal to seed, or the number of seeds if there is none.
+     */
+    uint64_t key = (uint64_t) seed << SEED_POSITION_BITS;
+    int64_t i = 0, j = index->seedNumber;
+    while (i < j) {
+        int64_t k = i + (j - i) / 2;
+        if (index->seeds[k] < key) {
+            i = k + 1;
+        } else {
+            j = k;
+        }
+    }
+    return i < index->seedNumber && (index->seeds[i] >> SEED_POSITION_BITS) == (uint64_t) seed ? i : index->seedNumber;
+}
+
+SeedIndex *seedIndex_construct(const char *sX, int64_t lX, bool repeatMask) {
+    SeedIndex *index = st_malloc(sizeof(SeedIndex));
+    index->lX = lX;
+    index->repeatMask = repeatMask;
+    index->cX = getBaseCodes(sX, lX);
+    index->seeds = getSeeds(sX, index->cX, lX, repeatMask, &index->seedNumber);
+    return index;
+}
+
+void seedIndex_destruct(SeedIndex *index) {
+    free(index->cX);
+    free(index->seeds);
+    free(index);
+}
+
+static void *growArray(void *array, int64_t *maxLength, size_t size) {
+    *maxLength = 2 * *maxLength + 16;
+    array = realloc(array, *maxLength * size);
+    if (array == NULL) {
+        st_errAbort("Could not allocate room for %" PRIi64 " seed hits or HSPs", *maxLength);
+    }
+    return array;
+}
+
+static int cmpSeedHits(const void *a, const void *b) {
+    const SeedHit *i = a, *j = b;
+    return i->diagonal > j->diagonal ? 1 : (i->diagonal < j->diagonal ? -1 : (i->x > j->x ? 1 : (i->x < j->x ? -1 : 0)));
+}
+
+static SeedHit *getSeedHits(SeedIndex *index, const char *sY, const int8_t *cY, int64_t lY, int64_t *hitNumber) {
+    /*
+     * Gets the hits of the seeds of y in x, ordered by diagonal and then x, leaving out the seeds occurring more than
+     * MAX_SEED_OCCURRENCES times in x.
+     */
+    int64_t maxHitNumber = 0;
+    SeedHit *hits = NULL;
+    *hitNumber = 0;
+    for (int64_t y = 0; y + SEED_LENGTH <= lY; y++) {
+        int64_t seed = getSeed(sY, cY, y, index->repeatMask);
+        if (seed < 0) {
+            continue;
+        }
+        int64_t first = getFirstOccurrence(index, seed), last = first;
+        while (last < index->seedNumber && (index->seeds[last] >> SEED_POSITION_BITS) == (uint64_t) seed) {
+            last++;
+        }
+        if (last - first > MAX_SEED_OCCURRENCES) {
+            continue;
+        }
+        for (int64_t i = first; i < last; i++) {
+            if (*hitNumber == maxHitNumber) {
+                hits = growArray(hits, &maxHitNumber, sizeof(SeedHit));
+            }
+            int64_t x = index->seeds[i] & (((uint64_t) 1 << SEED_POSITION_BITS) - 1);
+            hits[*hitNumber].diagonal = x - y;
+            hits[(*hitNumber)++].x = x;
+        }
+    }
+    qsort(hits, *hitNumber, sizeof(SeedHit), cmpSeedHits);
+    return hits;
+}
+
+///////////////////////////////////
+///////////////////////////////////
+//HSPs
+///////////////////////////////////
+///////////////////////////////////
+
+static inline int64_t getSubstitutionScore(int8_t i, int8_t j) {
+    return i < 0 || j < 0 ? AMBIGUITY_SCORE : SUBSTITUTION_SCORES[i][j];
+}
+
+static Hsp extendSeedHit(const int8_t *cX, const int8_t *cY, int64_t lX, int64_t lY, int64_t x, int64_t y) {
+    /*
+     * Extends the hit at x, y both ways along its diagonal until the score drops X_DROP below the best, returning the
+     * best scoring segment pair.
+     */
+    int64_t score = 0, rightScore = 0, rightLength = 0;
+    for (int64_t i = 0; x + i < lX && y + i < lY; i++) {
+        score += getSubstitutionScore(cX[x + i], cY[y + i]);
+        if (score > rightScore) {
+            rightScore = score;
+            rightLength = i + 1;
+        } else if (score < rightScore - X_DROP) {
+            break;
+        }
+    }
+    int64_t leftScore = 0, leftLength = 0;
+    score = 0;
+    for (int64_t i = 1; x - i >= 0 && y - i >= 0; i++) {
+        score += getSubstitutionScore(cX[x - i], cY[y - i]);
+        if (score > leftScore) {
+            leftScore = score;
+            leftLength = i;
+        } else if (score < leftScore - X_DROP) {
+            break;
+        }
+    }
+    Hsp hsp = { x - leftLength, y - leftLength, leftLength + rightLength, leftScore + rightScore };
+    return hsp;
+}
+
+static Hsp *getHsps(SeedIndex *index, const char *sY, const int8_t *cY, int64_t lY, int64_t *hspNumber) {
+    /*
+     * Extends every seed hit, except those within an HSP already found on the same diagonal, returning the HSPs scoring
+     * at least SEED_ANCHORS_HSP_THRESHOLD.
+     */
+    int64_t hitNumber;
+    SeedHit *hits = getSeedHits(index, sY, cY, lY, &hitNumber);
+    int64_t maxHspNumber = 0;
+    Hsp *hsps = NULL;
+    *hspNumber = 0;
+    int64_t diagonalEnd = 0; //The end in x of the last HSP extended on the diagonal of the hit
+    for (int64_t i = 0; i < hitNumber; i++) {
+        int64_t x = hits[i].x;
+        if (i > 0 && hits[i].diagonal == hits[i - 1].diagonal && x < diagonalEnd) { //Within an HSP already found
+            continue;
+        }
+        Hsp hsp = extendSeedHit(index->cX, cY, index->lX, lY, x, x - hits[i].diagonal);
+        diagonalEnd = hsp.x + hsp.length > x + 1 ? hsp.x + hsp.length : x + 1;
+        if (hsp.score >= SEED_ANCHORS_HSP_THRESHOLD) {
+            if (*hspNumber == maxHspNumber) {
+                hsps = growArray(hsps, &maxHspNumber, sizeof(Hsp));
+            }
+            hsps[(*hspNumber)++] = hsp;
+        }
+    }
+    free(hits);
+    return hsps;
+}
+
+///////////////////////////////////
+///////////////////////////////////
+//Chaining
+///////////////////////////////////
+///////////////////////////////////
+
+static int cmpHsps(const void *a, const void *b) {
+    const Hsp *i = a, *j = b;
+    return i->x > j->x ? 1 : (i->x < j->x ? -1 : (i->y > j->y ? 1 : (i->y < j->y ? -1 :
+            (i->length > j->length ? 1 : (i->length < j->length ? -1 : 0)))));
+}
+
+static stList *getChain(Hsp *hsps, int64_t hspNumber, int64_t lY) {
+    /*
+     * Returns the colinear chain of HSPs of highest total score, in order. An HSP can follow another if it starts no
+     * earlier in x and ends later in y. The HSPs may overlap, the overlap being left out of the later HSP when the
+     * chain's pairs are made. Taking the HSPs by their start in x, the best chain ending at each is its score plus the
+     * best chain ending earlier in y, which is kept for each end in y in a Fenwick tree of maxima, so the chain is
+     * found in O(n log n).
+     */
+    stList *chain = stList_construct();
+    if (hspNumber == 0) {
+        return chain;
+    }
+    qsort(hsps, hspNumber, sizeof(Hsp), cmpHsps);
+    int64_t *treeScores = st_calloc(lY + 1, sizeof(int64_t)); //Indexed by the end in y, from 1
+    int64_t *treeHsps = st_malloc((lY + 1) * sizeof(int64_t));
+    int64_t *previous = st_malloc(hspNumber * sizeof(int64_t));
+    int64_t bestScore = 0, best = 0;
+    for (int64_t i = 0; i < hspNumber; i++) {
+        //The best chain ending before the end of the HSP in y
+        int64_t end = hsps[i].y + hsps[i].length, score = 0;
+        previous[i] = -1;
+        for (int64_t j = end - 1; j > 0; j -= j & -j) {
+            if (treeScores[j] > score) {
+                score = treeScores[j];
+                previous[i] = treeHsps[j];
+            }
+        }
+        score += hsps[i].score;
+        for (int64_t j = end; j <= lY; j += j & -j) {
+            if (score > treeScores[j]) {
+                treeScores[j] = score;
+                treeHsps[j] = i;
+            }
+        }
+        if (score > bestScore) {
+            bestScore = score;
+            best = i;
+        }
+    }
+    for (int64_t i = best; i != -1; i = previous[i]) {
+        stList_append(chain, &hsps[i]);
+    }
+    stList_reverse(chain);
+    free(treeScores);
+    free(treeHsps);
+    free(previous);
+    return chain;
+}
+
+static void addHspPairs(stList *anchorPairs, const int8_t *cX, const int8_t *cY, Hsp *hsp, int64_t trim, int64_t *pX,
+        int64_t *pY) {
+    /*
+     * Splits the HSP where its score drops SPLIT_DROP below the best before, adding the pairs of the best scoring part of
+     * each piece. A long HSP can run over an indel and on along the wrong diagonal for a few bases before the alignment
+     * returns to it, which lastz's gapped extension would put right; this leaves such stretches out of the anchors.
+     */
+    int64_t start = 0;
+    while (start < hsp->length) {
+        int64_t score = 0, maxScore = 0, end = start, i = start;
+        for (; i < hsp->length; i++) {
+            score += getSubstitutionScore(cX[hsp->x + i], cY[hsp->y + i]);
+            if (score > maxScore) {
+                maxScore = score;
+                end = i + 1;
+            } else if (score < maxScore - SPLIT_DROP) {
+                break;
+            }
+        }
+        if (end == start) {
+            start = i + 1;
+            continue;
+        }
+        //Leave out the start of the piece scoring at or below zero
+        int64_t pieceStart = end;
+        score = 0;
+        maxScore = 0;
+        for (int64_t j = end - 1; j >= start; j--) {
+            score += getSubstitutionScore(cX[hsp->x + j], cY[hsp->y + j]);
+            if (score > maxScore) {
+                maxScore = score;
+                pieceStart = j;
+            }
+        }
+        addAnchorSegmentPairs(anchorPairs, hsp->x + pieceStart, hsp->y + pieceStart, end - pieceStart, trim, pX, pY);
+        start = end;
+    }
+}
+
+stList *seedIndex_getAnchorPairs(SeedIndex *index, const char *sY, int64_t lY, int64_t trim) {
+    int8_t *cY = getBaseCodes(sY, lY);
+    int64_t hspNumber;
+    Hsp *hsps = getHsps(index, sY, cY, lY, &hspNumber);
+    stList *chain = getChain(hsps, hspNumber, lY);
+    stList *anchorPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+    int64_t pX = -1, pY = -1;
+    for (int64_t i = 0; i < stList_length(chain); i++) {
+        addHspPairs(anchorPairs, index->cX, cY, stList_get(chain, i), trim, &pX, &pY);
+    }
+    stList_destruct(chain);
+    free(hsps);
+    free(cY);
+    return anchorPairs;
+}
+
+stList *getSeedAnchorPairs(const char *sX, const char *sY, int64_t lX, int64_t lY, int64_t trim, bool repeatMask) {
+    SeedIndex *index = seedIndex_construct(sX, lX, repeatMask);
+    stList *anchorPairs = seedIndex_getAnchorPairs(index, sY, lY, trim);
+    seedIndex_destruct(index);
+    return anchorPairs;
+}
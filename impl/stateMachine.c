@@ -13,6 +13,7 @@
 #include "bioioC.h"
 #include "sonLib.h"
 #include "pairwiseAligner.h"
+#include "logAdd.h"
 
 ///////////////////////////////////
 ///////////////////////////////////
@@ -85,6 +86,17 @@ void hmm_setEmissionsExpectation(Hmm *hmm, int64_t state, Symbol x, Symbol y, do
     *hmm_getEmissionsExpectation2(hmm, state, x, y) = p;
 }
 
+void hmm_addExpectations(Hmm *hmm, Hmm *hmm2) {
+    assert(hmm->type == hmm2->type);
+    for (int64_t i = 0; i < hmm->stateNumber * hmm->stateNumber; i++) {
+        hmm->transitions[i] += hmm2->transitions[i];
+    }
+    for (int64_t i = 0; i < hmm->stateNumber * SYMBOL_NUMBER_NO_N * SYMBOL_NUMBER_NO_N; i++) {
+        hmm->emissions[i] += hmm2->emissions[i];
+    }
+    hmm->likelihood += hmm2->likelihood;
+}
+
 void hmm_normalise(Hmm *hmm) {
     for (int64_t from = 0; from < hmm->stateNumber; from++) {
         double total = 0.0;
@@ -215,6 +227,14 @@ static void state_check(StateMachine *sM, State s) {
     assert(s >= 0 && s < sM->stateNumber);
 }
 
+StateEmission stateMachine_getStateEmission(StateMachine *sM, int64_t state) {
+    state_check(sM, state);
+    if (state == match) {
+        return matchEmission;
+    }
+    return state == shortGapX || state == longGapX ? gapXEmission : gapYEmission;
+}
+
 static void emissions_setMatchProbsToDefaults(double *emissionMatchProbs) {
     /*
      * This is used to set the emissions to reasonable values.
@@ -314,6 +334,239 @@ static inline double emission_getMatchProb(const double *emissionMatchProbs, Sym
     return emissionMatchProbs[x * SYMBOL_NUMBER_NO_N + y];
 }
 
+//As above, but for tables of emission probabilities rather than log probabilities, as used by the scaled dp.
+
+static inline double emission_getGapProbability(const double *emissionGapProbabilities, Symbol i) {
+    symbol_check(i);
+    if(i == n) {
+        return 0.25;
+    }
+    return emissionGapProbabilities[i];
+}
+
+static inline double emission_getMatchProbability(const double *emissionMatchProbabilities, Symbol x, Symbol y) {
+    symbol_check(x);
+    symbol_check(y);
+    if(x == n || y == n) {
+        return 0.0625;
+    }
+    return emissionMatchProbabilities[x * SYMBOL_NUMBER_NO_N + y];
+}
+
+static void emissions_setProbabilities(double *emissionProbabilities, const double *emissionLogProbs, int64_t length) {
+    for (int64_t i = 0; i < length; i++) {
+        emissionProbabilities[i] = exp(emissionLogProbs[i]);
+    }
+}
+
+///////////////////////////////////
+///////////////////////////////////
+//Transition functions
+//
+//Applied by the cell calculations to each transition between
+//the states of two cells. The cell calculations of each state
+//machine are instantiated for each of them, so they are inlined.
+///////////////////////////////////
+///////////////////////////////////
+
+static inline void doTransitionForward(double *fromCells, double *toCells, int64_t from, int64_t to, double eP,
+        double tP, void *extraArgs) {
+    toCells[to] = logAdd_inline(toCells[to], fromCells[from] + (eP + tP));
+}
+
+static inline void doTransitionBackward(double *fromCells, double *toCells, int64_t from, int64_t to, double eP,
+        double tP, void *extraArgs) {
+    fromCells[from] = logAdd_inline(fromCells[from], toCells[to] + (eP + tP));
+}
+
+typedef struct _expectationArgs {
+    double totalProbability;
+    Hmm *hmmExpectations;
+    Symbol x;
+    Symbol y;
+} ExpectationArgs;
+
+static inline void doTransitionUpdateExpectations(double *fromCells, double *toCells, int64_t from, int64_t to, double eP,
+        double tP, void *extraArgs) {
+    ExpectationArgs *args = extraArgs;
+    //Calculate posterior probability of the transition/emission pair
+    double p = exp(fromCells[from] + toCells[to] + (eP + tP) - args->totalProbability);
+    //Add in the expectation of the transition
+    hmm_addToTransitionExpectation(args->hmmExpectations, from, to, p);
+    if (args->x < SYMBOL_NUMBER_NO_N && args->y < SYMBOL_NUMBER_NO_N) { //Ignore gaps involving Ns.
+        hmm_addToEmissionsExpectation(args->hmmExpectations, to, args->x, args->y, p);
+    }
+}
+
+//The max-product equivalent of doTransitionForward, which records the state of the best transition so far into each
+//state, see cellCalculateViterbi. Ties go to the first transition.
+static inline void doTransitionViterbi(double *fromCells, double *toCells, int64_t from, int64_t to, double eP,
+        double tP, void *extraArgs) {
+    double p = fromCells[from] + (eP + tP);
+    if (p > toCells[to]) {
+        toCells[to] = p;
+        uint16_t *traceBack = extraArgs;
+        *traceBack = (*traceBack & ~(7 << (3 * to))) | (from << (3 * to));
+    }
+}
+
+//The scaled dp equivalents of doTransitionForward and doTransitionBackward, in which cells hold probabilities and eP is
+//an emission probability already multiplied by the scaling factor, see STATE_MACHINE_EMISSION_PROBABILITIES.
+
+static inline void doTransitionForwardScaled(double *fromCells, double *toCells, int64_t from, int64_t to, double eP,
+        double tP, void *extraArgs) {
+    toCells[to] += fromCells[from] * (eP * tP);
+}
+
+static inline void doTransitionBackwardScaled(double *fromCells, double *toCells, int64_t from, int64_t to, double eP,
+        double tP, void *extraArgs) {
+    fromCells[from] += toCells[to] * (eP * tP);
+}
+
+static inline ExpectationArgs expectationArgs_construct(void *extraArgs, Symbol cX, Symbol cY) {
+    //extraArgs is { &totalProbability, hmmExpectations }, see cell_calculateExpectation.
+    ExpectationArgs args = { *((double *) ((void **) extraArgs)[0]), ((void **) extraArgs)[1], cX, cY };
+    return args;
+}
+
+//The transitions are done on double precision cells. If DpValue is float the cells are copied into doubles first and
+//rounded back afterwards, so each value is rounded once per cell calculation, as in the diagonal kernels, rather than
+//once per transition. If it is double the cells are used directly.
+
+static inline double *cells_load(DpValue *cells, double *values, int64_t stateNumber) {
+#ifdef DP_FLOAT
+    if (cells == NULL) {
+        return NULL;
+    }
+    for (int64_t s = 0; s < stateNumber; s++) {
+        values[s] = cells[s];
+    }
+    return values;
+#else
+    return cells;
+#endif
+}
+
+static inline void cells_store(DpValue *cells, const double *values, int64_t stateNumber) {
+#ifdef DP_FLOAT
+    if (cells != NULL) {
+        for (int64_t s = 0; s < stateNumber; s++) {
+            cells[s] = values[s];
+        }
+    }
+#endif
+}
+
+#define STATE_MACHINE_LOAD_CELLS(stateNumber) \
+    double cellValues[4][stateNumber]; \
+    double *currentValues = cells_load(current, cellValues[0], stateNumber); \
+    double *lowerValues = cells_load(lower, cellValues[1], stateNumber); \
+    double *middleValues = cells_load(middle, cellValues[2], stateNumber); \
+    double *upperValues = cells_load(upper, cellValues[3], stateNumber);
+
+#define STATE_MACHINE_STORE_CELLS(stateNumber) \
+    cells_store(current, currentValues, stateNumber); \
+    cells_store(lower, lowerValues, stateNumber); \
+    cells_store(middle, middleValues, stateNumber); \
+    cells_store(upper, upperValues, stateNumber);
+
+///////////////////////////////////
+///////////////////////////////////
+//Fused transitions
+//
+//The forward and backward calculations look up each transition
+//with the emission of the cell it goes to already included, from a
+//table per state machine with an entry per pair of symbols, N
+//included. An entry is a struct with the same transition fields as
+//the state machine, so the STATE_MACHINE*_TRANSITIONS macros apply
+//to it, given emissions of 0 (log probabilities) or the emission
+//scales (scaled dp) in place of the emission probabilities.
+///////////////////////////////////
+///////////////////////////////////
+
+#define symbolPair_index(cX, cY) ((cX) * SYMBOL_NUMBER + (cY))
+
+static inline double fuseTransition(double eP, double tP, bool probabilities) {
+    return probabilities ? eP * tP : eP + tP;
+}
+
+//Declares the emissions given to the transition macros with fused transitions, extraArgs being the emission scales
+//for the scaled dp.
+#define STATE_MACHINE_FUSED_EMISSIONS \
+    double eGapX = 0.0, eMatch = 0.0, eGapY = 0.0;
+
+#define STATE_MACHINE_FUSED_EMISSION_SCALES(emissionScales) \
+    double eGapX = ((double *) emissionScales)[0]; \
+    double eMatch = ((double *) emissionScales)[1]; \
+    double eGapY = ((double *) emissionScales)[0];
+
+#define STATE_MACHINE_SIMD_FUSED_EMISSIONS \
+    SimdDouble eGapX = simd_set1(0.0), eMatch = eGapX, eGapY = eGapX;
+
+#define STATE_MACHINE_SIMD_FUSED_EMISSION_SCALES(emissionScales) \
+    SimdDouble eGapX = simd_set1(((double *) emissionScales)[0]); \
+    SimdDouble eMatch = simd_set1(((double *) emissionScales)[1]); \
+    SimdDouble eGapY = eGapX;
+
+///////////////////////////////////
+///////////////////////////////////
+//Diagonal kernel helpers
+//
+//Vector forms of the transitions and of loading/storing
+//runs of cells, used by the state machine diagonal kernels.
+///////////////////////////////////
+///////////////////////////////////
+
+static inline void simdTransitionForward(SimdDouble *fromCells, SimdDouble *toCells, int64_t from, int64_t to, SimdDouble eP,
+        SimdDouble tP, void *extraArgs) {
+    toCells[to] = simd_logAdd(toCells[to], simd_add(fromCells[from], simd_add(eP, tP)));
+}
+
+static inline void simdTransitionBackward(SimdDouble *fromCells, SimdDouble *toCells, int64_t from, int64_t to, SimdDouble eP,
+        SimdDouble tP, void *extraArgs) {
+    fromCells[from] = simd_logAdd(fromCells[from], simd_add(toCells[to], simd_add(eP, tP)));
+}
+
+static inline void simdTransitionForwardScaled(SimdDouble *fromCells, SimdDouble *toCells, int64_t from, int64_t to,
+        SimdDouble eP, SimdDouble tP, void *extraArgs) {
+    toCells[to] = simd_add(toCells[to], simd_mul(fromCells[from], simd_mul(eP, tP)));
+}
+
+static inline void simdTransitionBackwardScaled(SimdDouble *fromCells, SimdDouble *toCells, int64_t from, int64_t to,
+        SimdDouble eP, SimdDouble tP, void *extraArgs) {
+    fromCells[from] = simd_add(fromCells[from], simd_mul(toCells[to], simd_mul(eP, tP)));
+}
+
+static inline void simd_loadCells(DpCells cells, int64_t i, SimdDouble *states, int64_t stateNumber) {
+    //Loads cells i to i + SIMD_WIDTH - 1 of the run, a vector per state
+    for (int64_t s = 0; s < stateNumber; s++) {
+        states[s] = simd_loadValues(dpCells_getValue(cells, i, s));
+    }
+}
+
+static inline void simd_storeCells(DpCells cells, int64_t i, SimdDouble *states, int64_t stateNumber) {
+    for (int64_t s = 0; s < stateNumber; s++) {
+        simd_storeValues(dpCells_getValue(cells, i, s), states[s]);
+    }
+}
+
+static inline void simd_loadTransitions(const void *transitions, int64_t transitionNumber, const PackedSymbol *cX,
+        const PackedSymbol *cY, SimdDouble *t) {
+    //Loads the fused transitions (see STATE_MACHINE_FUSED_TRANSITIONS) of the symbol pairs of SIMD_WIDTH cells, a vector
+    //per transition. transitions is a table of transitionNumber doubles per symbol pair.
+    const double *pairTransitions[SIMD_WIDTH];
+    for (int64_t i = 0; i < SIMD_WIDTH; i++) {
+        pairTransitions[i] = (const double *) transitions + symbolPair_index(cX[i], cY[i]) * transitionNumber;
+    }
+    for (int64_t k = 0; k < transitionNumber; k++) {
+        double v[SIMD_WIDTH];
+        for (int64_t i = 0; i < SIMD_WIDTH; i++) {
+            v[i] = pairTransitions[i][k];
+        }
+        t[k] = simd_load(v);
+    }
+}
+
 ///////////////////////////////////
 ///////////////////////////////////
 //Five state state-machine
@@ -323,6 +576,32 @@ static inline double emission_getMatchProb(const double *emissionMatchProbs, Sym
 //Transitions
 typedef struct _StateMachine5 StateMachine5;
 
+//The transitions used by STATE_MACHINE5_TRANSITIONS, with their emissions included, see "Fused transitions" above.
+#define STATE_MACHINE5_TRANSITION_FIELDS(type) \
+    type TRANSITION_MATCH_CONTINUE; \
+    type TRANSITION_MATCH_FROM_SHORT_GAP_X; \
+    type TRANSITION_MATCH_FROM_LONG_GAP_X; \
+    type TRANSITION_GAP_SHORT_OPEN_X; \
+    type TRANSITION_GAP_SHORT_EXTEND_X; \
+    type TRANSITION_GAP_LONG_OPEN_X; \
+    type TRANSITION_GAP_LONG_EXTEND_X; \
+    type TRANSITION_MATCH_FROM_SHORT_GAP_Y; \
+    type TRANSITION_MATCH_FROM_LONG_GAP_Y; \
+    type TRANSITION_GAP_SHORT_OPEN_Y; \
+    type TRANSITION_GAP_SHORT_EXTEND_Y; \
+    type TRANSITION_GAP_LONG_OPEN_Y; \
+    type TRANSITION_GAP_LONG_EXTEND_Y;
+
+#define STATE_MACHINE5_TRANSITION_NUMBER 13
+
+typedef struct _stateMachine5Transitions {
+    STATE_MACHINE5_TRANSITION_FIELDS(double)
+} StateMachine5Transitions;
+
+typedef struct _stateMachine5SimdTransitions {
+    STATE_MACHINE5_TRANSITION_FIELDS(SimdDouble)
+} StateMachine5SimdTransitions;
+
 struct _StateMachine5 {
     StateMachine model;
     double TRANSITION_MATCH_CONTINUE; //0.9703833696510062f
@@ -345,6 +624,8 @@ struct _StateMachine5 {
     double EMISSION_MATCH_PROBS[SYMBOL_NUMBER_NO_N*SYMBOL_NUMBER_NO_N]; //Match emission probs
     double EMISSION_GAP_X_PROBS[SYMBOL_NUMBER_NO_N]; //Gap emission probs
     double EMISSION_GAP_Y_PROBS[SYMBOL_NUMBER_NO_N]; //Gap emission probs
+    StateMachine5Transitions FUSED_TRANSITIONS[SYMBOL_NUMBER * SYMBOL_NUMBER]; //The transitions by symbol pair, with emissions
+    StateMachine5 *probabilities; //The above as probabilities rather than log probabilities, for the scaled dp
 };
 
 static double stateMachine5_startStateProb(StateMachine *sM, int64_t state) {
@@ -396,40 +677,267 @@ static double stateMachine5_raggedEndStateProb(StateMachine *sM, int64_t state)
     return 0.0;
 }
 
-static void stateMachine5_cellCalculate(StateMachine *sM, double *current, double *lower, double *middle, double *upper,
+/*
+ * The transitions of the five state machine between a cell and its lower, middle and upper cells. This is a macro
+ * so that the cell calculations can be instantiated for each transition function, and for scalar or vector cells,
+ * with the transitions inlined rather than made through a function pointer. The short/long gap switch transitions
+ * (shortGapY -> shortGapX, longGapY -> longGapX and vice versa) are left out.
+ */
+#define STATE_MACHINE5_TRANSITIONS(sM5, current, lower, middle, upper, eGapX, eMatch, eGapY, doTransition, extraArgs) \
+    if (lower != NULL) { \
+        doTransition(lower, current, match, shortGapX, eGapX, sM5->TRANSITION_GAP_SHORT_OPEN_X, extraArgs); \
+        doTransition(lower, current, shortGapX, shortGapX, eGapX, sM5->TRANSITION_GAP_SHORT_EXTEND_X, extraArgs); \
+        doTransition(lower, current, match, longGapX, eGapX, sM5->TRANSITION_GAP_LONG_OPEN_X, extraArgs); \
+        doTransition(lower, current, longGapX, longGapX, eGapX, sM5->TRANSITION_GAP_LONG_EXTEND_X, extraArgs); \
+    } \
+    if (middle != NULL) { \
+        doTransition(middle, current, match, match, eMatch, sM5->TRANSITION_MATCH_CONTINUE, extraArgs); \
+        doTransition(middle, current, shortGapX, match, eMatch, sM5->TRANSITION_MATCH_FROM_SHORT_GAP_X, extraArgs); \
+        doTransition(middle, current, shortGapY, match, eMatch, sM5->TRANSITION_MATCH_FROM_SHORT_GAP_Y, extraArgs); \
+        doTransition(middle, current, longGapX, match, eMatch, sM5->TRANSITION_MATCH_FROM_LONG_GAP_X, extraArgs); \
+        doTransition(middle, current, longGapY, match, eMatch, sM5->TRANSITION_MATCH_FROM_LONG_GAP_Y, extraArgs); \
+    } \
+    if (upper != NULL) { \
+        doTransition(upper, current, match, shortGapY, eGapY, sM5->TRANSITION_GAP_SHORT_OPEN_Y, extraArgs); \
+        doTransition(upper, current, shortGapY, shortGapY, eGapY, sM5->TRANSITION_GAP_SHORT_EXTEND_Y, extraArgs); \
+        doTransition(upper, current, match, longGapY, eGapY, sM5->TRANSITION_GAP_LONG_OPEN_Y, extraArgs); \
+        doTransition(upper, current, longGapY, longGapY, eGapY, sM5->TRANSITION_GAP_LONG_EXTEND_Y, extraArgs); \
+    }
+
+#define STATE_MACHINE_EMISSIONS(sMN, cX, cY) \
+    double eGapX = emission_getGapProb(sMN->EMISSION_GAP_X_PROBS, cX); \
+    double eMatch = emission_getMatchProb(sMN->EMISSION_MATCH_PROBS, cX, cY); \
+    double eGapY = emission_getGapProb(sMN->EMISSION_GAP_Y_PROBS, cY);
+
+static void stateMachine5_cellCalculate(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle, DpValue *upper,
         Symbol cX, Symbol cY, void (*doTransition)(double *, double *, int64_t, int64_t, double, double, void *),
         void *extraArgs) {
     StateMachine5 *sM5 = (StateMachine5 *) sM;
-    if (lower != NULL) {
-        double eP = emission_getGapProb(sM5->EMISSION_GAP_X_PROBS, cX);
-        doTransition(lower, current, match, shortGapX, eP, sM5->TRANSITION_GAP_SHORT_OPEN_X, extraArgs);
-        doTransition(lower, current, shortGapX, shortGapX, eP, sM5->TRANSITION_GAP_SHORT_EXTEND_X, extraArgs);
-        //doTransition(lower, current, shortGapY, shortGapX, eP, sM5->TRANSITION_GAP_SHORT_SWITCH_TO_X, extraArgs);
-        doTransition(lower, current, match, longGapX, eP, sM5->TRANSITION_GAP_LONG_OPEN_X, extraArgs);
-        doTransition(lower, current, longGapX, longGapX, eP, sM5->TRANSITION_GAP_LONG_EXTEND_X, extraArgs);
-        //doTransition(lower, current, longGapY, longGapX, eP, sM5->TRANSITION_GAP_LONG_SWITCH_TO_X, extraArgs);
-    }
-    if (middle != NULL) {
-        double eP = emission_getMatchProb(sM5->EMISSION_MATCH_PROBS, cX, cY); //symbol_matchProb(cX, cY);
-        doTransition(middle, current, match, match, eP, sM5->TRANSITION_MATCH_CONTINUE, extraArgs);
-        doTransition(middle, current, shortGapX, match, eP, sM5->TRANSITION_MATCH_FROM_SHORT_GAP_X, extraArgs);
-        doTransition(middle, current, shortGapY, match, eP, sM5->TRANSITION_MATCH_FROM_SHORT_GAP_Y, extraArgs);
-        doTransition(middle, current, longGapX, match, eP, sM5->TRANSITION_MATCH_FROM_LONG_GAP_X, extraArgs);
-        doTransition(middle, current, longGapY, match, eP, sM5->TRANSITION_MATCH_FROM_LONG_GAP_Y, extraArgs);
-    }
-    if (upper != NULL) {
-        double eP = emission_getGapProb(sM5->EMISSION_GAP_Y_PROBS, cY);
-        doTransition(upper, current, match, shortGapY, eP, sM5->TRANSITION_GAP_SHORT_OPEN_Y, extraArgs);
-        doTransition(upper, current, shortGapY, shortGapY, eP, sM5->TRANSITION_GAP_SHORT_EXTEND_Y, extraArgs);
-        //doTransition(upper, current, shortGapX, shortGapY, eP, sM5->TRANSITION_GAP_SHORT_SWITCH_TO_Y, extraArgs);
-        doTransition(upper, current, match, longGapY, eP, sM5->TRANSITION_GAP_LONG_OPEN_Y, extraArgs);
-        doTransition(upper, current, longGapY, longGapY, eP, sM5->TRANSITION_GAP_LONG_EXTEND_Y, extraArgs);
-        //doTransition(upper, current, longGapX, longGapY, eP, sM5->TRANSITION_GAP_LONG_SWITCH_TO_Y, extraArgs);
+    STATE_MACHINE_EMISSIONS(sM5, cX, cY)
+    STATE_MACHINE_LOAD_CELLS(5)
+    STATE_MACHINE5_TRANSITIONS(sM5, currentValues, lowerValues, middleValues, upperValues,
+            eGapX, eMatch, eGapY, doTransition, extraArgs)
+    STATE_MACHINE_STORE_CELLS(5)
+}
+
+static void stateMachine5_cellCalculateForward(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle, DpValue *upper,
+        Symbol cX, Symbol cY, void *extraArgs) {
+    StateMachine5Transitions *t = &((StateMachine5 *) sM)->FUSED_TRANSITIONS[symbolPair_index(cX, cY)];
+    STATE_MACHINE_FUSED_EMISSIONS
+    STATE_MACHINE_LOAD_CELLS(5)
+    STATE_MACHINE5_TRANSITIONS(t, currentValues, lowerValues, middleValues, upperValues,
+            eGapX, eMatch, eGapY, doTransitionForward, NULL)
+    STATE_MACHINE_STORE_CELLS(5)
+}
+
+static void stateMachine5_cellCalculateBackward(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle, DpValue *upper,
+        Symbol cX, Symbol cY, void *extraArgs) {
+    StateMachine5Transitions *t = &((StateMachine5 *) sM)->FUSED_TRANSITIONS[symbolPair_index(cX, cY)];
+    STATE_MACHINE_FUSED_EMISSIONS
+    STATE_MACHINE_LOAD_CELLS(5)
+    STATE_MACHINE5_TRANSITIONS(t, currentValues, lowerValues, middleValues, upperValues,
+            eGapX, eMatch, eGapY, doTransitionBackward, NULL)
+    STATE_MACHINE_STORE_CELLS(5)
+}
+
+static void stateMachine5_cellCalculateViterbi(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle, DpValue *upper,
+        Symbol cX, Symbol cY, void *extraArgs) {
+    StateMachine5Transitions *t = &((StateMachine5 *) sM)->FUSED_TRANSITIONS[symbolPair_index(cX, cY)];
+    STATE_MACHINE_FUSED_EMISSIONS
+    STATE_MACHINE_LOAD_CELLS(5)
+    STATE_MACHINE5_TRANSITIONS(t, currentValues, lowerValues, middleValues, upperValues,
+            eGapX, eMatch, eGapY, doTransitionViterbi, extraArgs)
+    STATE_MACHINE_STORE_CELLS(5)
+}
+
+static void stateMachine5_cellCalculateUpdateExpectations(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle,
+        DpValue *upper, Symbol cX, Symbol cY, void *extraArgs) {
+    StateMachine5 *sM5 = (StateMachine5 *) sM;
+    ExpectationArgs args = expectationArgs_construct(extraArgs, cX, cY);
+    STATE_MACHINE_EMISSIONS(sM5, cX, cY)
+    STATE_MACHINE_LOAD_CELLS(5)
+    STATE_MACHINE5_TRANSITIONS(sM5, currentValues, lowerValues, middleValues, upperValues,
+            eGapX, eMatch, eGapY, doTransitionUpdateExpectations, &args)
+    STATE_MACHINE_STORE_CELLS(5)
+}
+
+static inline void stateMachine5_simdCellCalculate(StateMachine5SimdTransitions *sM5, SimdDouble *current, SimdDouble *lower,
+        SimdDouble *middle, SimdDouble *upper, SimdDouble eGapX, SimdDouble eMatch, SimdDouble eGapY,
+        void (*doTransition)(SimdDouble *, SimdDouble *, int64_t, int64_t, SimdDouble, SimdDouble, void *)) {
+    STATE_MACHINE5_TRANSITIONS(sM5, current, lower, middle, upper, eGapX, eMatch, eGapY, doTransition, NULL)
+}
+
+static void stateMachine5_diagonalCalculateForward(StateMachine *sM, DpCells current, DpCells lower, DpCells middle, DpCells upper,
+        const PackedSymbol *cX, const PackedSymbol *cY, int64_t cellNumber, void *extraArgs) {
+    StateMachine5 *sM5 = (StateMachine5 *) sM;
+    STATE_MACHINE_SIMD_FUSED_EMISSIONS
+    assert(cellNumber % SIMD_WIDTH == 0);
+    for (int64_t i = 0; i < cellNumber; i += SIMD_WIDTH) {
+        StateMachine5SimdTransitions t;
+        simd_loadTransitions(sM5->FUSED_TRANSITIONS, STATE_MACHINE5_TRANSITION_NUMBER, cX + i, cY + i, (SimdDouble *) &t);
+        SimdDouble c[5], l[5], m[5], u[5];
+        simd_loadCells(current, i, c, 5);
+        simd_loadCells(lower, i, l, 5);
+        simd_loadCells(middle, i, m, 5);
+        simd_loadCells(upper, i, u, 5);
+        stateMachine5_simdCellCalculate(&t, c, l, m, u, eGapX, eMatch, eGapY, simdTransitionForward);
+        simd_storeCells(current, i, c, 5);
+    }
+}
+
+static void stateMachine5_diagonalCalculateBackward(StateMachine *sM, DpCells current, DpCells lower, DpCells middle, DpCells upper,
+        const PackedSymbol *cX, const PackedSymbol *cY, int64_t cellNumber, void *extraArgs) {
+    /*
+     * The upper cell of cell i is the lower cell of cell i+1, so the lanes of a block overlap. To keep the order
+     * in which each cell is summed into the same as the cell by cell calculation (upper transitions from cell i-1
+     * before lower transitions from cell i) the upper transitions of a block are done and stored before the lower ones.
+     */
+    StateMachine5 *sM5 = (StateMachine5 *) sM;
+    STATE_MACHINE_SIMD_FUSED_EMISSIONS
+    assert(cellNumber % SIMD_WIDTH == 0);
+    for (int64_t i = 0; i < cellNumber; i += SIMD_WIDTH) {
+        StateMachine5SimdTransitions t;
+        simd_loadTransitions(sM5->FUSED_TRANSITIONS, STATE_MACHINE5_TRANSITION_NUMBER, cX + i, cY + i, (SimdDouble *) &t);
+        SimdDouble c[5], l[5], m[5], u[5];
+        simd_loadCells(current, i, c, 5);
+        simd_loadCells(upper, i, u, 5);
+        stateMachine5_simdCellCalculate(&t, c, NULL, NULL, u, eGapX, eMatch, eGapY, simdTransitionBackward);
+        simd_storeCells(upper, i, u, 5);
+        simd_loadCells(lower, i, l, 5);
+        simd_loadCells(middle, i, m, 5);
+        stateMachine5_simdCellCalculate(&t, c, l, m, NULL, eGapX, eMatch, eGapY, simdTransitionBackward);
+        simd_storeCells(lower, i, l, 5);
+        simd_storeCells(middle, i, m, 5);
+    }
+}
+
+static void stateMachine5_cellCalculateForwardScaled(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle,
+        DpValue *upper, Symbol cX, Symbol cY, void *extraArgs) {
+    StateMachine5Transitions *t = &((StateMachine5 *) sM)->probabilities->FUSED_TRANSITIONS[symbolPair_index(cX, cY)];
+    STATE_MACHINE_FUSED_EMISSION_SCALES(extraArgs)
+    STATE_MACHINE_LOAD_CELLS(5)
+    STATE_MACHINE5_TRANSITIONS(t, currentValues, lowerValues, middleValues, upperValues,
+            eGapX, eMatch, eGapY, doTransitionForwardScaled, NULL)
+    STATE_MACHINE_STORE_CELLS(5)
+}
+
+static void stateMachine5_cellCalculateBackwardScaled(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle,
+        DpValue *upper, Symbol cX, Symbol cY, void *extraArgs) {
+    StateMachine5Transitions *t = &((StateMachine5 *) sM)->probabilities->FUSED_TRANSITIONS[symbolPair_index(cX, cY)];
+    STATE_MACHINE_FUSED_EMISSION_SCALES(extraArgs)
+    STATE_MACHINE_LOAD_CELLS(5)
+    STATE_MACHINE5_TRANSITIONS(t, currentValues, lowerValues, middleValues, upperValues,
+            eGapX, eMatch, eGapY, doTransitionBackwardScaled, NULL)
+    STATE_MACHINE_STORE_CELLS(5)
+}
+
+static void stateMachine5_diagonalCalculateForwardScaled(StateMachine *sM, DpCells current, DpCells lower, DpCells middle,
+        DpCells upper, const PackedSymbol *cX, const PackedSymbol *cY, int64_t cellNumber, void *extraArgs) {
+    StateMachine5 *sM5 = ((StateMachine5 *) sM)->probabilities;
+    STATE_MACHINE_SIMD_FUSED_EMISSION_SCALES(extraArgs)
+    assert(cellNumber % SIMD_WIDTH == 0);
+    for (int64_t i = 0; i < cellNumber; i += SIMD_WIDTH) {
+        StateMachine5SimdTransitions t;
+        simd_loadTransitions(sM5->FUSED_TRANSITIONS, STATE_MACHINE5_TRANSITION_NUMBER, cX + i, cY + i, (SimdDouble *) &t);
+        SimdDouble c[5], l[5], m[5], u[5];
+        simd_loadCells(current, i, c, 5);
+        simd_loadCells(lower, i, l, 5);
+        simd_loadCells(middle, i, m, 5);
+        simd_loadCells(upper, i, u, 5);
+        stateMachine5_simdCellCalculate(&t, c, l, m, u, eGapX, eMatch, eGapY, simdTransitionForwardScaled);
+        simd_storeCells(current, i, c, 5);
     }
 }
 
+static void stateMachine5_diagonalCalculateBackwardScaled(StateMachine *sM, DpCells current, DpCells lower, DpCells middle,
+        DpCells upper, const PackedSymbol *cX, const PackedSymbol *cY, int64_t cellNumber, void *extraArgs) {
+    //Upper transitions before lower ones, see stateMachine5_diagonalCalculateBackward.
+    StateMachine5 *sM5 = ((StateMachine5 *) sM)->probabilities;
+    STATE_MACHINE_SIMD_FUSED_EMISSION_SCALES(extraArgs)
+    assert(cellNumber % SIMD_WIDTH == 0);
+    for (int64_t i = 0; i < cellNumber; i += SIMD_WIDTH) {
+        StateMachine5SimdTransitions t;
+        simd_loadTransitions(sM5->FUSED_TRANSITIONS, STATE_MACHINE5_TRANSITION_NUMBER, cX + i, cY + i, (SimdDouble *) &t);
+        SimdDouble c[5], l[5], m[5], u[5];
+        simd_loadCells(current, i, c, 5);
+        simd_loadCells(upper, i, u, 5);
+        stateMachine5_simdCellCalculate(&t, c, NULL, NULL, u, eGapX, eMatch, eGapY, simdTransitionBackwardScaled);
+        simd_storeCells(upper, i, u, 5);
+        simd_loadCells(lower, i, l, 5);
+        simd_loadCells(middle, i, m, 5);
+        stateMachine5_simdCellCalculate(&t, c, l, m, NULL, eGapX, eMatch, eGapY, simdTransitionBackwardScaled);
+        simd_storeCells(lower, i, l, 5);
+        simd_storeCells(middle, i, m, 5);
+    }
+}
+
+//Gets the emissions of a symbol pair, as probabilities or log probabilities, for building the fused transitions.
+#define STATE_MACHINE_PAIR_EMISSIONS(sMN, x, y, probabilities) \
+    double eGapX = probabilities ? emission_getGapProbability(sMN->EMISSION_GAP_X_PROBS, x) : \
+            emission_getGapProb(sMN->EMISSION_GAP_X_PROBS, x); \
+    double eMatch = probabilities ? emission_getMatchProbability(sMN->EMISSION_MATCH_PROBS, x, y) : \
+            emission_getMatchProb(sMN->EMISSION_MATCH_PROBS, x, y); \
+    double eGapY = probabilities ? emission_getGapProbability(sMN->EMISSION_GAP_Y_PROBS, y) : \
+            emission_getGapProb(sMN->EMISSION_GAP_Y_PROBS, y);
+
+#define fuseTransitionField(sMN, t, field, eP, probabilities) \
+    t->field = fuseTransition(eP, sMN->field, probabilities)
+
+static void stateMachine5_setFusedTransitions(StateMachine5 *sM5, bool probabilities) {
+    for (Symbol x = 0; x < SYMBOL_NUMBER; x++) {
+        for (Symbol y = 0; y < SYMBOL_NUMBER; y++) {
+            STATE_MACHINE_PAIR_EMISSIONS(sM5, x, y, probabilities)
+            StateMachine5Transitions *t = &sM5->FUSED_TRANSITIONS[symbolPair_index(x, y)];
+            fuseTransitionField(sM5, t, TRANSITION_MATCH_CONTINUE, eMatch, probabilities);
+            fuseTransitionField(sM5, t, TRANSITION_MATCH_FROM_SHORT_GAP_X, eMatch, probabilities);
+            fuseTransitionField(sM5, t, TRANSITION_MATCH_FROM_LONG_GAP_X, eMatch, probabilities);
+            fuseTransitionField(sM5, t, TRANSITION_GAP_SHORT_OPEN_X, eGapX, probabilities);
+            fuseTransitionField(sM5, t, TRANSITION_GAP_SHORT_EXTEND_X, eGapX, probabilities);
+            fuseTransitionField(sM5, t, TRANSITION_GAP_LONG_OPEN_X, eGapX, probabilities);
+            fuseTransitionField(sM5, t, TRANSITION_GAP_LONG_EXTEND_X, eGapX, probabilities);
+            fuseTransitionField(sM5, t, TRANSITION_MATCH_FROM_SHORT_GAP_Y, eMatch, probabilities);
+            fuseTransitionField(sM5, t, TRANSITION_MATCH_FROM_LONG_GAP_Y, eMatch, probabilities);
+            fuseTransitionField(sM5, t, TRANSITION_GAP_SHORT_OPEN_Y, eGapY, probabilities);
+            fuseTransitionField(sM5, t, TRANSITION_GAP_SHORT_EXTEND_Y, eGapY, probabilities);
+            fuseTransitionField(sM5, t, TRANSITION_GAP_LONG_OPEN_Y, eGapY, probabilities);
+            fuseTransitionField(sM5, t, TRANSITION_GAP_LONG_EXTEND_Y, eGapY, probabilities);
+        }
+    }
+}
+
+static void stateMachine5_setProbabilities(StateMachine5 *sM5) {
+    /*
+     * Sets the probabilities copy of the parameters and the fused transitions of both, which must be redone whenever
+     * the parameters change.
+     */
+    StateMachine5 *p = sM5->probabilities;
+    p->TRANSITION_MATCH_CONTINUE = exp(sM5->TRANSITION_MATCH_CONTINUE);
+    p->TRANSITION_MATCH_FROM_SHORT_GAP_X = exp(sM5->TRANSITION_MATCH_FROM_SHORT_GAP_X);
+    p->TRANSITION_MATCH_FROM_LONG_GAP_X = exp(sM5->TRANSITION_MATCH_FROM_LONG_GAP_X);
+    p->TRANSITION_GAP_SHORT_OPEN_X = exp(sM5->TRANSITION_GAP_SHORT_OPEN_X);
+    p->TRANSITION_GAP_SHORT_EXTEND_X = exp(sM5->TRANSITION_GAP_SHORT_EXTEND_X);
+    p->TRANSITION_GAP_SHORT_SWITCH_TO_X = exp(sM5->TRANSITION_GAP_SHORT_SWITCH_TO_X);
+    p->TRANSITION_GAP_LONG_OPEN_X = exp(sM5->TRANSITION_GAP_LONG_OPEN_X);
+    p->TRANSITION_GAP_LONG_EXTEND_X = exp(sM5->TRANSITION_GAP_LONG_EXTEND_X);
+    p->TRANSITION_GAP_LONG_SWITCH_TO_X = exp(sM5->TRANSITION_GAP_LONG_SWITCH_TO_X);
+    p->TRANSITION_MATCH_FROM_SHORT_GAP_Y = exp(sM5->TRANSITION_MATCH_FROM_SHORT_GAP_Y);
+    p->TRANSITION_MATCH_FROM_LONG_GAP_Y = exp(sM5->TRANSITION_MATCH_FROM_LONG_GAP_Y);
+    p->TRANSITION_GAP_SHORT_OPEN_Y = exp(sM5->TRANSITION_GAP_SHORT_OPEN_Y);
+    p->TRANSITION_GAP_SHORT_EXTEND_Y = exp(sM5->TRANSITION_GAP_SHORT_EXTEND_Y);
+    p->TRANSITION_GAP_SHORT_SWITCH_TO_Y = exp(sM5->TRANSITION_GAP_SHORT_SWITCH_TO_Y);
+    p->TRANSITION_GAP_LONG_OPEN_Y = exp(sM5->TRANSITION_GAP_LONG_OPEN_Y);
+    p->TRANSITION_GAP_LONG_EXTEND_Y = exp(sM5->TRANSITION_GAP_LONG_EXTEND_Y);
+    p->TRANSITION_GAP_LONG_SWITCH_TO_Y = exp(sM5->TRANSITION_GAP_LONG_SWITCH_TO_Y);
+    emissions_setProbabilities(p->EMISSION_MATCH_PROBS, sM5->EMISSION_MATCH_PROBS, SYMBOL_NUMBER_NO_N * SYMBOL_NUMBER_NO_N);
+    emissions_setProbabilities(p->EMISSION_GAP_X_PROBS, sM5->EMISSION_GAP_X_PROBS, SYMBOL_NUMBER_NO_N);
+    emissions_setProbabilities(p->EMISSION_GAP_Y_PROBS, sM5->EMISSION_GAP_Y_PROBS, SYMBOL_NUMBER_NO_N);
+    stateMachine5_setFusedTransitions(sM5, 0);
+    stateMachine5_setFusedTransitions(p, 1);
+}
+
 StateMachine *stateMachine5_construct(StateMachineType type) {
-    StateMachine5 *sM5 = st_malloc(sizeof(StateMachine5));
+    StateMachine5 *sM5 = st_malloc(2 * sizeof(StateMachine5)); //The second is the probabilities copy, freed with the first
+    sM5->probabilities = sM5 + 1;
     sM5->TRANSITION_MATCH_CONTINUE = -0.030064059121770816; //0.9703833696510062f
     sM5->TRANSITION_MATCH_FROM_SHORT_GAP_X = -1.272871422049609; //1.0 - gapExtend - gapSwitch = 0.280026392297485
     sM5->TRANSITION_MATCH_FROM_LONG_GAP_X = -5.673280173170473; //1.0 - gapExtend = 0.00343657420938
@@ -463,6 +971,17 @@ StateMachine *stateMachine5_construct(StateMachineType type) {
     sM5->model.raggedStartStateProb = stateMachine5_raggedStartStateProb;
     sM5->model.raggedEndStateProb = stateMachine5_raggedEndStateProb;
     sM5->model.cellCalculate = stateMachine5_cellCalculate;
+    sM5->model.cellCalculateForward = stateMachine5_cellCalculateForward;
+    sM5->model.cellCalculateBackward = stateMachine5_cellCalculateBackward;
+    sM5->model.cellCalculateUpdateExpectations = stateMachine5_cellCalculateUpdateExpectations;
+    sM5->model.cellCalculateViterbi = stateMachine5_cellCalculateViterbi;
+    sM5->model.diagonalCalculateForward = stateMachine5_diagonalCalculateForward;
+    sM5->model.diagonalCalculateBackward = stateMachine5_diagonalCalculateBackward;
+    sM5->model.cellCalculateForwardScaled = stateMachine5_cellCalculateForwardScaled;
+    sM5->model.cellCalculateBackwardScaled = stateMachine5_cellCalculateBackwardScaled;
+    sM5->model.diagonalCalculateForwardScaled = stateMachine5_diagonalCalculateForwardScaled;
+    sM5->model.diagonalCalculateBackwardScaled = stateMachine5_diagonalCalculateBackwardScaled;
+    stateMachine5_setProbabilities(sM5);
 
     return (StateMachine *) sM5;
 }
@@ -575,6 +1094,28 @@ static void stateMachine5_loadSymmetric(StateMachine5 *sM5, Hmm *hmm) {
 //Transitions
 typedef struct _StateMachine3 StateMachine3;
 
+//The transitions used by STATE_MACHINE3_TRANSITIONS, with their emissions included, see "Fused transitions" above.
+#define STATE_MACHINE3_TRANSITION_FIELDS(type) \
+    type TRANSITION_MATCH_CONTINUE; \
+    type TRANSITION_MATCH_FROM_GAP_X; \
+    type TRANSITION_MATCH_FROM_GAP_Y; \
+    type TRANSITION_GAP_OPEN_X; \
+    type TRANSITION_GAP_OPEN_Y; \
+    type TRANSITION_GAP_EXTEND_X; \
+    type TRANSITION_GAP_EXTEND_Y; \
+    type TRANSITION_GAP_SWITCH_TO_X; \
+    type TRANSITION_GAP_SWITCH_TO_Y;
+
+#define STATE_MACHINE3_TRANSITION_NUMBER 9
+
+typedef struct _stateMachine3Transitions {
+    STATE_MACHINE3_TRANSITION_FIELDS(double)
+} StateMachine3Transitions;
+
+typedef struct _stateMachine3SimdTransitions {
+    STATE_MACHINE3_TRANSITION_FIELDS(SimdDouble)
+} StateMachine3SimdTransitions;
+
 struct _StateMachine3 {
     //3 state state machine, allowing for symmetry in x and y.
     StateMachine model;
@@ -590,6 +1131,8 @@ struct _StateMachine3 {
     double EMISSION_MATCH_PROBS[SYMBOL_NUMBER_NO_N*SYMBOL_NUMBER_NO_N]; //Match emission probs
     double EMISSION_GAP_X_PROBS[SYMBOL_NUMBER_NO_N]; //Gap X emission probs
     double EMISSION_GAP_Y_PROBS[SYMBOL_NUMBER_NO_N]; //Gap Y emission probs
+    StateMachine3Transitions FUSED_TRANSITIONS[SYMBOL_NUMBER * SYMBOL_NUMBER]; //The transitions by symbol pair, with emissions
+    StateMachine3 *probabilities; //The above as probabilities rather than log probabilities, for the scaled dp
 };
 
 static double stateMachine3_startStateProb(StateMachine *sM, int64_t state) {
@@ -633,35 +1176,222 @@ static double stateMachine3_raggedEndStateProb(StateMachine *sM, int64_t state)
     return 0.0;
 }
 
-static void stateMachine3_cellCalculate(StateMachine *sM, double *current, double *lower, double *middle, double *upper,
+//The transitions of the three state machine, see STATE_MACHINE5_TRANSITIONS.
+#define STATE_MACHINE3_TRANSITIONS(sM3, current, lower, middle, upper, eGapX, eMatch, eGapY, doTransition, extraArgs) \
+    if (lower != NULL) { \
+        doTransition(lower, current, match, shortGapX, eGapX, sM3->TRANSITION_GAP_OPEN_X, extraArgs); \
+        doTransition(lower, current, shortGapX, shortGapX, eGapX, sM3->TRANSITION_GAP_EXTEND_X, extraArgs); \
+        doTransition(lower, current, shortGapY, shortGapX, eGapX, sM3->TRANSITION_GAP_SWITCH_TO_X, extraArgs); \
+    } \
+    if (middle != NULL) { \
+        doTransition(middle, current, match, match, eMatch, sM3->TRANSITION_MATCH_CONTINUE, extraArgs); \
+        doTransition(middle, current, shortGapX, match, eMatch, sM3->TRANSITION_MATCH_FROM_GAP_X, extraArgs); \
+        doTransition(middle, current, shortGapY, match, eMatch, sM3->TRANSITION_MATCH_FROM_GAP_Y, extraArgs); \
+    } \
+    if (upper != NULL) { \
+        doTransition(upper, current, match, shortGapY, eGapY, sM3->TRANSITION_GAP_OPEN_Y, extraArgs); \
+        doTransition(upper, current, shortGapY, shortGapY, eGapY, sM3->TRANSITION_GAP_EXTEND_Y, extraArgs); \
+        doTransition(upper, current, shortGapX, shortGapY, eGapY, sM3->TRANSITION_GAP_SWITCH_TO_Y, extraArgs); \
+    }
+
+static void stateMachine3_cellCalculate(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle, DpValue *upper,
         Symbol cX, Symbol cY, void (*doTransition)(double *, double *, int64_t, int64_t, double, double, void *),
         void *extraArgs) {
-    symbol_check(cX);
-    symbol_check(cY);
     StateMachine3 *sM3 = (StateMachine3 *) sM;
-    if (lower != NULL) {
-        double eP = emission_getGapProb(sM3->EMISSION_GAP_X_PROBS, cX);
-        doTransition(lower, current, match, shortGapX, eP, sM3->TRANSITION_GAP_OPEN_X, extraArgs);
-        doTransition(lower, current, shortGapX, shortGapX, eP, sM3->TRANSITION_GAP_EXTEND_X, extraArgs);
-        doTransition(lower, current, shortGapY, shortGapX, eP, sM3->TRANSITION_GAP_SWITCH_TO_X, extraArgs);
+    STATE_MACHINE_EMISSIONS(sM3, cX, cY)
+    STATE_MACHINE_LOAD_CELLS(3)
+    STATE_MACHINE3_TRANSITIONS(sM3, currentValues, lowerValues, middleValues, upperValues,
+            eGapX, eMatch, eGapY, doTransition, extraArgs)
+    STATE_MACHINE_STORE_CELLS(3)
+}
+
+static void stateMachine3_cellCalculateForward(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle, DpValue *upper,
+        Symbol cX, Symbol cY, void *extraArgs) {
+    StateMachine3Transitions *t = &((StateMachine3 *) sM)->FUSED_TRANSITIONS[symbolPair_index(cX, cY)];
+    STATE_MACHINE_FUSED_EMISSIONS
+    STATE_MACHINE_LOAD_CELLS(3)
+    STATE_MACHINE3_TRANSITIONS(t, currentValues, lowerValues, middleValues, upperValues,
+            eGapX, eMatch, eGapY, doTransitionForward, NULL)
+    STATE_MACHINE_STORE_CELLS(3)
+}
+
+static void stateMachine3_cellCalculateBackward(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle, DpValue *upper,
+        Symbol cX, Symbol cY, void *extraArgs) {
+    StateMachine3Transitions *t = &((StateMachine3 *) sM)->FUSED_TRANSITIONS[symbolPair_index(cX, cY)];
+    STATE_MACHINE_FUSED_EMISSIONS
+    STATE_MACHINE_LOAD_CELLS(3)
+    STATE_MACHINE3_TRANSITIONS(t, currentValues, lowerValues, middleValues, upperValues,
+            eGapX, eMatch, eGapY, doTransitionBackward, NULL)
+    STATE_MACHINE_STORE_CELLS(3)
+}
+
+static void stateMachine3_cellCalculateViterbi(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle, DpValue *upper,
+        Symbol cX, Symbol cY, void *extraArgs) {
+    StateMachine3Transitions *t = &((StateMachine3 *) sM)->FUSED_TRANSITIONS[symbolPair_index(cX, cY)];
+    STATE_MACHINE_FUSED_EMISSIONS
+    STATE_MACHINE_LOAD_CELLS(3)
+    STATE_MACHINE3_TRANSITIONS(t, currentValues, lowerValues, middleValues, upperValues,
+            eGapX, eMatch, eGapY, doTransitionViterbi, extraArgs)
+    STATE_MACHINE_STORE_CELLS(3)
+}
+
+static void stateMachine3_cellCalculateUpdateExpectations(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle,
+        DpValue *upper, Symbol cX, Symbol cY, void *extraArgs) {
+    StateMachine3 *sM3 = (StateMachine3 *) sM;
+    ExpectationArgs args = expectationArgs_construct(extraArgs, cX, cY);
+    STATE_MACHINE_EMISSIONS(sM3, cX, cY)
+    STATE_MACHINE_LOAD_CELLS(3)
+    STATE_MACHINE3_TRANSITIONS(sM3, currentValues, lowerValues, middleValues, upperValues,
+            eGapX, eMatch, eGapY, doTransitionUpdateExpectations, &args)
+    STATE_MACHINE_STORE_CELLS(3)
+}
+
+static inline void stateMachine3_simdCellCalculate(StateMachine3SimdTransitions *sM3, SimdDouble *current, SimdDouble *lower,
+        SimdDouble *middle, SimdDouble *upper, SimdDouble eGapX, SimdDouble eMatch, SimdDouble eGapY,
+        void (*doTransition)(SimdDouble *, SimdDouble *, int64_t, int64_t, SimdDouble, SimdDouble, void *)) {
+    STATE_MACHINE3_TRANSITIONS(sM3, current, lower, middle, upper, eGapX, eMatch, eGapY, doTransition, NULL)
+}
+
+static void stateMachine3_diagonalCalculateForward(StateMachine *sM, DpCells current, DpCells lower, DpCells middle, DpCells upper,
+        const PackedSymbol *cX, const PackedSymbol *cY, int64_t cellNumber, void *extraArgs) {
+    StateMachine3 *sM3 = (StateMachine3 *) sM;
+    STATE_MACHINE_SIMD_FUSED_EMISSIONS
+    assert(cellNumber % SIMD_WIDTH == 0);
+    for (int64_t i = 0; i < cellNumber; i += SIMD_WIDTH) {
+        StateMachine3SimdTransitions t;
+        simd_loadTransitions(sM3->FUSED_TRANSITIONS, STATE_MACHINE3_TRANSITION_NUMBER, cX + i, cY + i, (SimdDouble *) &t);
+        SimdDouble c[3], l[3], m[3], u[3];
+        simd_loadCells(current, i, c, 3);
+        simd_loadCells(lower, i, l, 3);
+        simd_loadCells(middle, i, m, 3);
+        simd_loadCells(upper, i, u, 3);
+        stateMachine3_simdCellCalculate(&t, c, l, m, u, eGapX, eMatch, eGapY, simdTransitionForward);
+        simd_storeCells(current, i, c, 3);
     }
-    if (middle != NULL) {
-        double eP = emission_getMatchProb(sM3->EMISSION_MATCH_PROBS, cX, cY);  //symbol_matchProb(cX, cY);
-        doTransition(middle, current, match, match, eP, sM3->TRANSITION_MATCH_CONTINUE, extraArgs);
-        doTransition(middle, current, shortGapX, match, eP, sM3->TRANSITION_MATCH_FROM_GAP_X, extraArgs);
-        doTransition(middle, current, shortGapY, match, eP, sM3->TRANSITION_MATCH_FROM_GAP_Y, extraArgs);
+}
 
+static void stateMachine3_diagonalCalculateBackward(StateMachine *sM, DpCells current, DpCells lower, DpCells middle, DpCells upper,
+        const PackedSymbol *cX, const PackedSymbol *cY, int64_t cellNumber, void *extraArgs) {
+    //Upper transitions before lower ones, see stateMachine5_diagonalCalculateBackward.
+    StateMachine3 *sM3 = (StateMachine3 *) sM;
+    STATE_MACHINE_SIMD_FUSED_EMISSIONS
+    assert(cellNumber % SIMD_WIDTH == 0);
+    for (int64_t i = 0; i < cellNumber; i += SIMD_WIDTH) {
+        StateMachine3SimdTransitions t;
+        simd_loadTransitions(sM3->FUSED_TRANSITIONS, STATE_MACHINE3_TRANSITION_NUMBER, cX + i, cY + i, (SimdDouble *) &t);
+        SimdDouble c[3], l[3], m[3], u[3];
+        simd_loadCells(current, i, c, 3);
+        simd_loadCells(upper, i, u, 3);
+        stateMachine3_simdCellCalculate(&t, c, NULL, NULL, u, eGapX, eMatch, eGapY, simdTransitionBackward);
+        simd_storeCells(upper, i, u, 3);
+        simd_loadCells(lower, i, l, 3);
+        simd_loadCells(middle, i, m, 3);
+        stateMachine3_simdCellCalculate(&t, c, l, m, NULL, eGapX, eMatch, eGapY, simdTransitionBackward);
+        simd_storeCells(lower, i, l, 3);
+        simd_storeCells(middle, i, m, 3);
     }
-    if (upper != NULL) {
-        double eP = emission_getGapProb(sM3->EMISSION_GAP_Y_PROBS, cY);
-        doTransition(upper, current, match, shortGapY, eP, sM3->TRANSITION_GAP_OPEN_Y, extraArgs);
-        doTransition(upper, current, shortGapY, shortGapY, eP, sM3->TRANSITION_GAP_EXTEND_Y, extraArgs);
-        doTransition(upper, current, shortGapX, shortGapY, eP, sM3->TRANSITION_GAP_SWITCH_TO_Y, extraArgs);
+}
+
+static void stateMachine3_cellCalculateForwardScaled(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle,
+        DpValue *upper, Symbol cX, Symbol cY, void *extraArgs) {
+    StateMachine3Transitions *t = &((StateMachine3 *) sM)->probabilities->FUSED_TRANSITIONS[symbolPair_index(cX, cY)];
+    STATE_MACHINE_FUSED_EMISSION_SCALES(extraArgs)
+    STATE_MACHINE_LOAD_CELLS(3)
+    STATE_MACHINE3_TRANSITIONS(t, currentValues, lowerValues, middleValues, upperValues,
+            eGapX, eMatch, eGapY, doTransitionForwardScaled, NULL)
+    STATE_MACHINE_STORE_CELLS(3)
+}
+
+static void stateMachine3_cellCalculateBackwardScaled(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle,
+        DpValue *upper, Symbol cX, Symbol cY, void *extraArgs) {
+    StateMachine3Transitions *t = &((StateMachine3 *) sM)->probabilities->FUSED_TRANSITIONS[symbolPair_index(cX, cY)];
+    STATE_MACHINE_FUSED_EMISSION_SCALES(extraArgs)
+    STATE_MACHINE_LOAD_CELLS(3)
+    STATE_MACHINE3_TRANSITIONS(t, currentValues, lowerValues, middleValues, upperValues,
+            eGapX, eMatch, eGapY, doTransitionBackwardScaled, NULL)
+    STATE_MACHINE_STORE_CELLS(3)
+}
+
+static void stateMachine3_diagonalCalculateForwardScaled(StateMachine *sM, DpCells current, DpCells lower, DpCells middle,
+        DpCells upper, const PackedSymbol *cX, const PackedSymbol *cY, int64_t cellNumber, void *extraArgs) {
+    StateMachine3 *sM3 = ((StateMachine3 *) sM)->probabilities;
+    STATE_MACHINE_SIMD_FUSED_EMISSION_SCALES(extraArgs)
+    assert(cellNumber % SIMD_WIDTH == 0);
+    for (int64_t i = 0; i < cellNumber; i += SIMD_WIDTH) {
+        StateMachine3SimdTransitions t;
+        simd_loadTransitions(sM3->FUSED_TRANSITIONS, STATE_MACHINE3_TRANSITION_NUMBER, cX + i, cY + i, (SimdDouble *) &t);
+        SimdDouble c[3], l[3], m[3], u[3];
+        simd_loadCells(current, i, c, 3);
+        simd_loadCells(lower, i, l, 3);
+        simd_loadCells(middle, i, m, 3);
+        simd_loadCells(upper, i, u, 3);
+        stateMachine3_simdCellCalculate(&t, c, l, m, u, eGapX, eMatch, eGapY, simdTransitionForwardScaled);
+        simd_storeCells(current, i, c, 3);
+    }
+}
+
+static void stateMachine3_diagonalCalculateBackwardScaled(StateMachine *sM, DpCells current, DpCells lower, DpCells middle,
+        DpCells upper, const PackedSymbol *cX, const PackedSymbol *cY, int64_t cellNumber, void *extraArgs) {
+    //Upper transitions before lower ones, see stateMachine5_diagonalCalculateBackward.
+    StateMachine3 *sM3 = ((StateMachine3 *) sM)->probabilities;
+    STATE_MACHINE_SIMD_FUSED_EMISSION_SCALES(extraArgs)
+    assert(cellNumber % SIMD_WIDTH == 0);
+    for (int64_t i = 0; i < cellNumber; i += SIMD_WIDTH) {
+        StateMachine3SimdTransitions t;
+        simd_loadTransitions(sM3->FUSED_TRANSITIONS, STATE_MACHINE3_TRANSITION_NUMBER, cX + i, cY + i, (SimdDouble *) &t);
+        SimdDouble c[3], l[3], m[3], u[3];
+        simd_loadCells(current, i, c, 3);
+        simd_loadCells(upper, i, u, 3);
+        stateMachine3_simdCellCalculate(&t, c, NULL, NULL, u, eGapX, eMatch, eGapY, simdTransitionBackwardScaled);
+        simd_storeCells(upper, i, u, 3);
+        simd_loadCells(lower, i, l, 3);
+        simd_loadCells(middle, i, m, 3);
+        stateMachine3_simdCellCalculate(&t, c, l, m, NULL, eGapX, eMatch, eGapY, simdTransitionBackwardScaled);
+        simd_storeCells(lower, i, l, 3);
+        simd_storeCells(middle, i, m, 3);
+    }
+}
+
+static void stateMachine3_setFusedTransitions(StateMachine3 *sM3, bool probabilities) {
+    for (Symbol x = 0; x < SYMBOL_NUMBER; x++) {
+        for (Symbol y = 0; y < SYMBOL_NUMBER; y++) {
+            STATE_MACHINE_PAIR_EMISSIONS(sM3, x, y, probabilities)
+            StateMachine3Transitions *t = &sM3->FUSED_TRANSITIONS[symbolPair_index(x, y)];
+            fuseTransitionField(sM3, t, TRANSITION_MATCH_CONTINUE, eMatch, probabilities);
+            fuseTransitionField(sM3, t, TRANSITION_MATCH_FROM_GAP_X, eMatch, probabilities);
+            fuseTransitionField(sM3, t, TRANSITION_MATCH_FROM_GAP_Y, eMatch, probabilities);
+            fuseTransitionField(sM3, t, TRANSITION_GAP_OPEN_X, eGapX, probabilities);
+            fuseTransitionField(sM3, t, TRANSITION_GAP_OPEN_Y, eGapY, probabilities);
+            fuseTransitionField(sM3, t, TRANSITION_GAP_EXTEND_X, eGapX, probabilities);
+            fuseTransitionField(sM3, t, TRANSITION_GAP_EXTEND_Y, eGapY, probabilities);
+            fuseTransitionField(sM3, t, TRANSITION_GAP_SWITCH_TO_X, eGapX, probabilities);
+            fuseTransitionField(sM3, t, TRANSITION_GAP_SWITCH_TO_Y, eGapY, probabilities);
+        }
     }
 }
 
+static void stateMachine3_setProbabilities(StateMachine3 *sM3) {
+    //See stateMachine5_setProbabilities.
+    StateMachine3 *p = sM3->probabilities;
+    p->TRANSITION_MATCH_CONTINUE = exp(sM3->TRANSITION_MATCH_CONTINUE);
+    p->TRANSITION_MATCH_FROM_GAP_X = exp(sM3->TRANSITION_MATCH_FROM_GAP_X);
+    p->TRANSITION_MATCH_FROM_GAP_Y = exp(sM3->TRANSITION_MATCH_FROM_GAP_Y);
+    p->TRANSITION_GAP_OPEN_X = exp(sM3->TRANSITION_GAP_OPEN_X);
+    p->TRANSITION_GAP_OPEN_Y = exp(sM3->TRANSITION_GAP_OPEN_Y);
+    p->TRANSITION_GAP_EXTEND_X = exp(sM3->TRANSITION_GAP_EXTEND_X);
+    p->TRANSITION_GAP_EXTEND_Y = exp(sM3->TRANSITION_GAP_EXTEND_Y);
+    p->TRANSITION_GAP_SWITCH_TO_X = exp(sM3->TRANSITION_GAP_SWITCH_TO_X);
+    p->TRANSITION_GAP_SWITCH_TO_Y = exp(sM3->TRANSITION_GAP_SWITCH_TO_Y);
+    emissions_setProbabilities(p->EMISSION_MATCH_PROBS, sM3->EMISSION_MATCH_PROBS, SYMBOL_NUMBER_NO_N * SYMBOL_NUMBER_NO_N);
+    emissions_setProbabilities(p->EMISSION_GAP_X_PROBS, sM3->EMISSION_GAP_X_PROBS, SYMBOL_NUMBER_NO_N);
+    emissions_setProbabilities(p->EMISSION_GAP_Y_PROBS, sM3->EMISSION_GAP_Y_PROBS, SYMBOL_NUMBER_NO_N);
+    stateMachine3_setFusedTransitions(sM3, 0);
+    stateMachine3_setFusedTransitions(p, 1);
+}
+
 StateMachine *stateMachine3_construct(StateMachineType type) {
-    StateMachine3 *sM3 = st_malloc(sizeof(StateMachine3));
+    StateMachine3 *sM3 = st_malloc(2 * sizeof(StateMachine3)); //The second is the probabilities copy, freed with the first
+    sM3->probabilities = sM3 + 1;
     sM3->TRANSITION_MATCH_CONTINUE = -0.030064059121770816; //0.9703833696510062f
     sM3->TRANSITION_MATCH_FROM_GAP_X = -1.272871422049609; //1.0 - gapExtend - gapSwitch = 0.280026392297485
     sM3->TRANSITION_MATCH_FROM_GAP_Y = -1.272871422049609; //1.0 - gapExtend - gapSwitch = 0.280026392297485
@@ -685,6 +1415,17 @@ StateMachine *stateMachine3_construct(StateMachineType type) {
     sM3->model.raggedStartStateProb = stateMachine3_raggedStartStateProb;
     sM3->model.raggedEndStateProb = stateMachine3_raggedEndStateProb;
     sM3->model.cellCalculate = stateMachine3_cellCalculate;
+    sM3->model.cellCalculateForward = stateMachine3_cellCalculateForward;
+    sM3->model.cellCalculateBackward = stateMachine3_cellCalculateBackward;
+    sM3->model.cellCalculateUpdateExpectations = stateMachine3_cellCalculateUpdateExpectations;
+    sM3->model.cellCalculateViterbi = stateMachine3_cellCalculateViterbi;
+    sM3->model.diagonalCalculateForward = stateMachine3_diagonalCalculateForward;
+    sM3->model.diagonalCalculateBackward = stateMachine3_diagonalCalculateBackward;
+    sM3->model.cellCalculateForwardScaled = stateMachine3_cellCalculateForwardScaled;
+    sM3->model.cellCalculateBackwardScaled = stateMachine3_cellCalculateBackwardScaled;
+    sM3->model.diagonalCalculateForwardScaled = stateMachine3_diagonalCalculateForwardScaled;
+    sM3->model.diagonalCalculateBackwardScaled = stateMachine3_diagonalCalculateBackwardScaled;
+    stateMachine3_setProbabilities(sM3);
 
     return (StateMachine *) sM3;
 }
@@ -743,21 +1484,25 @@ StateMachine *hmm_getStateMachine(Hmm *hmm) {
     if (hmm->type == fiveState) {
         StateMachine5 *sM5 = (StateMachine5 *) stateMachine5_construct(fiveState);
         stateMachine5_loadSymmetric(sM5, hmm);
+        stateMachine5_setProbabilities(sM5);
         return (StateMachine *) sM5;
     }
     if (hmm->type == fiveStateAsymmetric) {
         StateMachine5 *sM5 = (StateMachine5 *) stateMachine5_construct(fiveStateAsymmetric);
         stateMachine5_loadAsymmetric(sM5, hmm);
+        stateMachine5_setProbabilities(sM5);
         return (StateMachine *) sM5;
     }
     if (hmm->type == threeStateAsymmetric) {
         StateMachine3 *sM3 = (StateMachine3 *) stateMachine3_construct(hmm->type);
         stateMachine3_loadAsymmetric(sM3, hmm);
+        stateMachine3_setProbabilities(sM3);
         return (StateMachine *) sM3;
     }
     if (hmm->type == threeState) {
         StateMachine3 *sM3 = (StateMachine3 *) stateMachine3_construct(hmm->type);
         stateMachine3_loadSymmetric(sM3, hmm);
+        stateMachine3_setProbabilities(sM3);
         return (StateMachine *) sM3;
     }
     return NULL;
@@ -0,0 +1,152 @@
+/*
+ * threadPool.c
+ *
+ *  The workers wait on a condition variable for the run count to change,
+ *  rather than spinning, so an idle pool takes no cpu.
+ */
+
+#include <pthread.h>
+#include "sonLib.h"
+#include "threadPool.h"
+
+struct _threadPool {
+    int64_t threadNumber;
+    pthread_t *threads; //The threadNumber - 1 workers
+    pthread_mutex_t mutex;
+    pthread_cond_t runStarted;
+    pthread_cond_t runFinished;
+    int64_t runs; //Incremented to start each run
+    int64_t runningWorkers;
+    bool finished; //Set to stop the workers
+    void (*fn)(void *, int64_t, int64_t);
+    void *args;
+};
+
+typedef struct _worker {
+    ThreadPool *threadPool;
+    int64_t thread;
+} Worker;
+
+static void *threadPool_worker(void *arg) {
+    Worker *worker = arg;
+    ThreadPool *threadPool = worker->threadPool;
+    int64_t runs = 0;
+    pthread_mutex_lock(&threadPool->mutex);
+    while (1) {
+        while (threadPool->runs == runs && !threadPool->finished) {
+            pthread_cond_wait(&threadPool->runStarted, &threadPool->mutex);
+        }
+        if (threadPool->finished) {
+            break;
+        }
+        runs = threadPool->runs;
+        void (*fn)(void *, int64_t, int64_t) = threadPool->fn;
+        void *args = threadPool->args;
+        pthread_mutex_unlock(&threadPool->mutex);
+        fn(args, worker->thread, threadPool->threadNumber);
+        pthread_mutex_lock(&threadPool->mutex);
+        if (--threadPool->runningWorkers == 0) {
+            pthread_cond_signal(&threadPool->runFinished);
+        }
+    }
+    pthread_mutex_unlock(&threadPool->mutex);
+    free(worker);
+    return NULL;
+}
+
+ThreadPool *threadPool_construct(int64_t threadNumber) {
+    if (threadNumber < 1) {
+        st_errAbort("A thread pool needs at least one thread, not %" PRIi64, threadNumber);
+    }
+    ThreadPool *threadPool = st_calloc(1, sizeof(ThreadPool));
+    threadPool->threadNumber = threadNumber;
+    threadPool->threads = st_malloc((threadNumber - 1) * sizeof(pthread_t));
+    pthread_mutex_init(&threadPool->mutex, NULL);
+    pthread_cond_init(&threadPool->runStarted, NULL);
+    pthread_cond_init(&threadPool->runFinished, NULL);
+    for (int64_t i = 1; i < threadNumber; i++) {
+        Worker *worker = st_malloc(sizeof(Worker));
+        worker->threadPool = threadPool;
+        worker->thread = i;
+        if (pthread_create(&threadPool->threads[i - 1], NULL, threadPool_worker, worker) != 0) {
+            st_errAbort("Could not create thread %" PRIi64 " of a thread pool", i);
+        }
+    }
+    return threadPool;
+}
+
+void threadPool_destruct(ThreadPool *threadPool) {
+    pthread_mutex_lock(&threadPool->mutex);
+    threadPool->finished = 1;
+    pthread_cond_broadcast(&threadPool->runStarted);
+    pthread_mutex_unlock(&threadPool->mutex);
+    for (int64_t i = 1; i < threadPool->threadNumber; i++) {
+        pthread_join(threadPool->threads[i - 1], NULL);
+    }
+    pthread_mutex_destroy(&threadPool->mutex);
+    pthread_cond_destroy(&threadPool->runStarted);
+    pthread_cond_destroy(&threadPool->runFinished);
+    free(threadPool->threads);
+    free(threadPool);
+}
+
+int64_t threadPool_getThreadNumber(ThreadPool *threadPool) {
+    return threadPool->threadNumber;
+}
+
+void threadPool_start(ThreadPool *threadPool, void (*fn)(void *args, int64_t thread, int64_t threadNumber), void *args) {
+    assert(threadPool->threadNumber > 1);
+    pthread_mutex_lock(&threadPool->mutex);
+    assert(threadPool->runningWorkers == 0);
+    threadPool->fn = fn;
+    threadPool->args = args;
+    threadPool->runningWorkers = threadPool->threadNumber - 1;
+    threadPool->runs++;
+    pthread_cond_broadcast(&threadPool->runStarted);
+    pthread_mutex_unlock(&threadPool->mutex);
+}
+
+void threadPool_wait(ThreadPool *threadPool) {
+    pthread_mutex_lock(&threadPool->mutex);
+    while (threadPool->runningWorkers > 0) {
+        pthread_cond_wait(&threadPool->runFinished, &threadPool->mutex);
+    }
+    pthread_mutex_unlock(&threadPool->mutex);
+}
+
+void threadPool_run(ThreadPool *threadPool, void (*fn)(void *args, int64_t thread, int64_t threadNumber), void *args) {
+    if (threadPool->threadNumber == 1) {
+        fn(args, 0, 1);
+        return;
+    }
+    threadPool_start(threadPool, fn, args);
+    fn(args, 0, threadPool->threadNumber);
+    threadPool_wait(threadPool);
+}
+
+typedef struct _taskRun {
+    ThreadPool *threadPool;
+    void (*fn)(void *, int64_t, int64_t);
+    void *args;
+    int64_t taskNumber;
+    int64_t nextTask; //The next task to be taken by a thread, guarded by the pool's mutex
+} TaskRun;
+
+static void threadPool_runTasks2(void *args, int64_t thread, int64_t threadNumber) {
+    TaskRun *taskRun = args;
+    while (1) {
+        pthread_mutex_lock(&taskRun->threadPool->mutex);
+        int64_t task = taskRun->nextTask++;
+        pthread_mutex_unlock(&taskRun->threadPool->mutex);
+        if (task >= taskRun->taskNumber) {
+            return;
+        }
+        taskRun->fn(taskRun->args, task, thread);
+    }
+}
+
+void threadPool_runTasks(ThreadPool *threadPool, int64_t taskNumber, void (*fn)(void *args, int64_t task, int64_t thread),
+        void *args) {
+    TaskRun taskRun = { threadPool, fn, args, taskNumber, 0 };
+    threadPool_run(threadPool, threadPool_runTasks2, &taskRun);
+}
@@ -0,0 +1,50 @@
+/*
+ * alignedPairArray.h
+ *
+ *  Aligned pairs stored column by column, each pair being a posterior match
+ *  probability score (an integer, PAIR_ALIGNMENT_PROB_1 being probability 1)
+ *  and its x and y sequence coordinates. Pairs are appended to arrays that
+ *  grow by doubling, rather than each being an stIntTuple of its own.
+ */
+
+#ifndef ALIGNEDPAIRARRAY_H_
+#define ALIGNEDPAIRARRAY_H_
+
+#include <stdint.h>
+#include "sonLib.h"
+
+typedef struct _alignedPairArray {
+    int64_t length;
+    int64_t maxLength; //The number of pairs there is room for
+    int64_t *scores;
+    int64_t *x;
+    int64_t *y;
+} AlignedPairArray;
+
+AlignedPairArray *alignedPairArray_construct();
+
+void alignedPairArray_destruct(AlignedPairArray *alignedPairs);
+
+//Makes room for at least length pairs
+void alignedPairArray_reserve(AlignedPairArray *alignedPairs, int64_t length);
+
+static inline void alignedPairArray_append(AlignedPairArray *alignedPairs, int64_t score, int64_t x, int64_t y) {
+    if (alignedPairs->length == alignedPairs->maxLength) {
+        alignedPairArray_reserve(alignedPairs, 2 * alignedPairs->maxLength + 16);
+    }
+    alignedPairs->scores[alignedPairs->length] = score;
+    alignedPairs->x[alignedPairs->length] = x;
+    alignedPairs->y[alignedPairs->length++] = y;
+}
+
+//Appends the pairs of alignedPairs2, adding offsetX and offsetY to their coordinates.
+void alignedPairArray_appendArray(AlignedPairArray *alignedPairs, AlignedPairArray *alignedPairs2, int64_t offsetX,
+        int64_t offsetY);
+
+//Removes all the pairs, keeping the memory for reuse.
+void alignedPairArray_clear(AlignedPairArray *alignedPairs);
+
+//Returns the pairs as a list of (score, x, y) stIntTuples, the form the rest of the aligner uses.
+stList *alignedPairArray_getList(AlignedPairArray *alignedPairs);
+
+#endif /* ALIGNEDPAIRARRAY_H_ */
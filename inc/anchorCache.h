@@ -0,0 +1,46 @@
+/*
+ * anchorCache.h
+ *
+ *  A cache of the anchor pairs found for pairs of sequences, keyed by hashes
+ *  of the two sequences and of the parameters the anchors were found with, so
+ *  aligning the same sequences again (as EM iterations and repeated queries
+ *  do) costs no anchoring. The anchors are kept delta encoded as variable
+ *  length integers, in memory and optionally in files in a directory, so the
+ *  cache lasts between runs and may be shared by processes.
+ */
+
+#ifndef ANCHORCACHE_H_
+#define ANCHORCACHE_H_
+
+#include <stdint.h>
+#include "sonLib.h"
+
+typedef struct _anchorCache AnchorCache;
+
+//The default limit on the bytes the entries of a cache take in memory
+#define ANCHOR_CACHE_MAX_MEMORY ((int64_t) 256 * 1024 * 1024)
+
+//Constructs an empty cache. If directory is not NULL, anchors added are also written to a file each in it, and anchors
+//not in memory are looked for there. The directory must exist. A file that is truncated or corrupt is a miss. The
+//entries in memory are limited to ANCHOR_CACHE_MAX_MEMORY bytes; the files in the directory are not limited.
+AnchorCache *anchorCache_construct(const char *directory);
+
+//As anchorCache_construct, but the entries in memory are limited to maxMemory bytes. Past the limit entries are dropped
+//from memory, in no particular order, until they take half of it, and are read from the directory again if asked for.
+AnchorCache *anchorCache_construct2(const char *directory, int64_t maxMemory);
+
+void anchorCache_destruct(AnchorCache *cache);
+
+//Returns the anchor pairs cached for the sequences and parameters, as a new list of (x, y) stIntTuples, or NULL if
+//there are none. The parameters are whatever values the anchors depend on.
+stList *anchorCache_get(AnchorCache *cache, const char *sX, const char *sY, int64_t lX, int64_t lY,
+        const int64_t *parameters, int64_t parameterNumber);
+
+//Caches the anchor pairs for the sequences and parameters, replacing any cached before.
+void anchorCache_add(AnchorCache *cache, const char *sX, const char *sY, int64_t lX, int64_t lY,
+        const int64_t *parameters, int64_t parameterNumber, stList *anchorPairs);
+
+//The number of entries held in memory.
+int64_t anchorCache_size(AnchorCache *cache);
+
+#endif /* ANCHORCACHE_H_ */
@@ -0,0 +1,22 @@
+/*
+ * anchorSegments.h
+ *
+ *  Shared by the in process ways of finding anchor pairs, see seedAnchors.h
+ *  and minimizerAnchors.h, which both chain ungapped segments of the two
+ *  sequences and turn the chain into anchor pairs.
+ */
+
+#ifndef ANCHORSEGMENTS_H_
+#define ANCHORSEGMENTS_H_
+
+#include <stdint.h>
+#include "sonLib.h"
+
+/*
+ * Adds the pairs of the ungapped segment starting at x, y to anchorPairs as (x, y) stIntTuples, less trim pairs from
+ * either end, leaving out any not after the last pair added, (*pX, *pY), which is updated. Start with *pX and *pY at -1.
+ */
+void addAnchorSegmentPairs(stList *anchorPairs, int64_t x, int64_t y, int64_t length, int64_t trim, int64_t *pX,
+        int64_t *pY);
+
+#endif /* ANCHORSEGMENTS_H_ */
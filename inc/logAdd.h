@@ -0,0 +1,180 @@
+/*
+ * logAdd.h
+ *
+ *  Adding probabilities in log space, log(exp(x) + exp(y)) = max + log(1 + exp(-|x - y|)).
+ *  Defined here as static inline functions so that the dp recursions can inline them;
+ *  logAdd in pairwiseAligner.h is the exported version.
+ *
+ *  Two precisions are provided, selected at compile time with LOG_ADD_PRECISION:
+ *
+ *  LOG_ADD_INTERPOLATED (the default) interpolates log(1 + exp(-d)) with a piecewise
+ *  cubic and ignores differences of 7.5 or more. Absolute error is under 1e-3.
+ *
+ *  LOG_ADD_PRECISE evaluates exp and log1p with polynomials, giving an absolute
+ *  error under 1e-13, but making the dp about three to four times slower.
+ *
+ *  Both come in scalar and SIMD (see simd.h) forms. Neither branches, and lane i of the
+ *  SIMD form gives exactly the same result as the scalar form on lane i's arguments.
+ *  cPecanLogAddBenchmark reports the throughput and maximum error of each.
+ */
+
+#ifndef LOGADD_H_
+#define LOGADD_H_
+
+#include <math.h>
+#include "simd.h"
+
+#define LOG_ZERO -INFINITY
+
+#define LOG_ADD_INTERPOLATED 0
+#define LOG_ADD_PRECISE 1
+
+#ifndef LOG_ADD_PRECISION
+#define LOG_ADD_PRECISION LOG_ADD_INTERPOLATED
+#endif
+
+///////////////////////////////////
+///////////////////////////////////
+//Interpolated
+///////////////////////////////////
+///////////////////////////////////
+
+#define logUnderflowThreshold 7.5
+
+//Coefficients of the cubics for d in [0, 1], (1, 2.5], (2.5, 4.5] and (4.5, 7.5), highest power first.
+//They are float constants, as they always have been, so results do not change.
+static const double logAdd_cubics[4][4] = {
+        { -0.009350833524763f, 0.130659527668286f, 0.498799810682272f, 0.693203116424741f },
+        { -0.014532321752540f, 0.139942324101744f, 0.495635523139337f, 0.692140569840976f },
+        { -0.004605031767994f, 0.063427417320019f, 0.695956496475118f, 0.514272634594009f },
+        { -0.000458661602210f, 0.009695946122598f, 0.930734667215156f, 0.168037164329057f } };
+
+static inline double logAdd_interpolated(double x, double y) {
+    double mx = x > y ? x : y;
+    double mn = x > y ? y : x;
+    double d = mx - mn; //+inf if mn is LOG_ZERO, NaN if both are
+    const double *c = logAdd_cubics[(d > 1.00f) + (d > 2.50f) + (d > 4.50f)];
+    double l = ((c[0] * d + c[1]) * d + c[2]) * d + c[3];
+    //At or beyond the underflow threshold (including infinite and NaN differences) just take the max
+    return d < logUnderflowThreshold ? l + mn : mx;
+}
+
+static inline SimdDouble simd_logAddInterpolated(SimdDouble x, SimdDouble y) {
+    SimdDouble mx = simd_max(x, y);
+    SimdDouble mn = simd_min(x, y);
+    SimdDouble d = simd_sub(mx, mn);
+    //Pick the cubic for the interval containing d, starting from the last one
+    SimdDouble c[4];
+    c[0] = simd_set1(logAdd_cubics[3][0]);
+    c[1] = simd_set1(logAdd_cubics[3][1]);
+    c[2] = simd_set1(logAdd_cubics[3][2]);
+    c[3] = simd_set1(logAdd_cubics[3][3]);
+    SimdDouble m = simd_lessThanOrEqual(d, simd_set1(4.50f));
+    c[0] = simd_select(m, simd_set1(logAdd_cubics[2][0]), c[0]);
+    c[1] = simd_select(m, simd_set1(logAdd_cubics[2][1]), c[1]);
+    c[2] = simd_select(m, simd_set1(logAdd_cubics[2][2]), c[2]);
+    c[3] = simd_select(m, simd_set1(logAdd_cubics[2][3]), c[3]);
+    m = simd_lessThanOrEqual(d, simd_set1(2.50f));
+    c[0] = simd_select(m, simd_set1(logAdd_cubics[1][0]), c[0]);
+    c[1] = simd_select(m, simd_set1(logAdd_cubics[1][1]), c[1]);
+    c[2] = simd_select(m, simd_set1(logAdd_cubics[1][2]), c[2]);
+    c[3] = simd_select(m, simd_set1(logAdd_cubics[1][3]), c[3]);
+    m = simd_lessThanOrEqual(d, simd_set1(1.00f));
+    c[0] = simd_select(m, simd_set1(logAdd_cubics[0][0]), c[0]);
+    c[1] = simd_select(m, simd_set1(logAdd_cubics[0][1]), c[1]);
+    c[2] = simd_select(m, simd_set1(logAdd_cubics[0][2]), c[2]);
+    c[3] = simd_select(m, simd_set1(logAdd_cubics[0][3]), c[3]);
+    SimdDouble l = simd_add(simd_mul(simd_add(simd_mul(simd_add(simd_mul(c[0], d), c[1]), d), c[2]), d), c[3]);
+    return simd_select(simd_lessThan(d, simd_set1(logUnderflowThreshold)), simd_add(l, mn), mx);
+}
+
+///////////////////////////////////
+///////////////////////////////////
+//Precise
+//
+//exp(-d) is computed as exp(-d/64)^64, taking exp(-d/64) from
+//its Taylor series, and log(1 + e) as 2 * atanh(e / (2 + e)),
+//again from its series, which converges quickly as
+//e / (2 + e) <= 1/3.
+///////////////////////////////////
+///////////////////////////////////
+
+#define logUnderflowThresholdPrecise 37.5 //exp(-37.5) is below double precision relative to 1
+
+#define LOG_ADD_EXP_TERMS 15
+#define LOG_ADD_LOG1P_TERMS 14
+
+static const double logAdd_expCoefficients[LOG_ADD_EXP_TERMS] = { //1/k!, highest power first
+        1.0 / 87178291200.0, 1.0 / 6227020800.0, 1.0 / 479001600.0, 1.0 / 39916800.0, 1.0 / 3628800.0, 1.0 / 362880.0,
+        1.0 / 40320.0, 1.0 / 5040.0, 1.0 / 720.0, 1.0 / 120.0, 1.0 / 24.0, 1.0 / 6.0, 1.0 / 2.0, 1.0, 1.0 };
+
+static const double logAdd_log1pCoefficients[LOG_ADD_LOG1P_TERMS] = { //2/(2k+1), highest power first
+        2.0 / 27.0, 2.0 / 25.0, 2.0 / 23.0, 2.0 / 21.0, 2.0 / 19.0, 2.0 / 17.0, 2.0 / 15.0, 2.0 / 13.0, 2.0 / 11.0,
+        2.0 / 9.0, 2.0 / 7.0, 2.0 / 5.0, 2.0 / 3.0, 2.0 };
+
+static inline double logAdd_precise(double x, double y) {
+    double mx = x > y ? x : y;
+    double mn = x > y ? y : x;
+    double d = mx - mn;
+    double z = d < logUnderflowThresholdPrecise ? -d / 64.0 : 0.0; //Keeps the polynomials finite
+    double e = logAdd_expCoefficients[0];
+    for (int64_t i = 1; i < LOG_ADD_EXP_TERMS; i++) {
+        e = e * z + logAdd_expCoefficients[i];
+    }
+    for (int64_t i = 0; i < 6; i++) {
+        e = e * e;
+    }
+    double t = e / (2.0 + e);
+    double u = t * t;
+    double l = logAdd_log1pCoefficients[0];
+    for (int64_t i = 1; i < LOG_ADD_LOG1P_TERMS; i++) {
+        l = l * u + logAdd_log1pCoefficients[i];
+    }
+    return d < logUnderflowThresholdPrecise ? mx + l * t : mx;
+}
+
+static inline SimdDouble simd_logAddPrecise(SimdDouble x, SimdDouble y) {
+    SimdDouble mx = simd_max(x, y);
+    SimdDouble mn = simd_min(x, y);
+    SimdDouble d = simd_sub(mx, mn);
+    SimdDouble inRange = simd_lessThan(d, simd_set1(logUnderflowThresholdPrecise));
+    SimdDouble z = simd_select(inRange, simd_mul(simd_sub(simd_set1(0.0), d), simd_set1(1.0 / 64.0)), simd_set1(0.0));
+    SimdDouble e = simd_set1(logAdd_expCoefficients[0]);
+    for (int64_t i = 1; i < LOG_ADD_EXP_TERMS; i++) {
+        e = simd_add(simd_mul(e, z), simd_set1(logAdd_expCoefficients[i]));
+    }
+    for (int64_t i = 0; i < 6; i++) {
+        e = simd_mul(e, e);
+    }
+    SimdDouble t = simd_div(e, simd_add(simd_set1(2.0), e));
+    SimdDouble u = simd_mul(t, t);
+    SimdDouble l = simd_set1(logAdd_log1pCoefficients[0]);
+    for (int64_t i = 1; i < LOG_ADD_LOG1P_TERMS; i++) {
+        l = simd_add(simd_mul(l, u), simd_set1(logAdd_log1pCoefficients[i]));
+    }
+    return simd_select(inRange, simd_add(mx, simd_mul(l, t)), mx);
+}
+
+///////////////////////////////////
+///////////////////////////////////
+//The logAdd used by the dp, as selected by LOG_ADD_PRECISION
+///////////////////////////////////
+///////////////////////////////////
+
+static inline double logAdd_inline(double x, double y) {
+#if LOG_ADD_PRECISION == LOG_ADD_PRECISE
+    return logAdd_precise(x, y);
+#else
+    return logAdd_interpolated(x, y);
+#endif
+}
+
+static inline SimdDouble simd_logAdd(SimdDouble x, SimdDouble y) {
+#if LOG_ADD_PRECISION == LOG_ADD_PRECISE
+    return simd_logAddPrecise(x, y);
+#else
+    return simd_logAddInterpolated(x, y);
+#endif
+}
+
+#endif /* LOGADD_H_ */
@@ -0,0 +1,30 @@
+/*
+ * minimizerAnchors.h
+ *
+ *  Finds anchor pairs from exact matches of minimizers, the k-mers of least
+ *  hash in each window of consecutive k-mers, as minimap does. The matches
+ *  are chained by the colinear chain with the most matches and no gap longer
+ *  than MINIMIZER_ANCHORS_MAX_GAP, found in O(n log n). Short exact matches suit noisy sequences, such as nanopore
+ *  reads, better than lastz's high scoring segment pairs, see seedAnchors.h.
+ */
+
+#ifndef MINIMIZERANCHORS_H_
+#define MINIMIZERANCHORS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sonLib.h"
+
+//The most two successive matches of a chain may be apart in either sequence, as minimap's -g. Without it a chain may
+//take a few chance matches far from the rest, anchoring the alignment across a gap it does not have.
+#define MINIMIZER_ANCHORS_MAX_GAP 10000
+
+/*
+ * As getSeedAnchorPairs, but from chained minimizer matches. Matches of the chain on the same diagonal and close
+ * together are merged into ungapped segments, and the pairs of the segments, less trim from either end of each, are
+ * returned as (x, y) stIntTuples, each pair after the last in both sequences. If repeatMask, no minimizers are taken
+ * from lower case (repeat masked) bases.
+ */
+stList *getMinimizerAnchorPairs(const char *sX, const char *sY, int64_t lX, int64_t lY, int64_t trim, bool repeatMask);
+
+#endif /* MINIMIZERANCHORS_H_ */
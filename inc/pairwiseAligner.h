@@ -18,6 +18,12 @@
 #include "sonLib.h"
 #include "pairwiseAlignment.h"
 #include "stateMachine.h"
+#include "logAdd.h"
+#include "threadPool.h"
+#include "alignedPairArray.h"
+#include "seedAnchors.h"
+#include "minimizerAnchors.h"
+#include "anchorCache.h"
 
 //The exception string
 extern const char *PAIRWISE_ALIGNMENT_EXCEPTION_ID;
@@ -25,6 +31,13 @@ extern const char *PAIRWISE_ALIGNMENT_EXCEPTION_ID;
 //Constant that gives the integer value equal to probability 1. Integer probability zero is always 0.
 #define PAIR_ALIGNMENT_PROB_1 10000000
 
+//The ways of finding anchor pairs, see getBlastPairsForPairwiseAlignmentParameters
+typedef enum {
+    seedAnchors = 0, //In process, see getSeedAnchorPairs. The default.
+    lastzAnchors = 1, //By running cPecanLastz, see getBlastPairs
+    minimizerAnchors = 2 //In process, from minimizer matches, see getMinimizerAnchorPairs. Suits noisy sequences.
+} AnchorMethod;
+
 typedef struct _pairwiseAlignmentBandingParameters {
     double threshold; //Minimum posterior probability of a match to be added to the output
     int64_t minDiagsBetweenTraceBack; //Minimum x+y diagonals to leave between doing traceback.
@@ -34,8 +47,17 @@ typedef struct _pairwiseAlignmentBandingParameters {
     int64_t anchorMatrixBiggerThanThis; //Search for anchors on any matrix bigger than this
     int64_t repeatMaskMatrixBiggerThanThis; //Any matrix in the anchors bigger than this is searched for anchors using non-repeat masked sequences.
     int64_t splitMatrixBiggerThanThis; //Any matrix in the anchors bigger than this is split into two.
+    AnchorMethod anchorMethod; //How the anchors are found.
+    AnchorCache *anchorCache; //If not NULL, the anchors found by getBlastPairsForPairwiseAlignmentParameters are kept in and taken from this cache. Not owned by the parameters.
     bool alignAmbiguityCharacters;
     float gapGamma; //The AMAP gap-gamma parameter which controls the degree to which indel probabilities are factored into the alignment.
+    bool scaledProbabilities; //Do the dp with scaled probabilities rather than log probabilities, see dpMatrix_construct2. Faster, and posteriors agree to within the logAdd error.
+    int64_t threadNumber; //Number of threads to align the regions split by large gaps with, or if there is one region to split the diagonals of its dp between, see dpMatrix_setThreadPool.
+    int64_t minDiagonalCellsPerThread; //Diagonals are only split between threads if each thread gets at least this many cells.
+    double adaptiveBandDrop; //If greater than 0, the band is pruned as the forward calculation goes, dropping the cells of the next diagonal not next to a cell of the last two whose forward log probability is within this of the maximum of its diagonal (like lastz's ydrop). The backward calculation uses the pruned band. This is a heuristic with no bound on the error: a cell's forward probability says nothing of its backward probability, so the pruned cells may be on the path the rest of the alignment favours, and then the posteriors of the whole alignment move, by up to 1. On random pairs of up to 300 bases, a third unanchored, a drop of 15 keeps about 45% of the band's cells and 1 alignment in 75 has a posterior moved by more than 0.01, 25 keeps 60% and 1 in 600 do, and 60 keeps 90% and 1 in 3000 do.
+    double backwardBandDrop; //If greater than 0, the forward calculation is done over the whole band, but the backward and posterior calculations only over the cells of each diagonal whose forward log probability is within this of the maximum of the diagonal, and the cells next to them. The cells left out get no posterior. Like adaptiveBandDrop this is a heuristic with no bound on the error, as a cell's forward probability says nothing of its backward probability, and it may leave out the path the rest of the alignment favours, moving the posteriors by up to 1, with or without anchors or ragged ends. On random pairs of up to 300 bases, a third unanchored, a drop of 15 leaves the backward calculation about 50% of the band's cells and 1 alignment in 140 has a posterior moved by more than 0.01, 25 leaves 65% and 1 in 1000 do, and 60 leaves 90% and none of 3000 did.
+    int64_t checkpointDiagonals; //If greater than 0, the banded dp only keeps a pair of forward diagonals every this many, recomputing the rest in the traceback, so memory is bounded for any band. If negative, the square root of the number of diagonals is used, which about minimises the memory. 0 (the default) keeps every forward diagonal.
+    bool pipelineTraceBacks; //Do the intermediate tracebacks of the banded dp on a second thread while the forward calculation carries on. Not done if checkpointing.
 } PairwiseAlignmentParameters;
 
 PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters_construct();
@@ -51,6 +73,27 @@ stList *convertPairwiseForwardStrandAlignmentToAnchorPairs(struct PairwiseAlignm
 
 stList *getAlignedPairsUsingAnchors(StateMachine *sM, const char *sX, const char *sY, stList *anchorPairs, PairwiseAlignmentParameters *p, bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd);
 
+/*
+ * As getAlignedPairs and getAlignedPairsUsingAnchors, but return the pairs in an AlignedPairArray, which avoids making
+ * a tuple per pair. The list returning functions are these with the array converted by alignedPairArray_getList.
+ */
+AlignedPairArray *getAlignedPairArray(StateMachine *sM, const char *sX, const char *sY, PairwiseAlignmentParameters *p, bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd);
+
+AlignedPairArray *getAlignedPairArrayUsingAnchors(StateMachine *sM, const char *sX, const char *sY, stList *anchorPairs, PairwiseAlignmentParameters *p, bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd);
+
+/*
+ * Gets the most probable (Viterbi) alignment of the two sequences under the HMM, within the band around the anchor pairs,
+ * as a list of alignment operations (a cigar, see pairwiseAlignment.h), setting score to its log probability. Only the
+ * forward calculation is done, taking the maximum rather than the sum over transitions, with no backward calculation or
+ * posterior decoding, so it is much quicker than getting the aligned pairs. As for the aligned pairs, the matrix is split
+ * at large gaps, see getSplitPoints, so the tracebacks held, two bytes a cell of the band, are bounded by the largest
+ * region. The middle of each large gap left between two regions is aligned as gaps, and the score is the sum of the
+ * regions' scores.
+ */
+struct List *getViterbiAlignment(StateMachine *sM, const char *sX, const char *sY, PairwiseAlignmentParameters *p, bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd, double *score);
+
+struct List *getViterbiAlignmentUsingAnchors(StateMachine *sM, const char *sX, const char *sY, stList *anchorPairs, PairwiseAlignmentParameters *p, bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd, double *score);
+
 /*
  * Expectation calculation functions for EM algorithms.
  */
@@ -60,6 +103,23 @@ void getExpectationsUsingAnchors(StateMachine *sM, Hmm *hmmExpectations, const c
 
 void getExpectations(StateMachine *sM, Hmm *hmmExpectations, const char *sX, const char *sY, PairwiseAlignmentParameters *p, bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd);
 
+/*
+ * Batch versions of getAlignedPairArrayUsingAnchors and getExpectationsUsingAnchors, for aligning many small pairs of
+ * sequences. Pair i is the ith sequences of sXs and sYs, with the anchor pairs of the ith list of anchorPairs, or with
+ * none if anchorPairs is NULL. The pairs are split between p->threadNumber threads, each pair being aligned by one
+ * thread, which keeps the threads busy where the diagonals of single pairs are too short to split between them. With
+ * one thread the pairs are simply aligned in turn. This batches pairs over threads only: each pair is still aligned with
+ * the diagonal kernels, which already fill the SIMD lanes, see cPecanBatchBenchmark.
+ * The aligned pairs are exactly those of aligning the pairs one by one. The expectations are the same up to the order
+ * the pairs' expectations are summed in, as each thread sums its pair apart, and exactly the same with one thread.
+ */
+
+//Returns a list of the AlignedPairArrays of the pairs, in the order of the pairs.
+stList *getAlignedPairArraysForBatch(StateMachine *sM, stList *sXs, stList *sYs, stList *anchorPairs, PairwiseAlignmentParameters *p, bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd);
+
+//Adds the expectations of the pairs to hmmExpectations, in the order of the pairs.
+void getExpectationsForBatch(StateMachine *sM, Hmm *hmmExpectations, stList *sXs, stList *sYs, stList *anchorPairs, PairwiseAlignmentParameters *p, bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd);
+
 /*
  * Methods tested and possibly useful elsewhere
  */
@@ -99,6 +159,10 @@ Band *band_construct(stList *anchorPairs, int64_t lX, int64_t lY,
 
 void band_destruct(Band *band);
 
+//Narrows the band's diagonal xay to its cells within [xmyL, xmyR], which must have the parity of xay. Leaves the diagonal
+//as it is if it has no cells within them. Used to prune the band as the forward calculation goes, see adaptiveBandDrop.
+void band_narrowDiagonal(Band *band, int64_t xay, int64_t xmyL, int64_t xmyR);
+
 ////Band iterator.
 
 typedef struct _bandIterator BandIterator;
@@ -113,9 +177,7 @@ Diagonal bandIterator_getNext(BandIterator *bandIterator);
 
 Diagonal bandIterator_getPrevious(BandIterator *bandIterator);
 
-//Log add
-
-#define LOG_ZERO -INFINITY
+//Log add (LOG_ZERO and the inlined versions are in logAdd.h)
 
 double logAdd(double x, double y);
 
@@ -125,22 +187,31 @@ Symbol symbol_convertCharToSymbol(char i);
 
 Symbol *symbol_convertStringToSymbols(const char *s, int64_t sL);
 
+//A sequence of symbols, one byte per symbol, together with the same symbols in reverse order, so that the symbols
+//along an x+y diagonal can be read from contiguous runs of the x sequence and the reversed y sequence.
 typedef struct _symbolString {
-        Symbol *sequence;
-                int64_t length;
+        PackedSymbol *sequence;
+        PackedSymbol *reversedSequence;
+        int64_t length;
 } SymbolString;
 
 SymbolString symbolString_construct(const char *sequence, int64_t length);
 
+void symbolString_destruct(SymbolString s);
+
+//Gets the symbols [start, start + length) of a symbol string, without copying them. The returned
+//string shares the memory of the original, so must not be destructed or used after the original is.
+SymbolString symbolString_getSubString(SymbolString s, int64_t start, int64_t length);
+
 //Cell calculations
 
-void cell_calculateForward(StateMachine *sM, double *current, double *lower, double *middle, double *upper, Symbol cX, Symbol cY, void *extraArgs);
+void cell_calculateForward(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle, DpValue *upper, Symbol cX, Symbol cY, void *extraArgs);
 
-void cell_calculateBackward(StateMachine *sM, double *current, double *lower, double *middle, double *upper, Symbol cX, Symbol cY, void *extraArgs);
+void cell_calculateBackward(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle, DpValue *upper, Symbol cX, Symbol cY, void *extraArgs);
 
-double cell_dotProduct(double *cell1, double *cell2, int64_t stateNumber);
+double cell_dotProduct(DpValue *cell1, DpValue *cell2, int64_t stateNumber);
 
-double cell_dotProduct2(double *cell1, StateMachine *sM, double (*getStateValue)(StateMachine *, int64_t));
+double cell_dotProduct2(DpValue *cell1, StateMachine *sM, double (*getStateValue)(StateMachine *, int64_t));
 
 //DpDiagonal
 
@@ -154,7 +225,8 @@ bool dpDiagonal_equals(DpDiagonal *diagonal1, DpDiagonal *diagonal2);
 
 void dpDiagonal_destruct(DpDiagonal *dpDiagonal);
 
-double *dpDiagonal_getCell(DpDiagonal *dpDiagonal, int64_t xmy);
+//Gets the cell with the given x-y coordinate, with a NULL value pointer if it is outside of the diagonal.
+DpCells dpDiagonal_getCell(DpDiagonal *dpDiagonal, int64_t xmy);
 
 double dpDiagonal_dotProduct(DpDiagonal *diagonal1, DpDiagonal *diagonal2);
 
@@ -168,16 +240,29 @@ typedef struct _dpMatrix DpMatrix;
 
 DpMatrix *dpMatrix_construct(int64_t diagonalNumber, int64_t stateNumber);
 
+//As dpMatrix_construct, but if scaled is true the diagonals of the matrix hold probabilities, rather than log probabilities,
+//so that the dp can be done with multiply-adds. To avoid underflow each diagonal's values are divided by a power of two,
+//chosen when the diagonal is complete to keep the largest near 1. The dp functions below handle both kinds of
+//matrix and the probabilities they return or take, such as the total probability, are always log probabilities.
+DpMatrix *dpMatrix_construct2(int64_t diagonalNumber, int64_t stateNumber, bool scaled);
+
 void dpMatrix_destruct(DpMatrix *dpMatrix);
 
 DpDiagonal *dpMatrix_getDiagonal(DpMatrix *dpMatrix, int64_t xay);
 
 int64_t dpMatrix_getActiveDiagonalNumber(DpMatrix *dpMatrix);
 
+//The values of a created diagonal are undefined until initialised or zeroed. Created diagonals may reuse the memory of
+//deleted ones, which the matrix keeps until it is destructed.
 DpDiagonal *dpMatrix_createDiagonal(DpMatrix *dpMatrix, Diagonal diagonal);
 
 void dpMatrix_deleteDiagonal(DpMatrix *dpMatrix, int64_t xay);
 
+//Sets the thread pool the forward and backward calculations of the matrix's diagonals are split between, a diagonal
+//being split only if each thread gets at least minCellsPerThread cells. The results are identical to those without
+//threads. threadPool may be NULL, the default, to calculate everything in the caller. The pool is not owned by the matrix.
+void dpMatrix_setThreadPool(DpMatrix *dpMatrix, ThreadPool *threadPool, int64_t minCellsPerThread);
+
 //Diagonal calculations
 
 void diagonalCalculationForward(StateMachine *sM, int64_t xay, DpMatrix *dpMatrix, const SymbolString sX, const SymbolString sY);
@@ -187,10 +272,17 @@ void diagonalCalculationBackward(StateMachine *sM, int64_t xay, DpMatrix *dpMatr
 double diagonalCalculationTotalProbability(StateMachine *sM, int64_t xay, DpMatrix *forwardDpMatrix, DpMatrix *backwardDpMatrix,
         const SymbolString sX, const SymbolString sY);
 
+//Appends the pairs of the diagonal whose posterior match probability is at least p->threshold, as (score, x, y)
+//stIntTuples, to the stList ((void **) extraArgs)[0].
 void diagonalCalculationPosteriorMatchProbs(StateMachine *sM, int64_t xay, DpMatrix *forwardDpMatrix, DpMatrix *backwardDpMatrix,
         const SymbolString sX, const SymbolString sY,
         double totalProbability, PairwiseAlignmentParameters *p, void *extraArgs);
 
+//As diagonalCalculationPosteriorMatchProbs, but appends the pairs to the AlignedPairArray ((void **) extraArgs)[0].
+void diagonalCalculationPosteriorMatchProbsToArray(StateMachine *sM, int64_t xay, DpMatrix *forwardDpMatrix,
+        DpMatrix *backwardDpMatrix, const SymbolString sX, const SymbolString sY,
+        double totalProbability, PairwiseAlignmentParameters *p, void *extraArgs);
+
 //Banded matrix calculation of posterior probs
 
 void getPosteriorProbsWithBanding(StateMachine *sM, stList *anchorPairs, const SymbolString sX, const SymbolString sY,
@@ -198,6 +290,16 @@ void getPosteriorProbsWithBanding(StateMachine *sM, stList *anchorPairs, const S
         void (*diagonalPosteriorProbFn)(StateMachine *, int64_t, DpMatrix *, DpMatrix *, const SymbolString, const SymbolString,
               double, PairwiseAlignmentParameters *, void *), void *extraArgs);
 
+//Banded Viterbi alignment, see getViterbiAlignment
+
+struct List *getViterbiAlignmentWithBanding(StateMachine *sM, stList *anchorPairs, const SymbolString sX, const SymbolString sY,
+        PairwiseAlignmentParameters *p, bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd, double *score);
+
+//As getViterbiAlignmentWithBanding, but splitting the matrix at large gaps, see getViterbiAlignment.
+struct List *getViterbiAlignmentWithBandingSplittingAlignmentsByLargeGaps(StateMachine *sM, stList *anchorPairs,
+        const char *sX, const char *sY, int64_t lX, int64_t lY, PairwiseAlignmentParameters *p,
+        bool alignmentHasRaggedLeftEnd, bool alignmentHasRaggedRightEnd, double *score);
+
 //Blast pairs
 
 stList *getBlastPairs(const char *sX, const char *sY, int64_t lX, int64_t lY, int64_t trim, bool repeatMask);
@@ -205,6 +307,12 @@ stList *getBlastPairs(const char *sX, const char *sY, int64_t lX, int64_t lY, in
 stList *getBlastPairsForPairwiseAlignmentParameters(const char *sX, const char *sY, const int64_t lX, const int64_t lY,
         PairwiseAlignmentParameters *p);
 
+//As getBlastPairsForPairwiseAlignmentParameters, but if p->anchorMethod is seedAnchors the top level, repeat masked,
+//anchors are found with indexX, made by seedIndex_construct(sX, lX, 1), rather than indexing sX again. So when aligning
+//many sequences against one the index of it is made once. indexX may be NULL.
+stList *getBlastPairsForPairwiseAlignmentParametersUsingIndex(const char *sX, const char *sY, const int64_t lX,
+        const int64_t lY, SeedIndex *indexX, PairwiseAlignmentParameters *p);
+
 stList *filterToRemoveOverlap(stList *overlappingPairs);
 
 //Split over large gaps
@@ -218,6 +326,19 @@ void getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps(StateMachine *sM
                 double, PairwiseAlignmentParameters *, void *),
         void (*coordinateCorrectionFn)(), void *extraArgs);
 
+//As getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps, but each region is aligned with its own extra arguments,
+//made by constructRegionArgsFn(extraArgs), which are passed once the region is aligned to
+//mergeRegionArgsFn(regionArgs, offsetX, offsetY, extraArgs), offsetX and offsetY being the region's start. Regions are
+//merged in order. If p->threadNumber > 1 the regions are aligned at the same time by that many threads, so
+//diagonalPosteriorProbFn must only write to its region's arguments.
+void getPosteriorProbsWithBandingSplittingAlignmentsByLargeGaps2(StateMachine *sM, stList *anchorPairs, const char *sX,
+        const char *sY, int64_t lX, int64_t lY, PairwiseAlignmentParameters *p, bool alignmentHasRaggedLeftEnd,
+        bool alignmentHasRaggedRightEnd,
+        void (*diagonalPosteriorProbFn)(StateMachine *, int64_t, DpMatrix *, DpMatrix *, const SymbolString, const SymbolString,
+                double, PairwiseAlignmentParameters *, void *),
+        void *(*constructRegionArgsFn)(void *extraArgs),
+        void (*mergeRegionArgsFn)(void *regionArgs, int64_t offsetX, int64_t offsetY, void *extraArgs), void *extraArgs);
+
 //Calculate posterior probabilities of being aligned to gaps
 
 int64_t *getIndelProbabilities(stList *alignedPairs, int64_t seqLength, bool xIfTrueElseY);
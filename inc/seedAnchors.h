@@ -0,0 +1,42 @@
+/*
+ * seedAnchors.h
+ *
+ *  Finds anchor pairs in process, in the manner of lastz: hits of a spaced
+ *  seed between the two sequences are extended without gaps into high scoring
+ *  segment pairs (HSPs), and the highest scoring colinear chain of HSPs is
+ *  taken. Used in place of running cPecanLastz, which costs a process, temp
+ *  files and the parsing of its output on every call.
+ */
+
+#ifndef SEEDANCHORS_H_
+#define SEEDANCHORS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sonLib.h"
+
+//Minimum score of an HSP for it to be chained, as lastz's --hspthresh
+#define SEED_ANCHORS_HSP_THRESHOLD 800
+
+/*
+ * As getBlastPairs, but found in process. Returns the aligned pairs of the chained HSPs, less trim pairs from either
+ * end of each HSP, as (x, y) stIntTuples, each pair after the last in both sequences. If repeatMask, no seeds are
+ * taken from lower case (repeat masked) bases, though HSPs may be extended over them.
+ */
+stList *getSeedAnchorPairs(const char *sX, const char *sY, int64_t lX, int64_t lY, int64_t trim, bool repeatMask);
+
+/*
+ * An index of the seeds of a sequence x, made once to anchor any number of sequences against x. getSeedAnchorPairs
+ * indexes x on every call. The index keeps its own copy of what it needs of x, and is not changed by use, so it may be
+ * shared between threads.
+ */
+typedef struct _seedIndex SeedIndex;
+
+SeedIndex *seedIndex_construct(const char *sX, int64_t lX, bool repeatMask);
+
+void seedIndex_destruct(SeedIndex *index);
+
+//As getSeedAnchorPairs, with the indexed sequence as x and the repeat masking it was indexed with.
+stList *seedIndex_getAnchorPairs(SeedIndex *index, const char *sY, int64_t lY, int64_t trim);
+
+#endif /* SEEDANCHORS_H_ */
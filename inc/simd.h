@@ -0,0 +1,239 @@
+/*
+ * simd.h
+ *
+ *  Small set of vector operations on doubles used by the diagonal dp kernels.
+ *
+ *  The width is chosen at compile time from the instruction set the compiler
+ *  is targeting: four lanes with AVX, two lanes with SSE2 and a single lane
+ *  (plain doubles) otherwise, so the same kernel source compiles everywhere.
+ *  Build with -mavx (or -march=native) to get the wider lanes.
+ *
+ *  It also defines DpValue, the type the dp matrices store their values as, and
+ *  the loads and stores converting between it and the vectors.
+ */
+
+#ifndef SIMD_H_
+#define SIMD_H_
+
+#include <stdint.h>
+
+#if defined(__AVX__)
+
+#include <immintrin.h>
+
+#define SIMD_WIDTH 4
+
+typedef __m256d SimdDouble;
+
+static inline SimdDouble simd_set1(double x) {
+    return _mm256_set1_pd(x);
+}
+
+static inline SimdDouble simd_load(const double *x) { //x must have SIMD_WIDTH elements
+    return _mm256_loadu_pd(x);
+}
+
+static inline void simd_store(double *x, SimdDouble y) {
+    _mm256_storeu_pd(x, y);
+}
+
+static inline SimdDouble simd_add(SimdDouble x, SimdDouble y) {
+    return _mm256_add_pd(x, y);
+}
+
+static inline SimdDouble simd_sub(SimdDouble x, SimdDouble y) {
+    return _mm256_sub_pd(x, y);
+}
+
+static inline SimdDouble simd_mul(SimdDouble x, SimdDouble y) {
+    return _mm256_mul_pd(x, y);
+}
+
+static inline SimdDouble simd_div(SimdDouble x, SimdDouble y) {
+    return _mm256_div_pd(x, y);
+}
+
+static inline SimdDouble simd_max(SimdDouble x, SimdDouble y) {
+    return _mm256_max_pd(x, y);
+}
+
+static inline SimdDouble simd_min(SimdDouble x, SimdDouble y) {
+    return _mm256_min_pd(x, y);
+}
+
+static inline SimdDouble simd_lessThan(SimdDouble x, SimdDouble y) { //All bits set in lanes where x < y
+    return _mm256_cmp_pd(x, y, _CMP_LT_OQ);
+}
+
+static inline SimdDouble simd_lessThanOrEqual(SimdDouble x, SimdDouble y) {
+    return _mm256_cmp_pd(x, y, _CMP_LE_OQ);
+}
+
+static inline SimdDouble simd_select(SimdDouble mask, SimdDouble x, SimdDouble y) { //x where mask is set, else y
+    return _mm256_blendv_pd(y, x, mask);
+}
+
+static inline int simd_maskBits(SimdDouble mask) { //Bit i set where lane i of the mask is set
+    return _mm256_movemask_pd(mask);
+}
+
+#elif defined(__SSE2__)
+
+#include <emmintrin.h>
+
+#define SIMD_WIDTH 2
+
+typedef __m128d SimdDouble;
+
+static inline SimdDouble simd_set1(double x) {
+    return _mm_set1_pd(x);
+}
+
+static inline SimdDouble simd_load(const double *x) {
+    return _mm_loadu_pd(x);
+}
+
+static inline void simd_store(double *x, SimdDouble y) {
+    _mm_storeu_pd(x, y);
+}
+
+static inline SimdDouble simd_add(SimdDouble x, SimdDouble y) {
+    return _mm_add_pd(x, y);
+}
+
+static inline SimdDouble simd_sub(SimdDouble x, SimdDouble y) {
+    return _mm_sub_pd(x, y);
+}
+
+static inline SimdDouble simd_mul(SimdDouble x, SimdDouble y) {
+    return _mm_mul_pd(x, y);
+}
+
+static inline SimdDouble simd_div(SimdDouble x, SimdDouble y) {
+    return _mm_div_pd(x, y);
+}
+
+static inline SimdDouble simd_max(SimdDouble x, SimdDouble y) {
+    return _mm_max_pd(x, y);
+}
+
+static inline SimdDouble simd_min(SimdDouble x, SimdDouble y) {
+    return _mm_min_pd(x, y);
+}
+
+static inline SimdDouble simd_lessThan(SimdDouble x, SimdDouble y) {
+    return _mm_cmplt_pd(x, y);
+}
+
+static inline SimdDouble simd_lessThanOrEqual(SimdDouble x, SimdDouble y) {
+    return _mm_cmple_pd(x, y);
+}
+
+static inline SimdDouble simd_select(SimdDouble mask, SimdDouble x, SimdDouble y) {
+    //SSE2 has no blend, but comparison masks are all ones or all zeros per lane.
+    return _mm_or_pd(_mm_and_pd(mask, x), _mm_andnot_pd(mask, y));
+}
+
+static inline int simd_maskBits(SimdDouble mask) {
+    return _mm_movemask_pd(mask);
+}
+
+#else
+
+#define SIMD_WIDTH 1
+
+typedef double SimdDouble;
+
+static inline SimdDouble simd_set1(double x) {
+    return x;
+}
+
+static inline SimdDouble simd_load(const double *x) {
+    return x[0];
+}
+
+static inline void simd_store(double *x, SimdDouble y) {
+    x[0] = y;
+}
+
+static inline SimdDouble simd_add(SimdDouble x, SimdDouble y) {
+    return x + y;
+}
+
+static inline SimdDouble simd_sub(SimdDouble x, SimdDouble y) {
+    return x - y;
+}
+
+static inline SimdDouble simd_mul(SimdDouble x, SimdDouble y) {
+    return x * y;
+}
+
+static inline SimdDouble simd_div(SimdDouble x, SimdDouble y) {
+    return x / y;
+}
+
+static inline SimdDouble simd_max(SimdDouble x, SimdDouble y) {
+    return x > y ? x : y;
+}
+
+static inline SimdDouble simd_min(SimdDouble x, SimdDouble y) {
+    return x < y ? x : y;
+}
+
+//In the single lane case a mask is 1.0 (true) or 0.0 (false).
+static inline SimdDouble simd_lessThan(SimdDouble x, SimdDouble y) {
+    return x < y;
+}
+
+static inline SimdDouble simd_lessThanOrEqual(SimdDouble x, SimdDouble y) {
+    return x <= y;
+}
+
+static inline SimdDouble simd_select(SimdDouble mask, SimdDouble x, SimdDouble y) {
+    return mask != 0.0 ? x : y;
+}
+
+static inline int simd_maskBits(SimdDouble mask) {
+    return mask != 0.0;
+}
+
+#endif
+
+/*
+ * Dp matrix values are doubles unless DP_FLOAT is defined, in which case they are stored as floats, halving the
+ * memory the matrices take and the memory traffic of the dp. They are converted to double precision when
+ * loaded, so the calculations themselves are always done in double precision. Floats suit the scaled dp (see
+ * dpMatrix_construct2); the log probabilities of long alignments are too large to keep their precision as floats.
+ * cPecanPosteriorDrift measures the resulting drift in the posterior match probabilities.
+ */
+#ifdef DP_FLOAT
+typedef float DpValue;
+#else
+typedef double DpValue;
+#endif
+
+static inline SimdDouble simd_loadValues(const DpValue *x) {
+#ifdef DP_FLOAT
+    double y[SIMD_WIDTH];
+    for (int64_t i = 0; i < SIMD_WIDTH; i++) {
+        y[i] = x[i];
+    }
+    return simd_load(y);
+#else
+    return simd_load(x);
+#endif
+}
+
+static inline void simd_storeValues(DpValue *x, SimdDouble y) {
+#ifdef DP_FLOAT
+    double z[SIMD_WIDTH];
+    simd_store(z, y);
+    for (int64_t i = 0; i < SIMD_WIDTH; i++) {
+        x[i] = z[i];
+    }
+#else
+    simd_store(x, y);
+#endif
+}
+
+#endif /* SIMD_H_ */
@@ -9,6 +9,7 @@
 #define STATEMACHINE_H_
 
 #include "sonLib.h"
+#include "simd.h"
 
 #define SYMBOL_NUMBER 5
 #define SYMBOL_NUMBER_NO_N 4
@@ -21,6 +22,22 @@ typedef enum {
     n=4
 } Symbol;
 
+//Symbols as they are stored in symbol strings (see SymbolString in pairwiseAligner.h), one byte each.
+typedef uint8_t PackedSymbol;
+
+/*
+ * A run of cells of a dp diagonal. Diagonals store their cells state by state (see DpDiagonal), so the value of state s
+ * of cell i of the run is values[s * stateStride + i]. values is NULL for a run outside of the diagonal.
+ */
+typedef struct _dpCells {
+    DpValue *values;
+    int64_t stateStride;
+} DpCells;
+
+static inline DpValue *dpCells_getValue(DpCells cells, int64_t cell, int64_t state) {
+    return cells.values + state * cells.stateStride + cell;
+}
+
 /*
  * The statemachine object for computing pairwise alignments with.
  */
@@ -34,6 +51,13 @@ typedef enum {
 
 typedef struct _stateMachine StateMachine;
 
+//Which sequences a state emits from: both (a match), only x (a gap in y) or only y (a gap in x)
+typedef enum {
+    matchEmission=0,
+    gapXEmission=1,
+    gapYEmission=2
+} StateEmission;
+
 struct _stateMachine {
     StateMachineType type;
     int64_t stateNumber;
@@ -48,8 +72,55 @@ struct _stateMachine {
     double (*raggedStartStateProb)(StateMachine *sM, int64_t state);
 
     //Cells (states at a given coordinate(
-    void (*cellCalculate)(StateMachine *sM, double *current, double *lower, double *middle, double *upper, Symbol cX, Symbol cY,
+    //A cell is an array of stateNumber DpValues (see simd.h). The calculations are done in double precision, on copies of
+    //the cells if DpValue is float, so doTransition is given double precision cells.
+    void (*cellCalculate)(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle, DpValue *upper, Symbol cX, Symbol cY,
             void(*doTransition)(double *, double *, int64_t, int64_t, double, double, void *), void *extraArgs);
+
+    //Versions of cellCalculate specialised to the forward, backward and expectation transitions, which are inlined.
+    //For cellCalculateUpdateExpectations extraArgs is { double *totalProbability, Hmm *hmmExpectations }.
+    void (*cellCalculateForward)(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle, DpValue *upper,
+            Symbol cX, Symbol cY, void *extraArgs);
+
+    void (*cellCalculateBackward)(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle, DpValue *upper,
+            Symbol cX, Symbol cY, void *extraArgs);
+
+    void (*cellCalculateUpdateExpectations)(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle, DpValue *upper,
+            Symbol cX, Symbol cY, void *extraArgs);
+
+    //The max-product version of cellCalculateForward, used for Viterbi alignment. Each state of the current cell takes the
+    //most probable of its transitions, and the state that transition comes from is written into the three bits from bit
+    //3 * state of the uint16_t that extraArgs points to.
+    void (*cellCalculateViterbi)(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle, DpValue *upper,
+            Symbol cX, Symbol cY, void *extraArgs);
+
+    //Diagonal kernels, doing the forward/backward calculation for a run of cellNumber consecutive cells of an x+y diagonal
+    //which all have lower, middle and upper cells. Cell i of the run is cell i of current (likewise for lower, middle
+    //and upper) and has x symbol cX[i] and y symbol cY[i], cY being read from the reversed y sequence so that both symbol runs are
+    //contiguous. The cells are computed SIMD_WIDTH at a time, so cellNumber must
+    //be a multiple of SIMD_WIDTH (see simd.h).
+    //extraArgs is passed on as for the cell calculations.
+    void (*diagonalCalculateForward)(StateMachine *sM, DpCells current, DpCells lower, DpCells middle, DpCells upper,
+            const PackedSymbol *cX, const PackedSymbol *cY, int64_t cellNumber, void *extraArgs);
+
+    void (*diagonalCalculateBackward)(StateMachine *sM, DpCells current, DpCells lower, DpCells middle, DpCells upper,
+            const PackedSymbol *cX, const PackedSymbol *cY, int64_t cellNumber, void *extraArgs);
+
+    //Versions of the forward/backward cell calculations and diagonal kernels for the scaled dp, in which cells hold
+    //probabilities rather than log probabilities, so transitions are multiply-adds rather than logAdds. extraArgs points
+    //to two doubles, factors by which the gap and match emission probabilities respectively are multiplied, which bring
+    //the cells of diagonals with different scales to a common scale (see dpMatrix_construct2).
+    void (*cellCalculateForwardScaled)(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle, DpValue *upper,
+            Symbol cX, Symbol cY, void *extraArgs);
+
+    void (*cellCalculateBackwardScaled)(StateMachine *sM, DpValue *current, DpValue *lower, DpValue *middle, DpValue *upper,
+            Symbol cX, Symbol cY, void *extraArgs);
+
+    void (*diagonalCalculateForwardScaled)(StateMachine *sM, DpCells current, DpCells lower, DpCells middle, DpCells upper,
+            const PackedSymbol *cX, const PackedSymbol *cY, int64_t cellNumber, void *extraArgs);
+
+    void (*diagonalCalculateBackwardScaled)(StateMachine *sM, DpCells current, DpCells lower, DpCells middle, DpCells upper,
+            const PackedSymbol *cX, const PackedSymbol *cY, int64_t cellNumber, void *extraArgs);
 };
 
 /*
@@ -86,12 +157,17 @@ void hmm_setEmissionsExpectation(Hmm *hmm, int64_t state, Symbol x, Symbol y, do
 
 Hmm *hmm_loadFromFile(const char *fileName);
 
+//Adds the expectations and likelihood of hmm2 to those of hmm, which must be of the same type.
+void hmm_addExpectations(Hmm *hmm, Hmm *hmm2);
+
 void hmm_normalise(Hmm *hmm);
 
 StateMachine *hmm_getStateMachine(Hmm *hmm);
 
 StateMachine *stateMachine5_construct(StateMachineType type);
 
+StateEmission stateMachine_getStateEmission(StateMachine *sM, int64_t state);
+
 StateMachine *stateMachine3_construct(StateMachineType type); //the type is to specify symmetric/asymmetric
 
 void stateMachine_destruct(StateMachine *stateMachine);
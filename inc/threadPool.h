@@ -0,0 +1,38 @@
+/*
+ * threadPool.h
+ *
+ *  A fixed set of threads which repeatedly run a function together, the caller
+ *  taking part as thread 0. Used to split the work of the dp between threads.
+ */
+
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <stdint.h>
+
+typedef struct _threadPool ThreadPool;
+
+//Constructs a pool of threadNumber threads, which must be at least 1. A pool of one thread runs everything in the caller.
+ThreadPool *threadPool_construct(int64_t threadNumber);
+
+void threadPool_destruct(ThreadPool *threadPool);
+
+int64_t threadPool_getThreadNumber(ThreadPool *threadPool);
+
+//Runs fn(args, thread, threadNumber) on every thread of the pool, thread being 0 to threadNumber - 1, and returns
+//once they have all returned. Runs of the same pool must not overlap, and fn must not run the pool itself.
+void threadPool_run(ThreadPool *threadPool, void (*fn)(void *args, int64_t thread, int64_t threadNumber), void *args);
+
+//As threadPool_run, but the caller takes no part, fn only being run on threads 1 to threadNumber - 1, and returns at
+//once, leaving the caller free to do other work until it calls threadPool_wait. The pool must have more than one thread.
+void threadPool_start(ThreadPool *threadPool, void (*fn)(void *args, int64_t thread, int64_t threadNumber), void *args);
+
+//Waits for the run started by threadPool_start to finish. Returns at once if no run is going.
+void threadPool_wait(ThreadPool *threadPool);
+
+//Runs fn(args, task, thread) for each task from 0 to taskNumber - 1, each thread of the pool taking the next task as it
+//finishes its last, so tasks of different sizes are balanced between the threads. Returns once all tasks are done.
+void threadPool_runTasks(ThreadPool *threadPool, int64_t taskNumber, void (*fn)(void *args, int64_t task, int64_t thread),
+        void *args);
+
+#endif /* THREADPOOL_H_ */
@@ -0,0 +1,162 @@
+/*
+ * Measures the throughput of aligning a batch of short pairs, as from short reads or amplicons, one by one, one by one
+ * with the diagonals of each pair split between threads, and with getAlignedPairArraysForBatch, which splits the pairs
+ * between the threads instead. Also reports the fraction of the SIMD lanes the diagonal kernels fill across the bands of
+ * the pairs, which is what aligning a pair per lane would be trying to improve on.
+ *
+ * It is a developer tool, built by "make batchBenchmark" rather than by "make all", for example:
+ *
+ *     cPecanBatchBenchmark --pairNumber 2000 --length 150 --threadNumber 4
+ */
+
+#define _XOPEN_SOURCE 500
+
+#include <getopt.h>
+#include <stdio.h>
+#include <sys/time.h>
+
+#include "sonLib.h"
+#include "pairwiseAligner.h"
+#include "simd.h"
+#include "randomSequences.h"
+
+static void usage() {
+    fprintf(stderr, "cPecanBatchBenchmark [options]\n");
+    fprintf(stderr, "Reports the pairs aligned per second of a batch of random pairs aligned one by one and as a batch\n");
+    fprintf(stderr, "-a --logLevel : Set the log level\n");
+    fprintf(stderr, "-n --pairNumber : The number of pairs, default 1000\n");
+    fprintf(stderr, "-l --length : The length of the first sequence of each pair, the second being evolved from it, default 150\n");
+    fprintf(stderr, "-t --threadNumber : The number of threads, default 4\n");
+    fprintf(stderr, "-S --scaledProbabilities : Do the dp with scaled probabilities rather than log probabilities\n");
+    fprintf(stderr, "-h --help : Print this help screen\n");
+}
+
+static double getTime() {
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec + t.tv_usec / 1000000.0;
+}
+
+static double getLaneFraction(stList *sXs, stList *sYs, PairwiseAlignmentParameters *p) {
+    /*
+     * Returns the fraction of the SIMD lanes filled by the cells of the unanchored bands of the pairs, each diagonal
+     * being computed in chunks of SIMD_WIDTH cells.
+     */
+    int64_t cells = 0, lanes = 0;
+    stList *anchorPairs = stList_construct();
+    for (int64_t i = 0; i < stList_length(sXs); i++) {
+        int64_t lX = strlen(stList_get(sXs, i)), lY = strlen(stList_get(sYs, i));
+        Band *band = band_construct(anchorPairs, lX, lY, p->diagonalExpansion);
+        BandIterator *bandIterator = bandIterator_construct(band);
+        for (int64_t xay = 0; xay <= lX + lY; xay++) {
+            int64_t width = diagonal_getWidth(bandIterator_getNext(bandIterator));
+            cells += width;
+            lanes += (width + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+        }
+        bandIterator_destruct(bandIterator);
+        band_destruct(band);
+    }
+    stList_destruct(anchorPairs);
+    return lanes > 0 ? (double) cells / lanes : 1.0;
+}
+
+static double alignOneByOne(StateMachine *sM, stList *sXs, stList *sYs, PairwiseAlignmentParameters *p) {
+    stList *anchorPairs = stList_construct();
+    double startTime = getTime();
+    for (int64_t i = 0; i < stList_length(sXs); i++) {
+        alignedPairArray_destruct(getAlignedPairArrayUsingAnchors(sM, stList_get(sXs, i), stList_get(sYs, i),
+                anchorPairs, p, 0, 0));
+    }
+    double time = getTime() - startTime;
+    stList_destruct(anchorPairs);
+    return time;
+}
+
+static double alignBatch(StateMachine *sM, stList *sXs, stList *sYs, PairwiseAlignmentParameters *p) {
+    double startTime = getTime();
+    stList *alignedPairs = getAlignedPairArraysForBatch(sM, sXs, sYs, NULL, p, 0, 0);
+    double time = getTime() - startTime;
+    stList_destruct(alignedPairs);
+    return time;
+}
+
+int main(int argc, char *argv[]) {
+    char *logLevelString = NULL;
+    int64_t pairNumber = 1000, length = 150, threadNumber = 4;
+    bool scaledProbabilities = 0;
+
+    while (1) {
+        static struct option long_options[] = { { "logLevel", required_argument, 0, 'a' }, { "pairNumber",
+                required_argument, 0, 'n' }, { "length", required_argument, 0, 'l' }, { "threadNumber", required_argument,
+                0, 't' }, { "scaledProbabilities", no_argument, 0, 'S' }, { "help", no_argument, 0, 'h' }, { 0, 0, 0, 0 } };
+
+        int option_index = 0;
+
+        int key = getopt_long(argc, argv, "a:n:l:t:Sh", long_options, &option_index);
+
+        if (key == -1) {
+            break;
+        }
+
+        switch (key) {
+            case 'a':
+                logLevelString = stString_copy(optarg);
+                st_setLogLevelFromString(logLevelString);
+                break;
+            case 'n':
+                pairNumber = atol(optarg);
+                break;
+            case 'l':
+                length = atol(optarg);
+                break;
+            case 't':
+                threadNumber = atol(optarg);
+                break;
+            case 'S':
+                scaledProbabilities = 1;
+                break;
+            case 'h':
+                usage();
+                return 0;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    if (pairNumber < 1 || length < 1 || threadNumber < 1) {
+        st_errAbort("The pair number, length and thread number must be positive");
+    }
+
+    stList *sXs = stList_construct3(0, free);
+    stList *sYs = stList_construct3(0, free);
+    for (int64_t i = 0; i < pairNumber; i++) {
+        char *sX = getRandomSequence(length);
+        stList_append(sYs, evolveSequence(sX));
+        stList_append(sXs, sX);
+    }
+    StateMachine *sM = stateMachine5_construct(fiveState);
+    PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+    p->scaledProbabilities = scaledProbabilities;
+
+    fprintf(stdout, "%" PRIi64 " pairs of length %" PRIi64 ", SIMD width %i, SIMD lanes filled %.3f\n", pairNumber,
+            length, SIMD_WIDTH, getLaneFraction(sXs, sYs, p));
+    p->threadNumber = 1;
+    double time = alignOneByOne(sM, sXs, sYs, p);
+    fprintf(stdout, "One by one: %.3f seconds, %.1f pairs/second\n", time, pairNumber / time);
+    p->threadNumber = threadNumber;
+    time = alignOneByOne(sM, sXs, sYs, p);
+    fprintf(stdout, "One by one, diagonals split between %" PRIi64 " threads: %.3f seconds, %.1f pairs/second\n",
+            threadNumber, time, pairNumber / time);
+    time = alignBatch(sM, sXs, sYs, p);
+    fprintf(stdout, "Batch, pairs split between %" PRIi64 " threads: %.3f seconds, %.1f pairs/second\n", threadNumber,
+            time, pairNumber / time);
+
+    //Cleanup
+    pairwiseAlignmentBandingParameters_destruct(p);
+    stateMachine_destruct(sM);
+    stList_destruct(sXs);
+    stList_destruct(sYs);
+    free(logLevelString);
+
+    return 0;
+}
@@ -11,6 +11,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <ctype.h>
+#include <time.h>
 #include "randomSequences.h"
 
 static void test_diagonal(CuTest *testCase) {
@@ -142,6 +144,34 @@ static void test_logAdd(CuTest *testCase) {
     }
 }
 
+static void test_logAddPrecisions(CuTest *testCase) {
+    //Checks the error of each logAdd precision and that their SIMD versions give exactly the scalar results.
+    //The arguments are taken from a fixed grid, rather than st_random, so as not to disturb the random numbers seen by later tests.
+    double x[SIMD_WIDTH], y[SIMD_WIDTH], z[SIMD_WIDTH], w[SIMD_WIDTH];
+    for (int64_t test = 0; test < 100000; test++) {
+        for (int64_t i = 0; i < SIMD_WIDTH; i++) {
+            int64_t j = test * SIMD_WIDTH + i;
+            x[i] = -(j % 997) * 0.1;
+            y[i] = j % 37 == 0 ? LOG_ZERO : x[i] + ((j % 8009) / 8009.0 - 0.5) * 80;
+            x[i] = j % 41 == 0 ? LOG_ZERO : x[i];
+        }
+        simd_store(z, simd_logAddInterpolated(simd_load(x), simd_load(y)));
+        simd_store(w, simd_logAddPrecise(simd_load(x), simd_load(y)));
+        for (int64_t i = 0; i < SIMD_WIDTH; i++) {
+            CuAssertTrue(testCase, z[i] == logAdd_interpolated(x[i], y[i]));
+            CuAssertTrue(testCase, w[i] == logAdd_precise(x[i], y[i]));
+            if (x[i] == LOG_ZERO && y[i] == LOG_ZERO) {
+                CuAssertTrue(testCase, z[i] == LOG_ZERO && w[i] == LOG_ZERO);
+                continue;
+            }
+            double mx = x[i] > y[i] ? x[i] : y[i], mn = x[i] > y[i] ? y[i] : x[i];
+            double exact = mx + log1p(exp(mn - mx));
+            CuAssertDblEquals(testCase, exact, z[i], 0.001);
+            CuAssertDblEquals(testCase, exact, w[i], 1e-12);
+        }
+    }
+}
+
 static void test_symbol(CuTest *testCase) {
     Symbol cA[9] = { a, c, g, t, n, t, n, c, g };
     Symbol *cA2 = symbol_convertStringToSymbols("AcGTntNCG", 9);
@@ -151,10 +181,32 @@ static void test_symbol(CuTest *testCase) {
     free(cA2);
 }
 
+static void test_symbolString(CuTest *testCase) {
+    Symbol cA[9] = { a, c, g, t, n, t, n, c, g };
+    SymbolString s = symbolString_construct("AcGTntNCG", 9);
+    CuAssertIntEquals(testCase, 9, s.length);
+    for (int64_t i = 0; i < 9; i++) {
+        CuAssertTrue(testCase, cA[i] == s.sequence[i]);
+        CuAssertTrue(testCase, cA[i] == s.reversedSequence[8 - i]);
+    }
+    //Sub strings are views of the same symbols
+    for (int64_t start = 0; start <= 9; start++) {
+        for (int64_t length = 0; start + length <= 9; length++) {
+            SymbolString s2 = symbolString_getSubString(s, start, length);
+            CuAssertIntEquals(testCase, length, s2.length);
+            for (int64_t i = 0; i < length; i++) {
+                CuAssertTrue(testCase, s2.sequence[i] == s.sequence[start + i]);
+                CuAssertTrue(testCase, s2.reversedSequence[length - 1 - i] == s.sequence[start + i]);
+            }
+        }
+    }
+    symbolString_destruct(s);
+}
+
 static void test_cell(CuTest *testCase) {
     StateMachine *sM = stateMachine5_construct(fiveState);
-    double lowerF[sM->stateNumber], middleF[sM->stateNumber], upperF[sM->stateNumber], currentF[sM->stateNumber];
-    double lowerB[sM->stateNumber], middleB[sM->stateNumber], upperB[sM->stateNumber], currentB[sM->stateNumber];
+    DpValue lowerF[sM->stateNumber], middleF[sM->stateNumber], upperF[sM->stateNumber], currentF[sM->stateNumber];
+    DpValue lowerB[sM->stateNumber], middleB[sM->stateNumber], upperB[sM->stateNumber], currentB[sM->stateNumber];
     for (int64_t i = 0; i < sM->stateNumber; i++) {
         middleF[i] = sM->startStateProb(sM, i);
         middleB[i] = LOG_ZERO;
@@ -180,26 +232,81 @@ static void test_cell(CuTest *testCase) {
     CuAssertDblEquals(testCase, totalProbForward, totalProbBackward, 0.00001); //Check the forward and back probabilities are about equal
 }
 
+static void doTransitionForwardUnfused(double *fromCells, double *toCells, int64_t from, int64_t to, double eP, double tP,
+        void *extraArgs) {
+    toCells[to] = logAdd(toCells[to], fromCells[from] + (eP + tP));
+}
+
+static void test_cellFusedTransitions(CuTest *testCase) {
+    //Checks the forward cell calculations, which use the transitions with their emissions included, give exactly the
+    //same cells as adding the emissions to the transitions, for every pair of symbols.
+    StateMachine *sMs[2] = { stateMachine5_construct(fiveState), stateMachine3_construct(threeState) };
+    for (int64_t i = 0; i < 2; i++) {
+        StateMachine *sM = sMs[i];
+        for (Symbol cX = 0; cX < SYMBOL_NUMBER; cX++) {
+            for (Symbol cY = 0; cY < SYMBOL_NUMBER; cY++) {
+                DpValue cells[2][4][sM->stateNumber];
+                for (int64_t j = 0; j < 4; j++) {
+                    for (int64_t s = 0; s < sM->stateNumber; s++) {
+                        cells[0][j][s] = cells[1][j][s] = -st_random() * 10;
+                    }
+                }
+                sM->cellCalculateForward(sM, cells[0][0], cells[0][1], cells[0][2], cells[0][3], cX, cY, NULL);
+                sM->cellCalculate(sM, cells[1][0], cells[1][1], cells[1][2], cells[1][3], cX, cY,
+                        doTransitionForwardUnfused, NULL);
+                for (int64_t s = 0; s < sM->stateNumber; s++) {
+                    CuAssertDblEquals(testCase, cells[1][0][s], cells[0][0][s], 0.0);
+                }
+            }
+        }
+        stateMachine_destruct(sM);
+    }
+}
+
+static DpValue *getCellValues(DpDiagonal *dpDiagonal, int64_t xmy, DpValue *cell, int64_t stateNumber) {
+    //Copies the states of the given cell into cell, returning NULL if the cell is outside the diagonal.
+    DpCells cells = dpDiagonal == NULL ? (DpCells) { NULL, 0 } : dpDiagonal_getCell(dpDiagonal, xmy);
+    if (cells.values == NULL) {
+        return NULL;
+    }
+    for (int64_t i = 0; i < stateNumber; i++) {
+        cell[i] = *dpCells_getValue(cells, 0, i);
+    }
+    return cell;
+}
+
+static void setCellValues(DpDiagonal *dpDiagonal, int64_t xmy, DpValue *cell, int64_t stateNumber) {
+    DpCells cells = dpDiagonal_getCell(dpDiagonal, xmy);
+    for (int64_t i = 0; i < stateNumber; i++) {
+        *dpCells_getValue(cells, 0, i) = cell[i];
+    }
+}
+
 static void test_dpDiagonal(CuTest *testCase) {
     StateMachine *sM = stateMachine5_construct(fiveState);
     Diagonal diagonal = diagonal_construct(3, -1, 1);
     DpDiagonal *dpDiagonal = dpDiagonal_construct(diagonal, sM->stateNumber);
 
     //Get cell
-    double *c1 = dpDiagonal_getCell(dpDiagonal, -1);
-    CuAssertTrue(testCase, c1 != NULL);
-    double *c2 = dpDiagonal_getCell(dpDiagonal, 1);
-    CuAssertTrue(testCase, c2 != NULL);
-    CuAssertTrue(testCase, dpDiagonal_getCell(dpDiagonal, 3) == NULL);
-    CuAssertTrue(testCase, dpDiagonal_getCell(dpDiagonal, -3) == NULL);
+    DpCells c1 = dpDiagonal_getCell(dpDiagonal, -1);
+    CuAssertTrue(testCase, c1.values != NULL);
+    DpCells c2 = dpDiagonal_getCell(dpDiagonal, 1);
+    CuAssertTrue(testCase, c2.values != NULL);
+    CuAssertTrue(testCase, dpDiagonal_getCell(dpDiagonal, 3).values == NULL);
+    CuAssertTrue(testCase, dpDiagonal_getCell(dpDiagonal, -3).values == NULL);
+    //The states of a cell are in separate planes
+    CuAssertTrue(testCase, dpCells_getValue(c2, 0, 0) == dpCells_getValue(c1, 1, 0));
+    CuAssertTrue(testCase, dpCells_getValue(c1, 0, 1) - dpCells_getValue(c1, 0, 0) >= 2);
+    CuAssertTrue(testCase, (uintptr_t) dpCells_getValue(c1, 0, 0) % 64 == 0);
+    CuAssertTrue(testCase, (uintptr_t) dpCells_getValue(c1, 0, 1) % 64 == 0);
 
     dpDiagonal_initialiseValues(dpDiagonal, sM, sM->endStateProb); //Test initialise values
     double totalProb = LOG_ZERO;
     for (int64_t i = 0; i < sM->stateNumber; i++) {
-        CuAssertDblEquals(testCase, c1[i], sM->endStateProb(sM, i), 0.0);
-        CuAssertDblEquals(testCase, c2[i], sM->endStateProb(sM, i), 0.0);
-        totalProb = logAdd(totalProb, 2 * c1[i]);
-        totalProb = logAdd(totalProb, 2 * c2[i]);
+        CuAssertDblEquals(testCase, *dpCells_getValue(c1, 0, i), (DpValue) sM->endStateProb(sM, i), 0.0);
+        CuAssertDblEquals(testCase, *dpCells_getValue(c2, 0, i), (DpValue) sM->endStateProb(sM, i), 0.0);
+        totalProb = logAdd(totalProb, 2 * *dpCells_getValue(c1, 0, i));
+        totalProb = logAdd(totalProb, 2 * *dpCells_getValue(c2, 0, i));
     }
 
     DpDiagonal *dpDiagonal2 = dpDiagonal_clone(dpDiagonal);
@@ -235,6 +342,32 @@ static void test_dpMatrix(CuTest *testCase) {
 
     CuAssertIntEquals(testCase, dpMatrix_getActiveDiagonalNumber(dpMatrix), 0);
 
+    //Recreate the diagonals in the opposite order, so they reuse the memory of deleted diagonals of other widths
+    for (int64_t i = lX + lY; i >= 0; i--) {
+        DpDiagonal *dpDiagonal = dpMatrix_createDiagonal(dpMatrix, diagonal_construct(i, -i, i));
+        CuAssertTrue(testCase, dpDiagonal == dpMatrix_getDiagonal(dpMatrix, i));
+        CuAssertTrue(testCase, dpDiagonal_getCell(dpDiagonal, -i - 2).values == NULL);
+        CuAssertTrue(testCase, dpDiagonal_getCell(dpDiagonal, i + 2).values == NULL);
+        for (int64_t xmy = -i; xmy <= i; xmy += 2) {
+            DpCells cell = dpDiagonal_getCell(dpDiagonal, xmy);
+            CuAssertTrue(testCase, cell.values != NULL);
+            for (int64_t j = 0; j < 5; j++) {
+                *dpCells_getValue(cell, 0, j) = i * 100 + xmy * 5 + j;
+            }
+        }
+    }
+    for (int64_t i = 0; i <= lX + lY; i++) {
+        DpDiagonal *dpDiagonal = dpMatrix_getDiagonal(dpMatrix, i);
+        for (int64_t xmy = -i; xmy <= i; xmy += 2) {
+            for (int64_t j = 0; j < 5; j++) {
+                CuAssertDblEquals(testCase, i * 100 + xmy * 5 + j, *dpCells_getValue(dpDiagonal_getCell(dpDiagonal, xmy), 0, j), 0.0);
+            }
+        }
+        dpMatrix_deleteDiagonal(dpMatrix, i);
+    }
+
+    CuAssertIntEquals(testCase, dpMatrix_getActiveDiagonalNumber(dpMatrix), 0);
+
     dpMatrix_destruct(dpMatrix);
 }
 
@@ -278,9 +411,12 @@ static void test_diagonalDPCalculations(CuTest *testCase) {
     }
 
     //Calculate total probabilities
+    DpValue cellForward[sM->stateNumber], cellBackward[sM->stateNumber];
     double totalProbForward = cell_dotProduct2(
-            dpDiagonal_getCell(dpMatrix_getDiagonal(dpMatrixForward, lX + lY), lX - lY), sM, sM->endStateProb);
-    double totalProbBackward = cell_dotProduct2(dpDiagonal_getCell(dpMatrix_getDiagonal(dpMatrixBackward, 0), 0), sM,
+            getCellValues(dpMatrix_getDiagonal(dpMatrixForward, lX + lY), lX - lY, cellForward, sM->stateNumber), sM,
+            sM->endStateProb);
+    double totalProbBackward = cell_dotProduct2(
+            getCellValues(dpMatrix_getDiagonal(dpMatrixBackward, 0), 0, cellBackward, sM->stateNumber), sM,
             sM->startStateProb);
     st_logInfo("Total forward and backward prob %f %f\n", (float) totalProbForward, (float) totalProbBackward);
 
@@ -366,6 +502,97 @@ static void checkAlignedPairs(CuTest *testCase, stList *blastPairs, int64_t lX,
     stSortedSet_destruct(pairs);
 }
 
+static void diagonalCalculationCellByCell(StateMachine *sM, DpMatrix *dpMatrix, int64_t xay, SymbolString sX, SymbolString sY,
+        void (*cellCalculation)(StateMachine *, DpValue *, DpValue *, DpValue *, DpValue *, Symbol, Symbol, void *)) {
+    //Reference calculation, one cell at a time.
+    DpDiagonal *dpDiagonal = dpMatrix_getDiagonal(dpMatrix, xay);
+    DpDiagonal *dpDiagonalM1 = dpMatrix_getDiagonal(dpMatrix, xay - 1);
+    DpDiagonal *dpDiagonalM2 = dpMatrix_getDiagonal(dpMatrix, xay - 2);
+    DpValue cells[4][sM->stateNumber];
+    for (int64_t xmy = -xay; xmy <= xay; xmy += 2) {
+        DpValue *current = getCellValues(dpDiagonal, xmy, cells[0], sM->stateNumber);
+        if (current == NULL) { //Outside of the band
+            continue;
+        }
+        DpValue *lower = getCellValues(dpDiagonalM1, xmy - 1, cells[1], sM->stateNumber);
+        DpValue *middle = getCellValues(dpDiagonalM2, xmy, cells[2], sM->stateNumber);
+        DpValue *upper = getCellValues(dpDiagonalM1, xmy + 1, cells[3], sM->stateNumber);
+        int64_t x = diagonal_getXCoordinate(xay, xmy), y = diagonal_getYCoordinate(xay, xmy);
+        cellCalculation(sM, current, lower, middle, upper, x > 0 ? sX.sequence[x - 1] : n,
+                y > 0 ? sY.sequence[y - 1] : n, NULL);
+        setCellValues(dpDiagonal, xmy, current, sM->stateNumber);
+        if (lower != NULL) { //The backward calculation updates the previous diagonal
+            setCellValues(dpDiagonalM1, xmy - 1, lower, sM->stateNumber);
+        }
+        if (middle != NULL) {
+            setCellValues(dpDiagonalM2, xmy, middle, sM->stateNumber);
+        }
+        if (upper != NULL) {
+            setCellValues(dpDiagonalM1, xmy + 1, upper, sM->stateNumber);
+        }
+    }
+}
+
+static void test_diagonalCalculationKernels(CuTest *testCase) {
+    //Checks the forward and backward calculations, which use the state machines' diagonal kernels, give exactly
+    //the same matrices as the cell by cell calculation.
+    for (int64_t test = 0; test < 100; test++) {
+        char *sX = getRandomSequence(st_randomInt(0, 100));
+        char *sY = evolveSequence(sX);
+        int64_t lX = strlen(sX), lY = strlen(sY);
+        SymbolString sX2 = symbolString_construct(sX, lX);
+        SymbolString sY2 = symbolString_construct(sY, lY);
+        StateMachine *sM = test % 2 ? stateMachine5_construct(fiveState) : stateMachine3_construct(threeState);
+        stList *anchorPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
+        for (int64_t x = st_randomInt(0, 20), y = st_randomInt(0, 20); x < lX && y < lY; x += st_randomInt(1, 20), y += st_randomInt(1, 20)) {
+            stList_append(anchorPairs, stIntTuple_construct2(x, y));
+        }
+        Band *band = band_construct(anchorPairs, lX, lY, st_randomInt(0, 10) * 2);
+        BandIterator *bandIt = bandIterator_construct(band);
+        DpMatrix *dpMatrices[4];
+        for (int64_t j = 0; j < 4; j++) {
+            dpMatrices[j] = dpMatrix_construct(lX + lY, sM->stateNumber);
+        }
+        for (int64_t i = 0; i <= lX + lY; i++) {
+            Diagonal d = bandIterator_getNext(bandIt);
+            for (int64_t j = 0; j < 4; j++) {
+                dpDiagonal_zeroValues(dpMatrix_createDiagonal(dpMatrices[j], d));
+            }
+        }
+        dpDiagonal_initialiseValues(dpMatrix_getDiagonal(dpMatrices[0], 0), sM, sM->startStateProb);
+        dpDiagonal_initialiseValues(dpMatrix_getDiagonal(dpMatrices[1], 0), sM, sM->startStateProb);
+        dpDiagonal_initialiseValues(dpMatrix_getDiagonal(dpMatrices[2], lX + lY), sM, sM->endStateProb);
+        dpDiagonal_initialiseValues(dpMatrix_getDiagonal(dpMatrices[3], lX + lY), sM, sM->endStateProb);
+        for (int64_t i = 1; i <= lX + lY; i++) {
+            diagonalCalculationForward(sM, i, dpMatrices[0], sX2, sY2);
+            diagonalCalculationCellByCell(sM, dpMatrices[1], i, sX2, sY2, cell_calculateForward);
+        }
+        for (int64_t i = lX + lY; i > 0; i--) {
+            diagonalCalculationBackward(sM, i, dpMatrices[2], sX2, sY2);
+            diagonalCalculationCellByCell(sM, dpMatrices[3], i, sX2, sY2, cell_calculateBackward);
+        }
+        for (int64_t i = 0; i <= lX + lY; i++) {
+            CuAssertTrue(testCase, dpDiagonal_equals(dpMatrix_getDiagonal(dpMatrices[0], i), dpMatrix_getDiagonal(dpMatrices[1], i)));
+            CuAssertTrue(testCase, dpDiagonal_equals(dpMatrix_getDiagonal(dpMatrices[2], i), dpMatrix_getDiagonal(dpMatrices[3], i)));
+        }
+        //Cleanup
+        for (int64_t j = 0; j < 4; j++) {
+            for (int64_t i = 0; i <= lX + lY; i++) {
+                dpMatrix_deleteDiagonal(dpMatrices[j], i);
+            }
+            dpMatrix_destruct(dpMatrices[j]);
+        }
+        bandIterator_destruct(bandIt);
+        band_destruct(band);
+        stList_destruct(anchorPairs);
+        stateMachine_destruct(sM);
+        symbolString_destruct(sX2);
+        symbolString_destruct(sY2);
+        free(sX);
+        free(sY);
+    }
+}
+
 static void test_getAlignedPairsWithBanding(CuTest *testCase) {
     for (int64_t test = 0; test < 100; test++) {
         //Make a pair of sequences
@@ -385,10 +612,12 @@ static void test_getAlignedPairsWithBanding(CuTest *testCase) {
         StateMachine *sM = stateMachine5_construct(fiveState);
         stList *anchorPairs = getRandomAnchorPairs(lX, lY);
 
-        stList *alignedPairs = stList_construct3(0, (void (*)(void *)) stIntTuple_destruct);
-        void *extraArgs[1] = { alignedPairs };
-        getPosteriorProbsWithBanding(sM, anchorPairs, sX2, sY2, p, 0, 0, diagonalCalculationPosteriorMatchProbs,
-                extraArgs);
+        AlignedPairArray *alignedPairArray = alignedPairArray_construct();
+        void *extraArgs[1] = { alignedPairArray };
+        getPosteriorProbsWithBanding(sM, anchorPairs, sX2, sY2, p, 0, 0,
+                diagonalCalculationPosteriorMatchProbsToArray, extraArgs);
+        stList *alignedPairs = alignedPairArray_getList(alignedPairArray);
+        alignedPairArray_destruct(alignedPairArray);
         //Check the aligned pairs.
         //Check the aligned pairs.
         checkAlignedPairs(testCase, alignedPairs, lX, lY);
@@ -397,12 +626,314 @@ static void test_getAlignedPairsWithBanding(CuTest *testCase) {
         stateMachine_destruct(sM);
         free(sX);
         free(sY);
-        free(sX2.sequence);
-        free(sY2.sequence);
+        symbolString_destruct(sX2);
+        symbolString_destruct(sY2);
         stList_destruct(alignedPairs);
     }
 }
 
+static int64_t getPairScore(stList *alignedPairs, int64_t x, int64_t y) {
+    for (int64_t i = 0; i < stList_length(alignedPairs); i++) {
+        stIntTuple *pair = stList_get(alignedPairs, i);
+        if (stIntTuple_get(pair, 1) == x && stIntTuple_get(pair, 2) == y) {
+            return stIntTuple_get(pair, 0);
+        }
+    }
+    return -1;
+}
+
+static bool checkWithin(CuTest *testCase, bool strict, double expected, double actual, double tolerance) {
+    //If strict asserts actual is within tolerance of expected, else returns if it is.
+    if (strict) {
+        CuAssertDblEquals(testCase, expected, actual, tolerance);
+    }
+    return fabs(expected - actual) <= tolerance;
+}
+
+static bool checkPairScoresAgree(CuTest *testCase, bool strict, stList *alignedPairs, stList *alignedPairs2,
+        double threshold, double tolerance) {
+    //Each pair in alignedPairs must have about the same score in alignedPairs2, or, if missing, be near the threshold.
+    bool agree = 1;
+    for (int64_t i = 0; i < stList_length(alignedPairs); i++) {
+        stIntTuple *pair = stList_get(alignedPairs, i);
+        int64_t score = getPairScore(alignedPairs2, stIntTuple_get(pair, 1), stIntTuple_get(pair, 2));
+        agree &= checkWithin(testCase, strict, score == -1 ? threshold : (double) score / PAIR_ALIGNMENT_PROB_1,
+                (double) stIntTuple_get(pair, 0) / PAIR_ALIGNMENT_PROB_1, tolerance);
+    }
+    return agree;
+}
+
+static int64_t checkVariantAgrees(CuTest *testCase, int64_t maxLength,
+        void (*configureVariant)(PairwiseAlignmentParameters *p, int64_t test, int64_t variant), double tolerance,
+        int64_t maxDisagreeingAlignments) {
+    /*
+     * Checks random alignments of sequences up to maxLength long give the same posterior match probabilities and
+     * expectations with the parameters of variant 0 and of variant 1. configureVariant is called on the same parameters
+     * with variant 0 and then 1, so what it sets for variant 0 alone is shared. If tolerance is 0 the results must be
+     * exactly the same, else each posterior and expected transition must agree within it, and the likelihood within a
+     * tenth of it. For a variant that is only a heuristic, up to maxDisagreeingAlignments of the 50 alignments may
+     * disagree. Returns the number of the alignments split into regions by large gaps, see getSplitPoints, with the
+     * parameters of variant 1.
+     */
+    assert(tolerance > 0.0 || maxDisagreeingAlignments == 0);
+    bool strict = maxDisagreeingAlignments == 0;
+    int64_t splitAlignments = 0, disagreeingAlignments = 0;
+    for (int64_t test = 0; test < 50; test++) {
+        char *sX = getRandomSequence(st_randomInt(0, maxLength));
+        char *sY = evolveSequence(sX);
+        int64_t lX = strlen(sX);
+        int64_t lY = strlen(sY);
+        StateMachine *sM = test % 2 ? stateMachine5_construct(fiveState) : stateMachine3_construct(threeState);
+        PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+        p->diagonalExpansion = st_randomInt(10, 50) * 2;
+        p->scaledProbabilities = test % 4 < 2;
+        stList *anchorPairs = test % 3 == 1 ? stList_construct() : getRandomAnchorPairs(lX, lY);
+        bool raggedLeftEnd = test % 3 == 0, raggedRightEnd = test % 5 == 0;
+        stList *alignedPairs[2];
+        Hmm *expectations[2];
+        for (int64_t variant = 0; variant < 2; variant++) {
+            configureVariant(p, test, variant);
+            alignedPairs[variant] = getAlignedPairsUsingAnchors(sM, sX, sY, anchorPairs, p, raggedLeftEnd, raggedRightEnd);
+            checkAlignedPairs(testCase, alignedPairs[variant], lX, lY);
+            expectations[variant] = hmm_constructEmpty(0.0, sM->type);
+            getExpectationsUsingAnchors(sM, expectations[variant], sX, sY, anchorPairs, p, raggedLeftEnd, raggedRightEnd);
+        }
+        stList *splitPoints = getSplitPoints(anchorPairs, lX, lY, p->splitMatrixBiggerThanThis, raggedLeftEnd, raggedRightEnd);
+        splitAlignments += stList_length(splitPoints) > 1;
+        stList_destruct(splitPoints);
+        bool agree = 1;
+        if (tolerance == 0.0) {
+            CuAssertIntEquals(testCase, stList_length(alignedPairs[0]), stList_length(alignedPairs[1]));
+            for (int64_t i = 0; i < stList_length(alignedPairs[0]); i++) {
+                CuAssertTrue(testCase, stIntTuple_equalsFn(stList_get(alignedPairs[0], i), stList_get(alignedPairs[1], i)));
+            }
+        } else {
+            agree &= checkPairScoresAgree(testCase, strict, alignedPairs[0], alignedPairs[1], p->threshold, tolerance);
+            agree &= checkPairScoresAgree(testCase, strict, alignedPairs[1], alignedPairs[0], p->threshold, tolerance);
+        }
+        agree &= checkWithin(testCase, strict, expectations[0]->likelihood, expectations[1]->likelihood,
+                0.1 * tolerance * (fabs(expectations[0]->likelihood) + 1.0));
+        for (int64_t from = 0; from < sM->stateNumber; from++) {
+            for (int64_t to = 0; to < sM->stateNumber; to++) {
+                double e = hmm_getTransition(expectations[0], from, to);
+                agree &= checkWithin(testCase, strict, e, hmm_getTransition(expectations[1], from, to),
+                        tolerance * (e + 1.0));
+            }
+        }
+        disagreeingAlignments += !agree;
+        //Cleanup
+        for (int64_t variant = 0; variant < 2; variant++) {
+            stList_destruct(alignedPairs[variant]);
+            hmm_destruct(expectations[variant]);
+        }
+        stList_destruct(anchorPairs);
+        pairwiseAlignmentBandingParameters_destruct(p);
+        stateMachine_destruct(sM);
+        free(sX);
+        free(sY);
+    }
+    st_logInfo("%" PRIi64 " of the alignments disagree\n", disagreeingAlignments);
+    CuAssertTrue(testCase, disagreeingAlignments <= maxDisagreeingAlignments);
+    return splitAlignments;
+}
+
+static void checkVariantPrunes(CuTest *testCase, int64_t maxLength,
+        void (*configureVariant)(PairwiseAlignmentParameters *p, int64_t test, int64_t variant), double maxCellFraction) {
+    /*
+     * Checks the posteriors of random alignments of sequences up to maxLength long are calculated over no more cells
+     * with the parameters of variant 1 than with those of variant 0, and over at most maxCellFraction of them in all,
+     * so a variant meant to prune the dp does. With a threshold of 0 every cell the posteriors are calculated over
+     * gives a pair, so the cells are counted as the pairs.
+     */
+    int64_t cells[2] = { 0, 0 };
+    for (int64_t test = 0; test < 20; test++) {
+        char *sX = getRandomSequence(st_randomInt(0, maxLength));
+        char *sY = evolveSequence(sX);
+        int64_t lX = strlen(sX);
+        int64_t lY = strlen(sY);
+        StateMachine *sM = test % 2 ? stateMachine5_construct(fiveState) : stateMachine3_construct(threeState);
+        PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+        p->diagonalExpansion = st_randomInt(10, 50) * 2;
+        p->threshold = 0.0;
+        stList *anchorPairs = test % 3 == 1 ? stList_construct() : getRandomAnchorPairs(lX, lY);
+        int64_t alignmentCells[2];
+        for (int64_t variant = 0; variant < 2; variant++) {
+            configureVariant(p, test, variant);
+            stList *alignedPairs = getAlignedPairsUsingAnchors(sM, sX, sY, anchorPairs, p, 0, 0);
+            alignmentCells[variant] = stList_length(alignedPairs);
+            cells[variant] += alignmentCells[variant];
+            stList_destruct(alignedPairs);
+        }
+        CuAssertTrue(testCase, alignmentCells[1] <= alignmentCells[0]);
+        //Cleanup
+        stList_destruct(anchorPairs);
+        pairwiseAlignmentBandingParameters_destruct(p);
+        stateMachine_destruct(sM);
+        free(sX);
+        free(sY);
+    }
+    st_logInfo("The variant calculates the posteriors over %" PRIi64 " of %" PRIi64 " cells\n", cells[1], cells[0]);
+    CuAssertTrue(testCase, cells[1] <= maxCellFraction * cells[0]);
+}
+
+static void configureScaledProbabilities(PairwiseAlignmentParameters *p, int64_t test, int64_t variant) {
+    if (variant == 0) {
+        p->traceBackDiagonals = st_randomInt(1, 10);
+        p->minDiagsBetweenTraceBack = p->traceBackDiagonals + st_randomInt(2, 10);
+        p->diagonalExpansion = st_randomInt(0, 10) * 2;
+    }
+    p->scaledProbabilities = variant;
+}
+
+static void test_scaledProbabilities(CuTest *testCase) {
+    //Checks the posterior match probabilities and expectations computed by the scaled dp agree with those
+    //computed in log space, to within the error of the interpolated logAdd.
+    checkVariantAgrees(testCase, 200, configureScaledProbabilities, 0.01, 0);
+}
+
+static void configureThreadedProbabilities(PairwiseAlignmentParameters *p, int64_t test, int64_t variant) {
+    if (variant == 0) {
+        p->traceBackDiagonals = st_randomInt(1, 10);
+        p->minDiagsBetweenTraceBack = p->traceBackDiagonals + st_randomInt(2, 10);
+        p->minDiagonalCellsPerThread = st_randomInt(1, 10);
+    }
+    p->threadNumber = variant ? st_randomInt(2, 5) : 1;
+    p->pipelineTraceBacks = variant && test % 3 != 2;
+}
+
+static void test_threadedProbabilities(CuTest *testCase) {
+    //Checks splitting the diagonals of the dp between threads, and pipelining the tracebacks, gives exactly the
+    //posterior match probabilities and expectations of the unthreaded dp. The band is made wide and the minimum cells
+    //per thread small so most diagonals are split.
+    checkVariantAgrees(testCase, 300, configureThreadedProbabilities, 0.0, 0);
+}
+
+static void configureThreadedSplitRegions(PairwiseAlignmentParameters *p, int64_t test, int64_t variant) {
+    if (variant == 0) {
+        p->splitMatrixBiggerThanThis = st_randomInt(10, 1000);
+    }
+    p->threadNumber = variant ? st_randomInt(2, 5) : 1;
+}
+
+static void test_threadedSplitRegions(CuTest *testCase) {
+    //Checks aligning the regions split by large gaps at the same time gives exactly the aligned pairs of aligning them in
+    //turn, and the same expectations, up to the order they are summed in. The split size is made small so there are
+    //many regions.
+    CuAssertTrue(testCase, checkVariantAgrees(testCase, 500, configureThreadedSplitRegions, 1e-9, 0) > 0);
+}
+
+static void test_batchAlignments(CuTest *testCase) {
+    //Checks aligning a batch of pairs between threads gives exactly the aligned pairs of aligning each pair on its own,
+    //and the summed expectations, up to the order they are summed in, or exactly with one thread.
+    for (int64_t test = 0; test < 20; test++) {
+        StateMachine *sM = test % 2 ? stateMachine5_construct(fiveState) : stateMachine3_construct(threeState);
+        PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+        p->threadNumber = test % 4 == 0 ? 1 : st_randomInt(2, 5);
+        double tolerance = p->threadNumber == 1 ? 0.0 : 1e-9;
+        p->scaledProbabilities = test % 4 < 2;
+        bool anchored = test % 3 != 0;
+        bool raggedLeftEnd = test % 3 == 1, raggedRightEnd = test % 5 == 0;
+        int64_t pairNumber = st_randomInt(0, 30);
+        stList *sXs = stList_construct3(0, free);
+        stList *sYs = stList_construct3(0, free);
+        stList *anchorPairs = stList_construct3(0, (void (*)(void *)) stList_destruct);
+        for (int64_t i = 0; i < pairNumber; i++) {
+            char *sX = getRandomSequence(st_randomInt(0, 150));
+            char *sY = evolveSequence(sX);
+            stList_append(sXs, sX);
+            stList_append(sYs, sY);
+            stList_append(anchorPairs, anchored ? getRandomAnchorPairs(strlen(sX), strlen(sY)) : stList_construct());
+        }
+        stList *batchAlignedPairs = getAlignedPairArraysForBatch(sM, sXs, sYs, anchored ? anchorPairs : NULL, p,
+                raggedLeftEnd, raggedRightEnd);
+        Hmm *batchExpectations = hmm_constructEmpty(0.0, sM->type);
+        getExpectationsForBatch(sM, batchExpectations, sXs, sYs, anchored ? anchorPairs : NULL, p, raggedLeftEnd,
+                raggedRightEnd);
+        CuAssertIntEquals(testCase, pairNumber, stList_length(batchAlignedPairs));
+        p->threadNumber = 1;
+        Hmm *expectations = hmm_constructEmpty(0.0, sM->type);
+        for (int64_t i = 0; i < pairNumber; i++) {
+            AlignedPairArray *alignedPairs = getAlignedPairArrayUsingAnchors(sM, stList_get(sXs, i), stList_get(sYs, i),
+                    stList_get(anchorPairs, i), p, raggedLeftEnd, raggedRightEnd);
+            AlignedPairArray *alignedPairs2 = stList_get(batchAlignedPairs, i);
+            CuAssertIntEquals(testCase, alignedPairs->length, alignedPairs2->length);
+            for (int64_t j = 0; j < alignedPairs->length; j++) {
+                CuAssertIntEquals(testCase, alignedPairs->scores[j], alignedPairs2->scores[j]);
+                CuAssertIntEquals(testCase, alignedPairs->x[j], alignedPairs2->x[j]);
+                CuAssertIntEquals(testCase, alignedPairs->y[j], alignedPairs2->y[j]);
+            }
+            alignedPairArray_destruct(alignedPairs);
+            getExpectationsUsingAnchors(sM, expectations, stList_get(sXs, i), stList_get(sYs, i),
+                    stList_get(anchorPairs, i), p, raggedLeftEnd, raggedRightEnd);
+        }
+        CuAssertDblEquals(testCase, expectations->likelihood, batchExpectations->likelihood,
+                tolerance * (fabs(expectations->likelihood) + 1));
+        for (int64_t from = 0; from < sM->stateNumber; from++) {
+            for (int64_t to = 0; to < sM->stateNumber; to++) {
+                double e = hmm_getTransition(expectations, from, to);
+                CuAssertDblEquals(testCase, e, hmm_getTransition(batchExpectations, from, to), tolerance * (e + 1));
+            }
+        }
+        //Cleanup
+        hmm_destruct(expectations);
+        hmm_destruct(batchExpectations);
+        stList_destruct(batchAlignedPairs);
+        stList_destruct(anchorPairs);
+        stList_destruct(sXs);
+        stList_destruct(sYs);
+        pairwiseAlignmentBandingParameters_destruct(p);
+        stateMachine_destruct(sM);
+    }
+}
+
+static void configureAdaptiveBand(PairwiseAlignmentParameters *p, int64_t test, int64_t variant) {
+    p->adaptiveBandDrop = variant ? 25.0 : 0.0;
+}
+
+static void test_adaptiveBand(CuTest *testCase) {
+    //Checks pruning the band with a drop of 25 leaves out cells of the whole band, about a third of them for these
+    //alignments, and that the posterior match probabilities and expectations agree with those of the whole band, for
+    //alignments with and without anchors. Pruning is a heuristic: at this drop about 1 alignment in 600 loses the
+    //path it favours and its posteriors move by up to 1, see adaptiveBandDrop, so 2 of the 50 may disagree.
+    checkVariantPrunes(testCase, 300, configureAdaptiveBand, 0.9);
+    checkVariantAgrees(testCase, 300, configureAdaptiveBand, 0.01, 2);
+}
+
+static void configureBackwardBandDrop(PairwiseAlignmentParameters *p, int64_t test, int64_t variant) {
+    if (variant == 0) {
+        p->adaptiveBandDrop = test % 3 == 0 ? 25.0 : 0.0;
+        p->checkpointDiagonals = test % 5 == 0 ? -1 : 0;
+    }
+    p->backwardBandDrop = variant ? 25.0 : 0.0;
+}
+
+static void test_backwardBandDrop(CuTest *testCase) {
+    //Checks restricting the backward calculation to the cells within a forward drop of 25 leaves out cells of the
+    //band, about 30% of them for these alignments, and that the posterior match probabilities and expectations
+    //agree with those of the whole band, alone and with the band also pruned or checkpointed. The restriction is a
+    //heuristic: at this drop about 1 alignment in 1000 has its posteriors moved by up to 1, see backwardBandDrop, so
+    //2 of the 50 may disagree.
+    checkVariantPrunes(testCase, 300, configureBackwardBandDrop, 0.95);
+    checkVariantAgrees(testCase, 300, configureBackwardBandDrop, 0.01, 2);
+}
+
+static void configureCheckpointedProbabilities(PairwiseAlignmentParameters *p, int64_t test, int64_t variant) {
+    if (variant == 0) {
+        p->traceBackDiagonals = st_randomInt(1, 10);
+        p->minDiagsBetweenTraceBack = p->traceBackDiagonals + st_randomInt(2, 100);
+        p->diagonalExpansion = st_randomInt(0, 50) * 2;
+        p->adaptiveBandDrop = test % 3 == 0 ? 25.0 : 0.0;
+    }
+    p->checkpointDiagonals = variant ? (test % 5 == 0 ? -1 : st_randomInt(1, 20)) : 0;
+    p->pipelineTraceBacks = variant; //Ignored when checkpointing
+}
+
+static void test_checkpointedProbabilities(CuTest *testCase) {
+    //Checks keeping only checkpoints of the forward diagonals, and recomputing the rest in the traceback, gives exactly
+    //the posterior match probabilities and expectations of keeping them all.
+    checkVariantAgrees(testCase, 300, configureCheckpointedProbabilities, 0.0, 0);
+}
+
 static void checkBlastPairs(CuTest *testCase, stList *blastPairs, int64_t lX, int64_t lY, bool checkNonOverlapping) {
     st_logInfo("I got %" PRIi64 " pairs to check\n", stList_length(blastPairs));
     int64_t pX = -1;
@@ -452,6 +983,383 @@ static void test_getBlastPairs(CuTest *testCase) {
     }
 }
 
+static void test_getSeedAnchorPairs(CuTest *testCase) {
+    /*
+     * Test the in process equivalent of the blast heuristic.
+     */
+    for (int64_t test = 0; test < 10; test++) {
+        char *seqX = getRandomSequence(st_randomInt(0, 10000));
+        char *seqY = evolveSequence(seqX);
+        int64_t lX = strlen(seqX), lY = strlen(seqY);
+        int64_t trim = st_randomInt(0, 5);
+        bool repeatMask = st_random() > 0.5;
+        stList *anchorPairs = getSeedAnchorPairs(seqX, seqY, lX, lY, trim, repeatMask);
+        checkBlastPairs(testCase, anchorPairs, lX, lY, 1);
+        stList_destruct(anchorPairs);
+
+        //An upper case sequence against itself is anchored along the whole of the main diagonal, less the trim
+        char *upperSeqX = stString_copy(seqX);
+        for (int64_t i = 0; i < lX; i++) {
+            upperSeqX[i] = toupper(seqX[i]) == 'N' ? 'A' : toupper(seqX[i]);
+        }
+        anchorPairs = getSeedAnchorPairs(upperSeqX, upperSeqX, lX, lX, trim, 1);
+        if (lX >= 100) {
+            CuAssertIntEquals(testCase, lX - 2 * trim, stList_length(anchorPairs));
+            for (int64_t i = 0; i < stList_length(anchorPairs); i++) {
+                CuAssertIntEquals(testCase, i + trim, stIntTuple_get(stList_get(anchorPairs, i), 0));
+                CuAssertIntEquals(testCase, i + trim, stIntTuple_get(stList_get(anchorPairs, i), 1));
+            }
+        }
+        stList_destruct(anchorPairs);
+
+        //No seeds are taken from repeat masked sequence
+        char *lowerSeqX = stString_copy(upperSeqX);
+        for (int64_t i = 0; i < lX; i++) {
+            lowerSeqX[i] = tolower(upperSeqX[i]);
+        }
+        anchorPairs = getSeedAnchorPairs(lowerSeqX, lowerSeqX, lX, lX, trim, 1);
+        CuAssertIntEquals(testCase, 0, stList_length(anchorPairs));
+        stList_destruct(anchorPairs);
+        if (lX >= 100) {
+            anchorPairs = getSeedAnchorPairs(lowerSeqX, lowerSeqX, lX, lX, trim, 0);
+            CuAssertIntEquals(testCase, lX - 2 * trim, stList_length(anchorPairs));
+            stList_destruct(anchorPairs);
+        }
+
+        free(upperSeqX);
+        free(lowerSeqX);
+        free(seqX);
+        free(seqY);
+    }
+}
+
+static char *mutateSequence(const char *seq, int64_t length) {
+    /*
+     * Returns a copy of the sequence with one in ten bases substituted and an indel about every hundred bases. Unlike
+     * evolveSequence it takes time linear in the length, for long sequences.
+     */
+    char *mutatedSeq = st_malloc((2 * length + 1) * sizeof(char));
+    int64_t j = 0;
+    for (int64_t i = 0; i < length; i++) {
+        if (st_random() < 0.01) {
+            if (st_random() < 0.5) { //Delete
+                continue;
+            }
+            mutatedSeq[j++] = getRandomChar(); //Insert
+        }
+        mutatedSeq[j++] = st_random() < 0.1 ? getRandomChar() : seq[i];
+    }
+    mutatedSeq[j] = '\0';
+    return mutatedSeq;
+}
+
+static void test_getSeedAnchorPairsLong(CuTest *testCase) {
+    /*
+     * Checks a long pair, with many HSPs to chain, is anchored along its length. The time taken is logged rather than
+     * checked, as it depends on the machine. It is about 2.5 seconds, chaining the HSPs by a quadratic dp taking over
+     * ten times as long.
+     */
+    int64_t lX = 2000000;
+    char *seqX = getRandomSequence(lX);
+    char *seqY = mutateSequence(seqX, lX);
+    int64_t lY = strlen(seqY);
+    clock_t startTime = clock();
+    stList *anchorPairs = getSeedAnchorPairs(seqX, seqY, lX, lY, 0, 0);
+    double time = (double) (clock() - startTime) / CLOCKS_PER_SEC;
+    st_logInfo("Anchored a pair of length %" PRIi64 " with %" PRIi64 " pairs in %f seconds\n", lX,
+            stList_length(anchorPairs), time);
+    checkBlastPairs(testCase, anchorPairs, lX, lY, 1);
+    CuAssertTrue(testCase, stList_length(anchorPairs) > lX / 2);
+    stList_destruct(anchorPairs);
+    free(seqX);
+    free(seqY);
+}
+
+static void test_getMinimizerAnchorPairs(CuTest *testCase) {
+    /*
+     * Test the anchors from minimizer matches.
+     */
+    for (int64_t test = 0; test < 10; test++) {
+        char *seqX = getRandomSequence(st_randomInt(0, 10000));
+        char *seqY = evolveSequence(seqX);
+        int64_t lX = strlen(seqX), lY = strlen(seqY);
+        int64_t trim = st_randomInt(0, 5);
+        bool repeatMask = st_random() > 0.5;
+        stList *anchorPairs = getMinimizerAnchorPairs(seqX, seqY, lX, lY, trim, repeatMask);
+        checkBlastPairs(testCase, anchorPairs, lX, lY, 1);
+        stList_destruct(anchorPairs);
+
+        //An upper case sequence against itself is anchored along the main diagonal, from about its first minimizer to
+        //its last
+        char *upperSeqX = stString_copy(seqX);
+        for (int64_t i = 0; i < lX; i++) {
+            upperSeqX[i] = toupper(seqX[i]) == 'N' ? 'A' : toupper(seqX[i]);
+        }
+        anchorPairs = getMinimizerAnchorPairs(upperSeqX, upperSeqX, lX, lX, trim, 1);
+        if (lX >= 100) {
+            CuAssertTrue(testCase, stList_length(anchorPairs) >= lX - 2 * trim - 50);
+        }
+        for (int64_t i = 0; i < stList_length(anchorPairs); i++) {
+            stIntTuple *anchorPair = stList_get(anchorPairs, i);
+            CuAssertIntEquals(testCase, stIntTuple_get(anchorPair, 0), stIntTuple_get(anchorPair, 1));
+        }
+        stList_destruct(anchorPairs);
+
+        //No minimizers are taken from repeat masked sequence
+        char *lowerSeqX = stString_copy(upperSeqX);
+        for (int64_t i = 0; i < lX; i++) {
+            lowerSeqX[i] = tolower(upperSeqX[i]);
+        }
+        anchorPairs = getMinimizerAnchorPairs(lowerSeqX, lowerSeqX, lX, lX, trim, 1);
+        CuAssertIntEquals(testCase, 0, stList_length(anchorPairs));
+        stList_destruct(anchorPairs);
+
+        free(upperSeqX);
+        free(lowerSeqX);
+        free(seqX);
+        free(seqY);
+    }
+
+    //A sequence with an insertion longer than the maximum gap is anchored on one side of the insertion only
+    char *seqX = getRandomSequence(30000);
+    char *insert = getRandomSequence(MINIMIZER_ANCHORS_MAX_GAP + 5000);
+    char *seqY = stString_print("%.10000s%s%s", seqX, insert, seqX + 10000);
+    stList *anchorPairs = getMinimizerAnchorPairs(seqX, seqY, strlen(seqX), strlen(seqY), 0, 0);
+    checkBlastPairs(testCase, anchorPairs, strlen(seqX), strlen(seqY), 1);
+    CuAssertTrue(testCase, stList_length(anchorPairs) > 15000);
+    for (int64_t i = 1; i < stList_length(anchorPairs); i++) {
+        stIntTuple *anchorPair = stList_get(anchorPairs, i), *previousAnchorPair = stList_get(anchorPairs, i - 1);
+        CuAssertTrue(testCase, stIntTuple_get(anchorPair, 0) - stIntTuple_get(previousAnchorPair, 0) <= MINIMIZER_ANCHORS_MAX_GAP);
+        CuAssertTrue(testCase, stIntTuple_get(anchorPair, 1) - stIntTuple_get(previousAnchorPair, 1) <= MINIMIZER_ANCHORS_MAX_GAP);
+    }
+    stList_destruct(anchorPairs);
+    free(seqX);
+    free(insert);
+    free(seqY);
+}
+
+static void checkAnchorPairsEqual(CuTest *testCase, stList *anchorPairs, stList *anchorPairs2) {
+    CuAssertIntEquals(testCase, stList_length(anchorPairs), stList_length(anchorPairs2));
+    for (int64_t i = 0; i < stList_length(anchorPairs); i++) {
+        CuAssertTrue(testCase, stIntTuple_equalsFn(stList_get(anchorPairs, i), stList_get(anchorPairs2, i)));
+    }
+}
+
+static void test_seedIndex(CuTest *testCase) {
+    /*
+     * Checks anchoring many sequences against one index gives the anchors of indexing the sequence for each.
+     */
+    for (int64_t test = 0; test < 5; test++) {
+        char *seqX = getRandomSequence(st_randomInt(0, 10000));
+        int64_t lX = strlen(seqX);
+        int64_t trim = st_randomInt(0, 5);
+        bool repeatMask = test % 2;
+        SeedIndex *index = seedIndex_construct(seqX, lX, repeatMask);
+        SeedIndex *maskedIndex = seedIndex_construct(seqX, lX, 1);
+        PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+        for (int64_t i = 0; i < 5; i++) {
+            char *seqY = evolveSequence(seqX);
+            int64_t lY = strlen(seqY);
+            stList *anchorPairs = getSeedAnchorPairs(seqX, seqY, lX, lY, trim, repeatMask);
+            stList *anchorPairs2 = seedIndex_getAnchorPairs(index, seqY, lY, trim);
+            checkAnchorPairsEqual(testCase, anchorPairs, anchorPairs2);
+            stList_destruct(anchorPairs);
+            stList_destruct(anchorPairs2);
+
+            anchorPairs = getBlastPairsForPairwiseAlignmentParameters(seqX, seqY, lX, lY, p);
+            anchorPairs2 = getBlastPairsForPairwiseAlignmentParametersUsingIndex(seqX, seqY, lX, lY, maskedIndex, p);
+            checkAnchorPairsEqual(testCase, anchorPairs, anchorPairs2);
+            stList_destruct(anchorPairs);
+            stList_destruct(anchorPairs2);
+            free(seqY);
+        }
+        seedIndex_destruct(index);
+        seedIndex_destruct(maskedIndex);
+        pairwiseAlignmentBandingParameters_destruct(p);
+        free(seqX);
+    }
+}
+
+static void test_anchorCache(CuTest *testCase) {
+    /*
+     * Checks anchors are got back from the cache, in memory and from its directory, as they were added, and that the
+     * anchors found using a cache are those found without.
+     */
+    char *directory = getTempFile();
+    st_system("rm -f %s && mkdir %s", directory, directory);
+    AnchorCache *cache = anchorCache_construct(directory);
+    PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+    for (int64_t test = 0; test < 5; test++) {
+        char *seqX = getRandomSequence(st_randomInt(0, 10000));
+        char *seqY = evolveSequence(seqX);
+        int64_t lX = strlen(seqX), lY = strlen(seqY);
+        int64_t parameters[] = { test, 14 }, parameters2[] = { test, 15 };
+        CuAssertPtrEquals(testCase, NULL, anchorCache_get(cache, seqX, seqY, lX, lY, parameters, 2));
+
+        p->anchorMethod = test % 3;
+        p->anchorCache = NULL;
+        stList *anchorPairs = getBlastPairsForPairwiseAlignmentParameters(seqX, seqY, lX, lY, p);
+        anchorCache_add(cache, seqX, seqY, lX, lY, parameters, 2, anchorPairs);
+        stList *anchorPairs2 = anchorCache_get(cache, seqX, seqY, lX, lY, parameters, 2);
+        CuAssertTrue(testCase, anchorPairs2 != NULL);
+        checkAnchorPairsEqual(testCase, anchorPairs, anchorPairs2);
+        stList_destruct(anchorPairs2);
+        CuAssertPtrEquals(testCase, NULL, anchorCache_get(cache, seqX, seqY, lX, lY, parameters2, 2));
+        CuAssertPtrEquals(testCase, NULL, anchorCache_get(cache, seqY, seqX, lY, lX, parameters, 2));
+
+        //A new cache of the directory reads the anchors from their file
+        AnchorCache *cache2 = anchorCache_construct(directory);
+        anchorPairs2 = anchorCache_get(cache2, seqX, seqY, lX, lY, parameters, 2);
+        CuAssertTrue(testCase, anchorPairs2 != NULL);
+        checkAnchorPairsEqual(testCase, anchorPairs, anchorPairs2);
+        stList_destruct(anchorPairs2);
+        CuAssertIntEquals(testCase, 1, anchorCache_size(cache2));
+        anchorCache_destruct(cache2);
+
+        //Finding anchors with a cache, the first time and the second
+        cache2 = anchorCache_construct(NULL);
+        p->anchorCache = cache2;
+        for (int64_t i = 0; i < 2; i++) {
+            anchorPairs2 = getBlastPairsForPairwiseAlignmentParameters(seqX, seqY, lX, lY, p);
+            checkAnchorPairsEqual(testCase, anchorPairs, anchorPairs2);
+            stList_destruct(anchorPairs2);
+        }
+        CuAssertIntEquals(testCase, (int64_t) lX * lY > p->anchorMatrixBiggerThanThis, anchorCache_size(cache2));
+        anchorCache_destruct(cache2);
+
+        stList_destruct(anchorPairs);
+        free(seqX);
+        free(seqY);
+    }
+    CuAssertIntEquals(testCase, 5, anchorCache_size(cache));
+    anchorCache_destruct(cache);
+    pairwiseAlignmentBandingParameters_destruct(p);
+    st_system("rm -rf %s", directory);
+    free(directory);
+}
+
+static void checkCacheFileIsMiss(CuTest *testCase, const char *directory, const char *fileName, const uint8_t *bytes,
+        int64_t byteNumber, const char *seqX, int64_t lX, int64_t *parameters) {
+    /*
+     * Writes the bytes as the cache file and checks a new cache of the directory treats it as a miss.
+     */
+    FILE *fileHandle = fopen(fileName, "wb");
+    CuAssertTrue(testCase, fileHandle != NULL);
+    CuAssertIntEquals(testCase, byteNumber, fwrite(bytes, 1, byteNumber, fileHandle));
+    fclose(fileHandle);
+    AnchorCache *cache = anchorCache_construct(directory);
+    CuAssertPtrEquals(testCase, NULL, anchorCache_get(cache, seqX, seqX, lX, lX, parameters, 1));
+    CuAssertIntEquals(testCase, 0, anchorCache_size(cache));
+    anchorCache_destruct(cache);
+}
+
+static void test_anchorCacheFiles(CuTest *testCase) {
+    /*
+     * Checks truncated and corrupt cache files are misses, and that the entries of a cache in memory are bounded while
+     * those dropped from memory are still read from the directory.
+     */
+    char *directory = getTempFile();
+    st_system("rm -f %s && mkdir %s", directory, directory);
+    char *seqX = getRandomSequence(2000);
+    int64_t lX = strlen(seqX), parameters[] = { 0 };
+    stList *anchorPairs = getSeedAnchorPairs(seqX, seqX, lX, lX, 0, 0);
+    CuAssertTrue(testCase, stList_length(anchorPairs) > 0);
+    AnchorCache *cache = anchorCache_construct(directory);
+    anchorCache_add(cache, seqX, seqX, lX, lX, parameters, 1, anchorPairs);
+    anchorCache_destruct(cache);
+
+    //Read the file back
+    stList *fileNames = stFile_getFileNamesInDirectory(directory);
+    CuAssertIntEquals(testCase, 1, stList_length(fileNames));
+    char *fileName = stString_print("%s/%s", directory, stList_get(fileNames, 0));
+    stList_destruct(fileNames);
+    FILE *fileHandle = fopen(fileName, "rb");
+    CuAssertTrue(testCase, fileHandle != NULL);
+    uint8_t *bytes = st_malloc(stList_length(anchorPairs) * 20 + 1000);
+    int64_t byteNumber = fread(bytes, 1, stList_length(anchorPairs) * 20 + 1000, fileHandle);
+    fclose(fileHandle);
+
+    //The header ends with the number of bytes of the anchors, which are the rest of the file
+    int64_t anchorBytesStart = 8, anchorByteNumber = -1;
+    for (; anchorBytesStart <= byteNumber; anchorBytesStart++) {
+        memcpy(&anchorByteNumber, bytes + anchorBytesStart - 8, sizeof(int64_t));
+        if (anchorByteNumber == byteNumber - anchorBytesStart) {
+            break;
+        }
+    }
+    CuAssertTrue(testCase, anchorBytesStart < byteNumber);
+
+    //Truncated, in the anchors and in the header
+    checkCacheFileIsMiss(testCase, directory, fileName, bytes, byteNumber - 1, seqX, lX, parameters);
+    checkCacheFileIsMiss(testCase, directory, fileName, bytes, anchorBytesStart / 2, seqX, lX, parameters);
+    //Longer than the header says
+    bytes[byteNumber] = 0;
+    checkCacheFileIsMiss(testCase, directory, fileName, bytes, byteNumber + 1, seqX, lX, parameters);
+    //With a byte left over after the anchors
+    anchorByteNumber++;
+    memcpy(bytes + anchorBytesStart - 8, &anchorByteNumber, sizeof(int64_t));
+    checkCacheFileIsMiss(testCase, directory, fileName, bytes, byteNumber + 1, seqX, lX, parameters);
+    anchorByteNumber--;
+    memcpy(bytes + anchorBytesStart - 8, &anchorByteNumber, sizeof(int64_t));
+    //With the last anchor running past the end of the file
+    uint8_t lastByte = bytes[byteNumber - 1];
+    bytes[byteNumber - 1] = 0x80;
+    checkCacheFileIsMiss(testCase, directory, fileName, bytes, byteNumber, seqX, lX, parameters);
+    //With more bytes than the pairs could take
+    bytes[byteNumber - 1] = lastByte;
+    int64_t pairNumber = 1;
+    memcpy(bytes + anchorBytesStart - 16, &pairNumber, sizeof(int64_t));
+    checkCacheFileIsMiss(testCase, directory, fileName, bytes, byteNumber, seqX, lX, parameters);
+
+    //A cache limited to a little memory keeps few entries in memory, but gets all of them back
+    cache = anchorCache_construct2(directory, 5000);
+    for (int64_t i = 0; i < 20; i++) {
+        parameters[0] = i;
+        anchorCache_add(cache, seqX, seqX, lX, lX, parameters, 1, anchorPairs);
+        CuAssertTrue(testCase, anchorCache_size(cache) <= 5000 / (2 * stList_length(anchorPairs)));
+    }
+    for (int64_t i = 0; i < 20; i++) {
+        parameters[0] = i;
+        stList *anchorPairs2 = anchorCache_get(cache, seqX, seqX, lX, lX, parameters, 1);
+        CuAssertTrue(testCase, anchorPairs2 != NULL);
+        checkAnchorPairsEqual(testCase, anchorPairs, anchorPairs2);
+        stList_destruct(anchorPairs2);
+    }
+    anchorCache_destruct(cache);
+
+    stList_destruct(anchorPairs);
+    free(bytes);
+    free(fileName);
+    free(seqX);
+    st_system("rm -rf %s", directory);
+    free(directory);
+}
+
+static void test_threadedAnchorGaps(CuTest *testCase) {
+    /*
+     * Checks filling the gaps between the top level anchors on many threads gives the anchors of filling them on one.
+     */
+    for (int64_t test = 0; test < 6; test++) {
+        char *seqX = getRandomSequence(st_randomInt(1000, 10000));
+        char *seqY = evolveSequence(seqX);
+        int64_t lX = strlen(seqX), lY = strlen(seqY);
+        PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+        p->anchorMethod = test % 3;
+        p->anchorMatrixBiggerThanThis = 0;
+        p->repeatMaskMatrixBiggerThanThis = st_randomInt(0, 100 * 100);
+        stList *anchorPairs = getBlastPairsForPairwiseAlignmentParameters(seqX, seqY, lX, lY, p);
+        checkBlastPairs(testCase, anchorPairs, lX, lY, 1);
+        p->threadNumber = st_randomInt(2, 8);
+        stList *anchorPairs2 = getBlastPairsForPairwiseAlignmentParameters(seqX, seqY, lX, lY, p);
+        checkAnchorPairsEqual(testCase, anchorPairs, anchorPairs2);
+        stList_destruct(anchorPairs);
+        stList_destruct(anchorPairs2);
+        pairwiseAlignmentBandingParameters_destruct(p);
+        free(seqX);
+        free(seqY);
+    }
+}
+
 static void test_filterToRemoveOverlap(CuTest *testCase) {
     for (int64_t i = 0; i < 100; i++) {
         //Make random pairs
@@ -523,11 +1431,13 @@ static void test_getBlastPairsWithRecursion(CuTest *testCase) {
         st_logInfo("Sequence Y to align: %s END, seq length %" PRIi64 "\n", seqY, lY);
 
         PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+        p->anchorMethod = test % 3 == 0 ? seedAnchors : (test % 3 == 1 ? lastzAnchors : minimizerAnchors);
 
         stList *blastPairs = getBlastPairsForPairwiseAlignmentParameters(seqX, seqY, lX, lY, p);
 
         checkBlastPairs(testCase, blastPairs, lX, lY, 1);
         stList_destruct(blastPairs);
+        pairwiseAlignmentBandingParameters_destruct(p);
         free(seqX);
         free(seqY);
     }
@@ -631,6 +1541,172 @@ static void test_getAlignedPairs(CuTest *testCase) {
     }
 }
 
+static void test_alignedPairArray(CuTest *testCase) {
+    //Appending, enough pairs to make the array grow
+    AlignedPairArray *alignedPairs = alignedPairArray_construct();
+    for (int64_t i = 0; i < 1000; i++) {
+        alignedPairArray_append(alignedPairs, i, 2 * i, 3 * i);
+    }
+    CuAssertIntEquals(testCase, 1000, alignedPairs->length);
+    CuAssertTrue(testCase, alignedPairs->maxLength >= 1000);
+
+    //Appending one array to another shifts its coordinates
+    AlignedPairArray *alignedPairs2 = alignedPairArray_construct();
+    alignedPairArray_appendArray(alignedPairs2, alignedPairs, 10, 20);
+    alignedPairArray_appendArray(alignedPairs2, alignedPairs, 0, 0);
+    CuAssertIntEquals(testCase, 2000, alignedPairs2->length);
+    stList *alignedPairList = alignedPairArray_getList(alignedPairs2);
+    CuAssertIntEquals(testCase, 2000, stList_length(alignedPairList));
+    for (int64_t i = 0; i < 2000; i++) {
+        stIntTuple *pair = stList_get(alignedPairList, i);
+        int64_t j = i % 1000, offset = i < 1000;
+        CuAssertIntEquals(testCase, j, stIntTuple_get(pair, 0));
+        CuAssertIntEquals(testCase, 2 * j + 10 * offset, stIntTuple_get(pair, 1));
+        CuAssertIntEquals(testCase, 3 * j + 20 * offset, stIntTuple_get(pair, 2));
+    }
+    stList_destruct(alignedPairList);
+    alignedPairArray_clear(alignedPairs2);
+    CuAssertIntEquals(testCase, 0, alignedPairs2->length);
+    alignedPairArray_destruct(alignedPairs);
+    alignedPairArray_destruct(alignedPairs2);
+
+    //The array and list returning aligners agree
+    for (int64_t test = 0; test < 10; test++) {
+        char *sX = getRandomSequence(st_randomInt(0, 500));
+        char *sY = evolveSequence(sX);
+        PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+        p->splitMatrixBiggerThanThis = st_randomInt(0, 2) ? 10 * 10 : p->splitMatrixBiggerThanThis;
+        StateMachine *sM = stateMachine5_construct(fiveState);
+        alignedPairs = getAlignedPairArray(sM, sX, sY, p, 0, 0);
+        alignedPairList = getAlignedPairs(sM, sX, sY, p, 0, 0);
+        CuAssertIntEquals(testCase, stList_length(alignedPairList), alignedPairs->length);
+        for (int64_t i = 0; i < alignedPairs->length; i++) {
+            stIntTuple *pair = stList_get(alignedPairList, i);
+            CuAssertIntEquals(testCase, stIntTuple_get(pair, 0), alignedPairs->scores[i]);
+            CuAssertIntEquals(testCase, stIntTuple_get(pair, 1), alignedPairs->x[i]);
+            CuAssertIntEquals(testCase, stIntTuple_get(pair, 2), alignedPairs->y[i]);
+        }
+        checkAlignedPairs(testCase, alignedPairList, strlen(sX), strlen(sY));
+        alignedPairArray_destruct(alignedPairs);
+        stList_destruct(alignedPairList);
+        stateMachine_destruct(sM);
+        pairwiseAlignmentBandingParameters_destruct(p);
+        free(sX);
+        free(sY);
+    }
+}
+
+static void getTotalProbability(StateMachine *sM, int64_t xay, DpMatrix *forwardDpMatrix, DpMatrix *backwardDpMatrix,
+        const SymbolString sX, const SymbolString sY, double totalProbability, PairwiseAlignmentParameters *p,
+        void *extraArgs) {
+    *((double *) extraArgs) = totalProbability;
+}
+
+static void checkAlignmentOperations(CuTest *testCase, struct List *alignmentOperations, int64_t lX, int64_t lY,
+        stSortedSet *matches) {
+    //The operations must cover both sequences, with no two consecutive operations of the same type. The matched pairs
+    //are added to matches.
+    int64_t x = 0, y = 0;
+    for (int64_t i = 0; i < alignmentOperations->length; i++) {
+        struct AlignmentOperation *operation = alignmentOperations->list[i];
+        CuAssertTrue(testCase, operation->length > 0);
+        if (i > 0) {
+            CuAssertTrue(testCase, operation->opType != ((struct AlignmentOperation *) alignmentOperations->list[i - 1])->opType);
+        }
+        for (int64_t j = 0; j < operation->length; j++) {
+            if (operation->opType == PAIRWISE_MATCH) {
+                stSortedSet_insert(matches, stIntTuple_construct2(x, y));
+            }
+            x += operation->opType != PAIRWISE_INDEL_Y;
+            y += operation->opType != PAIRWISE_INDEL_X;
+        }
+    }
+    CuAssertIntEquals(testCase, lX, x);
+    CuAssertIntEquals(testCase, lY, y);
+}
+
+static void test_viterbiAlignment(CuTest *testCase) {
+    int64_t confidentPairs = 0, confidentPairsInViterbiAlignment = 0, splitAlignments = 0;
+    for (int64_t test = 0; test < 100; test++) {
+        char *sX = getRandomSequence(st_randomInt(0, 200));
+        char *sY = test % 10 == 0 ? stString_copy(sX) : evolveSequence(sX);
+        int64_t lX = strlen(sX), lY = strlen(sY);
+        PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+        StateMachine *sM = test % 2 ? stateMachine5_construct(fiveState) : stateMachine3_construct(threeState);
+        stList *anchorPairs = getRandomAnchorPairs(lX, lY);
+        double score;
+        struct List *alignmentOperations = getViterbiAlignmentUsingAnchors(sM, sX, sY, anchorPairs, p, 0, 0, &score);
+
+        stSortedSet *matches = stSortedSet_construct3((int (*)(const void *, const void *)) stIntTuple_cmpFn,
+                (void (*)(void *)) stIntTuple_destruct);
+        checkAlignmentOperations(testCase, alignmentOperations, lX, lY, matches);
+
+        //The alignment is one of those summed over by the forward calculation, so is no more probable than all of them
+        SymbolString sX2 = symbolString_construct(sX, lX);
+        SymbolString sY2 = symbolString_construct(sY, lY);
+        double totalProbability = 0.0;
+        getPosteriorProbsWithBanding(sM, anchorPairs, sX2, sY2, p, 0, 0, getTotalProbability, &totalProbability);
+        CuAssertTrue(testCase, score <= totalProbability + 0.001);
+
+        //A wider band can only give a better alignment
+        stList *noAnchorPairs = stList_construct();
+        double unbandedScore;
+        struct List *unbandedAlignmentOperations = getViterbiAlignmentUsingAnchors(sM, sX, sY, noAnchorPairs, p, 0, 0,
+                &unbandedScore);
+        CuAssertTrue(testCase, unbandedScore >= score - 0.000001);
+        if (test % 10 == 0 && lX > 0) { //Identical sequences align with one match
+            CuAssertIntEquals(testCase, 1, unbandedAlignmentOperations->length);
+        }
+        destructList(unbandedAlignmentOperations);
+
+        //Split at large gaps, the alignment still covers both sequences, with or without ragged ends
+        p->splitMatrixBiggerThanThis = st_randomInt(10, 1000);
+        bool raggedLeftEnd = st_random() > 0.5, raggedRightEnd = st_random() > 0.5;
+        stList *splitPoints = getSplitPoints(noAnchorPairs, lX, lY, p->splitMatrixBiggerThanThis, raggedLeftEnd,
+                raggedRightEnd);
+        splitAlignments += stList_length(splitPoints) > 1;
+        stList_destruct(splitPoints);
+        double splitScore;
+        struct List *splitAlignmentOperations = getViterbiAlignmentUsingAnchors(sM, sX, sY, noAnchorPairs, p,
+                raggedLeftEnd, raggedRightEnd, &splitScore);
+        stSortedSet *splitMatches = stSortedSet_construct3((int (*)(const void *, const void *)) stIntTuple_cmpFn,
+                (void (*)(void *)) stIntTuple_destruct);
+        checkAlignmentOperations(testCase, splitAlignmentOperations, lX, lY, splitMatches);
+        stSortedSet_destruct(splitMatches);
+        destructList(splitAlignmentOperations);
+        p->splitMatrixBiggerThanThis = (int64_t) 3000 * 3000;
+
+        //Nearly all confidently aligned pairs are matched by the alignment
+        stList *alignedPairs = getAlignedPairsUsingAnchors(sM, sX, sY, anchorPairs, p, 0, 0);
+        for (int64_t i = 0; i < stList_length(alignedPairs); i++) {
+            stIntTuple *pair = stList_get(alignedPairs, i);
+            if (stIntTuple_get(pair, 0) >= 0.9 * PAIR_ALIGNMENT_PROB_1) {
+                stIntTuple *xy = stIntTuple_construct2(stIntTuple_get(pair, 1), stIntTuple_get(pair, 2));
+                confidentPairs++;
+                confidentPairsInViterbiAlignment += stSortedSet_search(matches, xy) != NULL;
+                stIntTuple_destruct(xy);
+            }
+        }
+
+        //Cleanup
+        stList_destruct(alignedPairs);
+        stList_destruct(noAnchorPairs);
+        stList_destruct(anchorPairs);
+        stSortedSet_destruct(matches);
+        destructList(alignmentOperations);
+        symbolString_destruct(sX2);
+        symbolString_destruct(sY2);
+        stateMachine_destruct(sM);
+        pairwiseAlignmentBandingParameters_destruct(p);
+        free(sX);
+        free(sY);
+    }
+    st_logInfo("%" PRIi64 " of %" PRIi64 " confident pairs are in the Viterbi alignments\n",
+            confidentPairsInViterbiAlignment, confidentPairs);
+    CuAssertTrue(testCase, confidentPairsInViterbiAlignment >= 0.99 * confidentPairs);
+    CuAssertTrue(testCase, splitAlignments > 0);
+}
+
 static void test_getAlignedPairsWithRaggedEnds(CuTest *testCase) {
     for (int64_t test = 0; test < 1000; test++) {
         //Make a pair of sequences
@@ -836,17 +1912,37 @@ CuSuite* pairwiseAlignmentTestSuite(void) {
     SUITE_ADD_TEST(suite, test_diagonal);
     SUITE_ADD_TEST(suite, test_bands);
     SUITE_ADD_TEST(suite, test_logAdd);
+    SUITE_ADD_TEST(suite, test_logAddPrecisions);
     SUITE_ADD_TEST(suite, test_symbol);
+    SUITE_ADD_TEST(suite, test_symbolString);
     SUITE_ADD_TEST(suite, test_cell);
+    SUITE_ADD_TEST(suite, test_cellFusedTransitions);
     SUITE_ADD_TEST(suite, test_dpDiagonal);
     SUITE_ADD_TEST(suite, test_dpMatrix);
     SUITE_ADD_TEST(suite, test_diagonalDPCalculations);
+    SUITE_ADD_TEST(suite, test_diagonalCalculationKernels);
     SUITE_ADD_TEST(suite, test_getAlignedPairsWithBanding);
+    SUITE_ADD_TEST(suite, test_scaledProbabilities);
+    SUITE_ADD_TEST(suite, test_threadedProbabilities);
+    SUITE_ADD_TEST(suite, test_threadedSplitRegions);
+    SUITE_ADD_TEST(suite, test_batchAlignments);
+    SUITE_ADD_TEST(suite, test_adaptiveBand);
+    SUITE_ADD_TEST(suite, test_backwardBandDrop);
+    SUITE_ADD_TEST(suite, test_checkpointedProbabilities);
     SUITE_ADD_TEST(suite, test_getBlastPairs);
     SUITE_ADD_TEST(suite, test_getBlastPairsWithRecursion);
     SUITE_ADD_TEST(suite, test_filterToRemoveOverlap);
+    SUITE_ADD_TEST(suite, test_getSeedAnchorPairs);
+    SUITE_ADD_TEST(suite, test_getSeedAnchorPairsLong);
+    SUITE_ADD_TEST(suite, test_seedIndex);
+    SUITE_ADD_TEST(suite, test_getMinimizerAnchorPairs);
+    SUITE_ADD_TEST(suite, test_anchorCache);
+    SUITE_ADD_TEST(suite, test_anchorCacheFiles);
+    SUITE_ADD_TEST(suite, test_threadedAnchorGaps);
     SUITE_ADD_TEST(suite, test_getSplitPoints);
     SUITE_ADD_TEST(suite, test_getAlignedPairs);
+    SUITE_ADD_TEST(suite, test_alignedPairArray);
+    SUITE_ADD_TEST(suite, test_viterbiAlignment);
     SUITE_ADD_TEST(suite, test_getAlignedPairsWithRaggedEnds);
     SUITE_ADD_TEST(suite, test_hmm_5State);
     SUITE_ADD_TEST(suite, test_hmm_5StateAsymmetric);
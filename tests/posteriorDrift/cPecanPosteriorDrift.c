@@ -0,0 +1,207 @@
+/*
+ * Reports how far the posterior match probabilities computed by this build drift from those of another build. The
+ * first sequence of the fasta file is aligned to each of the others, for example the human, chimp, mouse and dog
+ * sequences of tests/pairwiseAlignerLongTest.c.
+ *
+ * It is a developer tool, built by "make posteriorDrift" rather than by "make all". To measure the drift of storing
+ * the dp in floats (see DpValue in simd.h), build normally and write the posteriors of the double precision dp:
+ *
+ *     cPecanPosteriorDrift --write reference.txt seqs.fa
+ *
+ * then rebuild with -DDP_FLOAT and compare against them:
+ *
+ *     cPecanPosteriorDrift --compare reference.txt seqs.fa
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+
+#include "sonLib.h"
+#include "bioioC.h"
+#include "pairwiseAligner.h"
+
+static void usage() {
+    fprintf(stderr, "cPecanPosteriorDrift [options] fasta_file\n");
+    fprintf(stderr, "Computes the posterior match probabilities of the first sequence of the fasta file aligned to each of the others and writes or compares them\n");
+    fprintf(stderr, "-a --logLevel : Set the log level\n");
+    fprintf(stderr, "-w --write [FILE] : Write the posteriors to the given file, each line being pair name, x, y, posterior\n");
+    fprintf(stderr, "-c --compare [FILE] : Report the drift of the posteriors from those in the given file, as written by --write\n");
+    fprintf(stderr, "-S --scaledProbabilities : Do the dp with scaled probabilities rather than log probabilities\n");
+    fprintf(stderr, "-h --help : Print this help screen\n");
+}
+
+static stList *getPosteriors(char *seq1, char *seq2, bool scaledProbabilities) {
+    StateMachine *sM = stateMachine5_construct(fiveState);
+    PairwiseAlignmentParameters *p = pairwiseAlignmentBandingParameters_construct();
+    p->scaledProbabilities = scaledProbabilities;
+    stList *alignedPairs = getAlignedPairs(sM, seq1, seq2, p, 0, 0);
+    pairwiseAlignmentBandingParameters_destruct(p);
+    stateMachine_destruct(sM);
+    return alignedPairs;
+}
+
+static stHash *readPosteriors(char *name, FILE *fileHandle) {
+    /*
+     * Reads the posteriors of the named pair, as written by --write, into a hash from (x, y) to posterior.
+     */
+    stHash *posteriors = stHash_construct3((uint64_t (*)(const void *)) stIntTuple_hashKey,
+            (int (*)(const void *, const void *)) stIntTuple_equalsFn, (void (*)(void *)) stIntTuple_destruct,
+            (void (*)(void *)) stIntTuple_destruct);
+    rewind(fileHandle);
+    char *line;
+    while ((line = stFile_getLineFromFile(fileHandle)) != NULL) {
+        char name2[128];
+        int64_t x, y, score;
+        if (sscanf(line, "%127s %" SCNi64 " %" SCNi64 " %" SCNi64, name2, &x, &y, &score) != 4) {
+            st_errAbort("Could not parse the posterior line: %s", line);
+        }
+        if (strcmp(name, name2) == 0) {
+            stHash_insert(posteriors, stIntTuple_construct2(x, y), stIntTuple_construct1(score));
+        }
+        free(line);
+    }
+    return posteriors;
+}
+
+static void comparePosteriors(char *name, stList *alignedPairs, FILE *fileHandle) {
+    /*
+     * Reports the maximum and mean absolute differences between the posteriors and those in the file. A pair
+     * which is only above the posterior threshold in one of them counts as having a posterior of 0 in the other.
+     */
+    stHash *referencePosteriors = readPosteriors(name, fileHandle);
+    int64_t referencePairs = stHash_size(referencePosteriors), onlyHere = 0;
+    double maxDrift = 0.0, totalDrift = 0.0;
+    for (int64_t i = 0; i < stList_length(alignedPairs); i++) {
+        stIntTuple *alignedPair = stList_get(alignedPairs, i);
+        stIntTuple *pair = stIntTuple_construct2(stIntTuple_get(alignedPair, 1), stIntTuple_get(alignedPair, 2));
+        stIntTuple *referenceScore = stHash_removeAndFreeKey(referencePosteriors, pair);
+        int64_t score = 0;
+        if (referenceScore == NULL) {
+            onlyHere++;
+        } else {
+            score = stIntTuple_get(referenceScore, 0);
+            stIntTuple_destruct(referenceScore);
+        }
+        double drift = fabs((double) (stIntTuple_get(alignedPair, 0) - score) / PAIR_ALIGNMENT_PROB_1);
+        maxDrift = drift > maxDrift ? drift : maxDrift;
+        totalDrift += drift;
+        stIntTuple_destruct(pair);
+    }
+    //What is left is only in the reference
+    int64_t onlyInReference = stHash_size(referencePosteriors);
+    stHashIterator *it = stHash_getIterator(referencePosteriors);
+    stIntTuple *pair;
+    while ((pair = stHash_getNext(it)) != NULL) {
+        double drift = (double) stIntTuple_get(stHash_search(referencePosteriors, pair), 0) / PAIR_ALIGNMENT_PROB_1;
+        maxDrift = drift > maxDrift ? drift : maxDrift;
+        totalDrift += drift;
+    }
+    stHash_destructIterator(it);
+    stHash_destruct(referencePosteriors);
+    int64_t pairNumber = stList_length(alignedPairs) + onlyInReference;
+    fprintf(stdout,
+            "%s: %" PRIi64 " pairs (%" PRIi64 " in the reference), %" PRIi64 " only here, %" PRIi64
+            " only in the reference, max drift %.3g, mean drift %.3g\n", name, stList_length(alignedPairs), referencePairs,
+            onlyHere, onlyInReference, maxDrift, pairNumber > 0 ? totalDrift / pairNumber : 0.0);
+}
+
+int main(int argc, char *argv[]) {
+    char *logLevelString = NULL;
+    char *writeFile = NULL;
+    char *compareFile = NULL;
+    bool scaledProbabilities = 0;
+
+    while (1) {
+        static struct option long_options[] = { { "logLevel", required_argument, 0, 'a' }, { "help", no_argument, 0, 'h' },
+                { "write", required_argument, 0, 'w' }, { "compare", required_argument, 0, 'c' },
+                { "scaledProbabilities", no_argument, 0, 'S' }, { 0, 0, 0, 0 } };
+
+        int option_index = 0;
+
+        int key = getopt_long(argc, argv, "a:hw:c:S", long_options, &option_index);
+
+        if (key == -1) {
+            break;
+        }
+
+        switch (key) {
+        case 'a':
+            logLevelString = stString_copy(optarg);
+            st_setLogLevelFromString(logLevelString);
+            break;
+        case 'h':
+            usage();
+            return 0;
+        case 'w':
+            writeFile = stString_copy(optarg);
+            break;
+        case 'c':
+            compareFile = stString_copy(optarg);
+            break;
+        case 'S':
+            scaledProbabilities = 1;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if ((writeFile == NULL) == (compareFile == NULL) || optind != argc - 1) {
+        usage();
+        return 1;
+    }
+    FILE *fastaHandle = fopen(argv[optind], "r");
+    if (fastaHandle == NULL) {
+        st_errnoAbort("Could not open fasta file %s", argv[optind]);
+    }
+    struct List *seqs = constructEmptyList(0, free);
+    struct List *seqLengths = constructEmptyList(0, free);
+    struct List *headers = constructEmptyList(0, free);
+    fastaRead(fastaHandle, seqs, seqLengths, headers);
+    fclose(fastaHandle);
+    if (seqs->length < 2) {
+        st_errAbort("The fasta file %s has fewer than two sequences", argv[optind]);
+    }
+    //Pairs are named by the first words of the headers of their sequences
+    stList *names = stList_construct3(0, free);
+    for (int64_t i = 0; i < headers->length; i++) {
+        stList *headerTokens = stString_splitByString(headers->list[i], " ");
+        stList_append(names, stString_copy(stList_get(headerTokens, 0)));
+        stList_destruct(headerTokens);
+    }
+
+    FILE *fileHandle = fopen(writeFile != NULL ? writeFile : compareFile, writeFile != NULL ? "w" : "r");
+    if (fileHandle == NULL) {
+        st_errnoAbort("Could not open the posteriors file %s", writeFile != NULL ? writeFile : compareFile);
+    }
+    fprintf(stdout, "dp values are %s, dp uses %s\n", sizeof(DpValue) == sizeof(float) ? "floats" : "doubles",
+            scaledProbabilities ? "scaled probabilities" : "log probabilities");
+
+    for (int64_t i = 1; i < seqs->length; i++) {
+        char *name = stString_print("%s-%s", stList_get(names, 0), stList_get(names, i));
+        stList *alignedPairs = getPosteriors(seqs->list[0], seqs->list[i], scaledProbabilities);
+        if (writeFile != NULL) {
+            for (int64_t j = 0; j < stList_length(alignedPairs); j++) {
+                stIntTuple *alignedPair = stList_get(alignedPairs, j);
+                fprintf(fileHandle, "%s %" PRIi64 " %" PRIi64 " %" PRIi64 "\n", name, stIntTuple_get(alignedPair, 1),
+                        stIntTuple_get(alignedPair, 2), stIntTuple_get(alignedPair, 0));
+            }
+            fprintf(stdout, "%s: wrote %" PRIi64 " pairs\n", name, stList_length(alignedPairs));
+        } else {
+            comparePosteriors(name, alignedPairs, fileHandle);
+        }
+        stList_destruct(alignedPairs);
+        free(name);
+    }
+
+    fclose(fileHandle);
+    stList_destruct(names);
+    destructList(seqs);
+    destructList(seqLengths);
+    destructList(headers);
+    free(writeFile);
+    free(compareFile);
+    free(logLevelString);
+    return 0;
+}